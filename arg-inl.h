@@ -7,6 +7,16 @@
 #ifndef ARG_INL_H_
 #define ARG_INL_H_
 
+/**
+ * Access port list.
+ *
+ * @return list of port ranges
+ */
+inline const portlist_t & Arg::ports() const
+{
+    return m_settings.ports;
+}
+
 /**
  * Access `begin' of port list.
  *
@@ -14,7 +24,7 @@
  */
 inline portlist_t::const_iterator Arg::ports_begin() const
 {
-    return m_ports.begin();
+    return m_settings.ports.begin();
 }
 
 /**
@@ -24,7 +34,7 @@ inline portlist_t::const_iterator Arg::ports_begin() const
  */
 inline portlist_t::const_iterator Arg::ports_end() const
 {
-    return m_ports.end();
+    return m_settings.ports.end();
 }
 
 /**
@@ -44,7 +54,7 @@ inline const std::string & Arg::filename() const
  */
 inline const delay_t Arg::delay() const
 {
-    return m_delay;
+    return m_settings.delay;
 }
 
 /**
@@ -54,7 +64,117 @@ inline const delay_t Arg::delay() const
  */
 inline bool Arg::verbose() const
 {
-    return m_verbose;
+    return m_settings.verbose;
+}
+
+/**
+ * Get number of probes which can run in parallel.
+ *
+ * @return maximum count of probes in flight
+ */
+inline unsigned Arg::parallel() const
+{
+    return m_settings.parallel;
+}
+
+/**
+ * Get path of the socket to listen on in daemon mode.
+ *
+ * @return socket path, empty if not running as a daemon
+ */
+inline const std::string & Arg::daemon() const
+{
+    return m_daemon;
+}
+
+/**
+ * Get file to store port states to.
+ *
+ * @return file name, empty if states are not stored
+ */
+inline const std::string & Arg::store() const
+{
+    return m_store;
+}
+
+/**
+ * Get file with port states to be queried.
+ *
+ * @return file name, empty if not querying
+ */
+inline const std::string & Arg::query_file() const
+{
+    return m_query_file;
+}
+
+/**
+ * Get query of port states.
+ *
+ * @return query, e.g. "22=open,23=closed"
+ */
+inline const std::string & Arg::query() const
+{
+    return m_query;
+}
+
+/**
+ * Get specification of simulated network.
+ *
+ * @return specification, empty if the real network is scanned
+ */
+inline const std::string & Arg::simulate() const
+{
+    return m_simulate;
+}
+
+/**
+ * Get file with translations shared across runs.
+ *
+ * @return file name, empty if translations are not shared
+ */
+inline const std::string & Arg::dns_cache() const
+{
+    return m_dns_cache;
+}
+
+/**
+ * Get file where counters of the scan are published.
+ *
+ * @return file name, empty if counters are not published
+ */
+inline const std::string & Arg::stats() const
+{
+    return m_stats;
+}
+
+/**
+ * Get stats file of a scan whose progress is to be printed.
+ *
+ * @return file name, empty if no scan is watched
+ */
+inline const std::string & Arg::watch() const
+{
+    return m_watch;
+}
+
+/**
+ * Get stats file of a scan whose counters are to be printed as metrics.
+ *
+ * @return file name, empty if no metrics are printed
+ */
+inline const std::string & Arg::metrics() const
+{
+    return m_metrics;
+}
+
+/**
+ * Get options of the scan.
+ *
+ * @return scan options
+ */
+inline const Settings & Arg::settings() const
+{
+    return m_settings;
 }
 
 #endif // ARG_INL_H_
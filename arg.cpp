@@ -12,16 +12,350 @@
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
+#include <algorithm>
 
 #include "tcpsearch.h"
+#include "ports.h"
+#include "simnet.h"
+
+/**
+ * Default count of probes in flight when running as a daemon.
+ */
+static const unsigned kDaemonParallel = 64;
+
+/**
+ * Default bounds of adaptive connect timeout in milliseconds.
+ */
+static const msec_t kMinTimeout = 50;
+static const msec_t kMaxTimeout = 10000;
+
+/**
+ * Upper limit for timeouts given in milliseconds.
+ */
+static const unsigned kTimeoutLimit = 3600 * 1000;
+
+/**
+ * Upper limit for time budget of a scan, milliseconds.
+ */
+static const msec_t kDeadlineLimit = 30ULL * 24 * 3600 * 1000;
+
+/**
+ * Default time to wait for reverse lookup of a host, milliseconds.
+ */
+static const msec_t kRdnsTimeout = 2000;
+
+/**
+ * Upper limit for probe rate per subnet, probes per second.
+ */
+static const unsigned kRateLimit = 1000000;
+
+/**
+ * Default prefix lengths of subnets which are rate limited.
+ */
+static const unsigned kPrefix4 = 24;
+static const unsigned kPrefix6 = 64;
+
+/**
+ * Release port ranges stored in list.
+ *
+ * @param  ports list to be cleared
+ * @return void
+ */
+void free_ports(portlist_t & ports)
+{
+    for (portlist_t::iterator it = ports.begin();
+            it != ports.end();
+            it = ports.erase(it)) {
+        delete *it;
+    }
+}
+
+/**
+ * Constructor.
+ */
+Settings::Settings()
+{
+    delay = 0;
+    verbose = false;
+    parallel = 0;
+    order = ORDER_NUMERIC;
+    top = 0;
+    max_open = 0;
+    stop_after = 0;
+    down_after = 0;
+    retries = 0;
+    min_timeout = 0;
+    max_timeout = 0;
+    subnet_rate = 0;
+    prefix4 = kPrefix4;
+    prefix6 = kPrefix6;
+    deadline = 0;
+    ordered = false;
+    rdns = false;
+    rdns_timeout = 0;
+}
+
+/**
+ * Destructor.
+ */
+Settings::~Settings()
+{
+    free_ports(ports);
+    free_ports(pre_ports);
+    free_ports(tls_ports);
+    free_ports(dialog_ports);
+}
+
+/**
+ * Parse scan option at argv[i], advance i past its value.
+ *
+ * @param   argc argument count
+ * @param   argv argument vector
+ * @param   i index of the option
+ * @param   err output stream for error messages
+ * @return  PARSE_UNKNOWN if argv[i] is not a scan option
+ */
+Settings::parse_t Settings::parse(int argc, const char * const argv[], int & i,
+                                  std::ostream & err)
+{
+    const char * opt = argv[i];
+
+    if (! strcmp(opt, "-v")) {
+        if (verbose) {
+            err << "Err: bad arguments\n";
+            return PARSE_ERROR;
+        }
+
+        verbose = true;
+        return PARSE_OK;
+    }
+
+    if (! strcmp(opt, "--ordered")) {
+        if (ordered) {
+            err << "Err: bad arguments\n";
+            return PARSE_ERROR;
+        }
+
+        ordered = true;
+        return PARSE_OK;
+    }
+
+    if (! strcmp(opt, "--rdns")) {
+        if (rdns) {
+            err << "Err: bad arguments\n";
+            return PARSE_ERROR;
+        }
+
+        rdns = true;
+        return PARSE_OK;
+    }
+
+    if (strcmp(opt, "-t") && strcmp(opt, "-p") && strcmp(opt, "-j")
+            && strcmp(opt, "--order") && strcmp(opt, "--top")
+            && strcmp(opt, "--max-open-per-host") && strcmp(opt, "--stop-after")
+            && strcmp(opt, "--down-after") && strcmp(opt, "--pre-probe")
+            && strcmp(opt, "--min-timeout") && strcmp(opt, "--max-timeout")
+            && strcmp(opt, "--retries") && strcmp(opt, "--max-rate-per-subnet")
+            && strcmp(opt, "--subnet-prefix") && strcmp(opt, "--deadline")
+            && strcmp(opt, "--rdns-timeout") && strcmp(opt, "--tls")
+            && strcmp(opt, "--dialog"))
+        return PARSE_UNKNOWN;
+
+    // all other options have a value
+    if (++i == argc) {
+        if (! strcmp(opt, "-t"))
+            err << "Err: no time specified\n";
+        else if (! strcmp(opt, "-p") || ! strcmp(opt, "--pre-probe")
+                || ! strcmp(opt, "--tls") || ! strcmp(opt, "--dialog"))
+            err << "Err: no ports specified\n";
+        else if (! strcmp(opt, "--order"))
+            err << "Err: no order specified\n";
+        else if (! strcmp(opt, "--min-timeout") || ! strcmp(opt, "--max-timeout")
+                || ! strcmp(opt, "--deadline") || ! strcmp(opt, "--rdns-timeout"))
+            err << "Err: no time specified\n";
+        else if (! strcmp(opt, "--max-rate-per-subnet"))
+            err << "Err: no rate specified\n";
+        else if (! strcmp(opt, "--subnet-prefix"))
+            err << "Err: no prefix length specified\n";
+        else
+            err << "Err: no count specified\n";
+
+        return PARSE_ERROR;
+    }
+
+    const char * value = argv[i];
+
+    if (! strcmp(opt, "-t")) {
+        if (! Arg::parse_time(value, delay)) {
+            err << "Err: bad time delay specified\n";
+            return PARSE_ERROR;
+        }
+    } else if (! strcmp(opt, "-p")) {
+        if (! Arg::parse_ports(value, ports)) {
+            err << "Err: bad port range\n";
+            return PARSE_ERROR;
+        }
+    } else if (! strcmp(opt, "--pre-probe")) {
+        if (! Arg::parse_ports(value, pre_ports)) {
+            err << "Err: bad port range\n";
+            return PARSE_ERROR;
+        }
+    } else if (! strcmp(opt, "--tls")) {
+        if (! Arg::parse_ports(value, tls_ports)) {
+            err << "Err: bad port range\n";
+            return PARSE_ERROR;
+        }
+    } else if (! strcmp(opt, "--dialog")) {
+        if (! Arg::parse_ports(value, dialog_ports)) {
+            err << "Err: bad port range\n";
+            return PARSE_ERROR;
+        }
+    } else if (! strcmp(opt, "--min-timeout") || ! strcmp(opt, "--max-timeout")) {
+        unsigned timeout;
+
+        if (! Arg::parse_count(value, timeout, kTimeoutLimit)) {
+            err << "Err: bad time delay specified\n";
+            return PARSE_ERROR;
+        }
+
+        if (! strcmp(opt, "--min-timeout"))
+            min_timeout = timeout;
+        else
+            max_timeout = timeout;
+    } else if (! strcmp(opt, "--rdns-timeout")) {
+        unsigned timeout;
+
+        if (rdns_timeout) {
+            err << "Err: bad arguments\n";
+            return PARSE_ERROR;
+        }
+
+        if (! Arg::parse_count(value, timeout, kTimeoutLimit) || ! timeout) {
+            err << "Err: bad time delay specified\n";
+            return PARSE_ERROR;
+        }
+
+        rdns_timeout = timeout;
+    } else if (! strcmp(opt, "--deadline")) {
+        if (! Arg::parse_duration(value, deadline)) {
+            err << "Err: bad deadline specified\n";
+            return PARSE_ERROR;
+        }
+    } else if (! strcmp(opt, "--max-rate-per-subnet")) {
+        if (! Arg::parse_count(value, subnet_rate, kRateLimit)) {
+            err << "Err: bad rate specified\n";
+            return PARSE_ERROR;
+        }
+    } else if (! strcmp(opt, "--subnet-prefix")) {
+        // IPv4 prefix length, optionally followed by IPv6 one
+        char * endptr;
+        long v4 = strtol(value, &endptr, 10);
+        long v6 = prefix6;
+
+        if (endptr != value && *endptr == ',') {
+            const char * ptr = endptr + 1;
+            v6 = strtol(ptr, &endptr, 10);
+            if (endptr == ptr)
+                v6 = -1;
+        }
+
+        if (endptr == value || *endptr != '\0' || v4 < 0 || v4 > 32
+                || v6 < 0 || v6 > 128) {
+            err << "Err: bad prefix length specified\n";
+            return PARSE_ERROR;
+        }
+
+        prefix4 = v4;
+        prefix6 = v6;
+    } else if (! strcmp(opt, "--order")) {
+        if (! strcmp(value, "numeric"))
+            order = ORDER_NUMERIC;
+        else if (! strcmp(value, "frequency"))
+            order = ORDER_FREQUENCY;
+        else {
+            err << "Err: bad order specified\n";
+            return PARSE_ERROR;
+        }
+    } else {
+        unsigned * count = NULL;
+
+        if (! strcmp(opt, "-j"))
+            count = &parallel;
+        else if (! strcmp(opt, "--top"))
+            count = &top;
+        else if (! strcmp(opt, "--max-open-per-host"))
+            count = &max_open;
+        else if (! strcmp(opt, "--down-after"))
+            count = &down_after;
+        else if (! strcmp(opt, "--retries"))
+            count = &retries;
+        else
+            count = &stop_after;
+
+        if (! Arg::parse_count(value, *count)
+                || (count == &top && top > top_ports_count())) {
+            err << "Err: bad count specified for " << opt << std::endl;
+            return PARSE_ERROR;
+        }
+    }
+
+    return PARSE_OK;
+}
+
+/**
+ * Check parsed options and complete the port list.
+ *
+ * @param   err output stream for error messages
+ * @return  false if options are not sufficient for a scan
+ */
+bool Settings::finish(std::ostream & err)
+{
+    for (unsigned i = 0; i < top; ++i) {
+        Port * port = new Port();
+        port->port_from = port->port_to = top_port(i);
+        ports.push_back(port);
+    }
+
+    top = 0;
+
+    // adaptive timeouts requested, fill in missing bound
+    if (min_timeout || max_timeout) {
+        if (! max_timeout)
+            max_timeout = delay ? static_cast<msec_t>(delay) * 1000 : kMaxTimeout;
+
+        if (! min_timeout)
+            min_timeout = std::min(kMinTimeout, max_timeout);
+
+        if (min_timeout > max_timeout) {
+            err << "Err: minimal timeout is greater than maximal timeout\n";
+            return false;
+        }
+    }
+
+    // names are attached to results held until the lookup finishes
+    if (rdns_timeout)
+        rdns = true;
+
+    if (rdns) {
+        ordered = true;
+
+        if (! rdns_timeout)
+            rdns_timeout = kRdnsTimeout;
+    }
+
+    if (ports.empty()) {
+        err << "Err: port range has to be specified\n";
+        return false;
+    }
+
+    return true;
+}
 
 /**
  * Constructor.
  */
 Arg::Arg()
 {
-    m_delay = 0;
-    m_verbose = false;
 }
 
 /**
@@ -29,11 +363,6 @@ Arg::Arg()
  */
 Arg::~Arg()
 {
-    for (portlist_t::iterator it = m_ports.begin();
-            it != m_ports.end();
-            it = m_ports.erase(it)) {
-        delete *it;
-    }
 }
 
 /**
@@ -59,6 +388,9 @@ bool Arg::parse(int argc, char * argv[])
     assert(argv);
     assert(argc >= 0);
 
+    // options other than -j given, they are not allowed for daemon
+    bool scan_options = false;
+
     if (argc == 1) {
         std::cerr << "Err: No arguments provided\n";
         print_help(argv[0]);
@@ -66,13 +398,22 @@ bool Arg::parse(int argc, char * argv[])
     }
 
     for (int i = 1; i < argc; ++i) {
-        if (! strcmp(argv[i], "-v")) {
-            if (m_verbose) {
-                std::cerr << "Err: bad arguments\n";
+        int opt = i;
+
+        switch (m_settings.parse(argc, argv, i, std::cerr)) {
+            case Settings::PARSE_OK:
+                if (strcmp(argv[opt], "-j"))
+                    scan_options = true;
+                continue;
+
+            case Settings::PARSE_ERROR:
                 return false;
-            } else
-                m_verbose = true;
-        } else if (! strcmp(argv[i], "-h")) {
+
+            default:
+                break;
+        }
+
+        if (! strcmp(argv[i], "-h")) {
             if (argc == 2) {
                 print_help(argv[0]);
                 return false;
@@ -80,24 +421,82 @@ bool Arg::parse(int argc, char * argv[])
                 std::cerr << "Err: bad arguments\n";
                 return false;
             }
-        } else if (! strcmp(argv[i], "-t")) {
+        } else if (! strcmp(argv[i], "--daemon")) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "Err: no socket specified\n";
+                return false;
+            } else if (! m_daemon.empty() || ! *argv[i]) {
+                std::cerr << "Err: bad arguments\n";
+                return false;
+            }
+
+            m_daemon = argv[i];
+        } else if (! strcmp(argv[i], "--store")) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "Err: no file specified\n";
+                return false;
+            } else if (! m_store.empty() || ! *argv[i]) {
+                std::cerr << "Err: bad arguments\n";
+                return false;
+            }
+
+            m_store = argv[i];
+        } else if (! strcmp(argv[i], "--query")) {
+            if (i + 2 >= argc) {
+                std::cerr << "Err: no file or query specified\n";
+                return false;
+            } else if (! m_query_file.empty() || ! *argv[i + 1]) {
+                std::cerr << "Err: bad arguments\n";
+                return false;
+            }
+
+            m_query_file = argv[++i];
+            m_query = argv[++i];
+        } else if (! strcmp(argv[i], "--dns-cache")) {
             ++i;
             if (i == argc) {
-                std::cerr << "Err: no time specified\n";
+                std::cerr << "Err: no file specified\n";
                 return false;
-            } else if (! parse_time(argv[i])) {
-                std::cerr << "Err: bad time delay specified\n";
+            } else if (! m_dns_cache.empty() || ! *argv[i]) {
+                std::cerr << "Err: bad arguments\n";
                 return false;
             }
-        } else if (! strcmp(argv[i], "-p")) {
+
+            m_dns_cache = argv[i];
+        } else if (! strcmp(argv[i], "--stats") || ! strcmp(argv[i], "--watch")
+                || ! strcmp(argv[i], "--metrics")) {
+            std::string & file = ! strcmp(argv[i], "--stats") ? m_stats
+                                 : ! strcmp(argv[i], "--watch") ? m_watch : m_metrics;
+
             ++i;
             if (i == argc) {
-                std::cerr << "Err: no ports specified\n";
+                std::cerr << "Err: no file specified\n";
                 return false;
-            } else if (! parse_ports(argv[i])) {
-                std::cerr << "Err: bad port range\n";
+            } else if (! file.empty() || ! *argv[i]) {
+                std::cerr << "Err: bad arguments\n";
                 return false;
             }
+
+            file = argv[i];
+        } else if (! strcmp(argv[i], "--simulate")) {
+            ++i;
+            if (i == argc) {
+                std::cerr << "Err: no simulation specified\n";
+                return false;
+            } else if (! m_simulate.empty() || ! *argv[i]) {
+                std::cerr << "Err: bad arguments\n";
+                return false;
+            }
+
+            SimSpec spec;
+            if (! SimNetwork::parse_spec(argv[i], spec)) {
+                std::cerr << "Err: bad simulation specified\n";
+                return false;
+            }
+
+            m_simulate = argv[i];
         } else { // this should be input file
             if (m_filename.empty()) {
                 m_filename = argv[i];
@@ -108,8 +507,56 @@ bool Arg::parse(int argc, char * argv[])
         }
     }
 
-    if (m_ports.empty()) {
-        std::cerr << "Err: port range has to be specified\n";
+    if (! m_query_file.empty()) {
+        // no scan is run, states are read from the file
+        if (scan_options || m_settings.parallel || ! m_filename.empty()
+                || ! m_daemon.empty() || ! m_store.empty()
+                || ! m_simulate.empty() || ! m_dns_cache.empty()
+                || ! m_stats.empty() || ! m_watch.empty() || ! m_metrics.empty()) {
+            std::cerr << "Err: no other options can be used with --query\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    if (! m_watch.empty() || ! m_metrics.empty()) {
+        // no scan is run, counters of another one are read
+        if (scan_options || m_settings.parallel || ! m_filename.empty()
+                || ! m_daemon.empty() || ! m_store.empty()
+                || ! m_simulate.empty() || ! m_dns_cache.empty()
+                || ! m_stats.empty() || (! m_watch.empty() && ! m_metrics.empty())) {
+            std::cerr << "Err: no other options can be used with --watch or --metrics\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    // simulated names must not get to the shared file
+    if (! m_simulate.empty() && ! m_dns_cache.empty()) {
+        std::cerr << "Err: --dns-cache cannot be used with --simulate\n";
+        return false;
+    }
+
+    if (! m_daemon.empty()) {
+        // jobs carry their own ports, delays and targets
+        if (scan_options || ! m_filename.empty() || ! m_store.empty()
+                || ! m_simulate.empty()) {
+            std::cerr << "Err: only -j, --dns-cache and --stats can be used with --daemon\n";
+            return false;
+        }
+
+        if (! m_settings.parallel)
+            m_settings.parallel = kDaemonParallel;
+
+        return true;
+    }
+
+    if (! m_settings.parallel)
+        m_settings.parallel = 1;
+
+    if (! m_settings.finish(std::cerr)) {
         return false;
     } else if (m_filename.empty()) {
         std::cerr << "Err: file has to be specified (use '-' for stdin)\n";
@@ -120,16 +567,17 @@ bool Arg::parse(int argc, char * argv[])
 }
 
 /**
- * Parse port range and initialize m_ports.
+ * Parse port range and append it to list.
  *
  * @param   ports from command line
+ * @param   list list to append port ranges to
  * @return  false on error
  */
-bool Arg::parse_ports(char * ports)
+bool Arg::parse_ports(const char * ports, portlist_t & list)
 {
     assert(ports);
 
-    char * ptr = ports;
+    const char * ptr = ports;
     char * ptr2 = NULL;
     Port * tmp_port = NULL;
     long tmp;
@@ -146,7 +594,7 @@ bool Arg::parse_ports(char * ports)
             ptr = ptr2;
 
         // non-negative value
-        if (tmp <= 0) {
+        if (tmp <= 0 || tmp > static_cast<long>(kMaxPort)) {
             delete tmp_port;
             return false;
         }
@@ -163,7 +611,7 @@ bool Arg::parse_ports(char * ports)
                 return false;
             }
 
-            if (tmp <= 0) {
+            if (tmp <= 0 || tmp > static_cast<long>(kMaxPort)) {
                 delete tmp_port;
                 return false;
             }
@@ -201,32 +649,33 @@ bool Arg::parse_ports(char * ports)
             return false;
         }
 
-        m_ports.push_back(tmp_port);
+        list.push_back(tmp_port);
     }
 
     return true;
 }
 
 /**
- * Parse time and initialize m_delay.
+ * Parse time.
  *
  * @param   time from command line
+ * @param   delay parsed delay
  * @return  false on error
  */
-bool Arg::parse_time(const char * time)
+bool Arg::parse_time(const char * time, delay_t & delay)
 {
     assert(time);
 
     char * endptr;
-    long delay;
+    long tmp;
 
-    delay = strtol(time, &endptr, 10);
+    tmp = strtol(time, &endptr, 10);
 
     // non-negative
-    if (delay <= 0)
+    if (tmp <= 0)
         return false;
 
-    m_delay = delay;
+    delay = tmp;
 
     // was it all scanned?
     if (endptr == time + strlen(time))
@@ -235,6 +684,68 @@ bool Arg::parse_time(const char * time)
         return false;
 }
 
+/**
+ * Parse duration with optional unit, e.g. 90s, 15m or 2h (seconds if none).
+ *
+ * @param   duration from command line
+ * @param   value parsed duration in milliseconds
+ * @return  false on error
+ */
+bool Arg::parse_duration(const char * duration, msec_t & value)
+{
+    assert(duration);
+
+    char * endptr;
+    long tmp;
+    msec_t unit;
+
+    tmp = strtol(duration, &endptr, 10);
+
+    if (endptr == duration || tmp <= 0)
+        return false;
+
+    if (! strcmp(endptr, "") || ! strcmp(endptr, "s"))
+        unit = 1000;
+    else if (! strcmp(endptr, "m"))
+        unit = 60 * 1000;
+    else if (! strcmp(endptr, "h"))
+        unit = 3600 * 1000;
+    else
+        return false;
+
+    if (static_cast<msec_t>(tmp) > kDeadlineLimit / unit)
+        return false;
+
+    value = tmp * unit;
+
+    return true;
+}
+
+/**
+ * Parse positive count.
+ *
+ * @param   count from command line
+ * @param   value parsed count
+ * @param   max maximal allowed value
+ * @return  false on error
+ */
+bool Arg::parse_count(const char * count, unsigned & value, unsigned max)
+{
+    assert(count);
+
+    char * endptr;
+    long tmp;
+
+    tmp = strtol(count, &endptr, 10);
+
+    if (tmp <= 0 || *endptr != '\0' || tmp > static_cast<long>(max))
+        return false;
+
+    value = tmp;
+
+    return true;
+}
+
 /**
  * Print help to stdout.
  *
@@ -251,13 +762,94 @@ void Arg::print_help(const char * progname) const
         "Usage:\n\t";
 
     static const char * HELP_MSG_END =
-        " [-t TIME] [-v] -p PORT_RANGE FILE\n\n"
+        " [-t TIME] [-v] [-j COUNT] [--order ORDER] [--top COUNT]\n"
+        "\t\t[--max-open-per-host COUNT] [--stop-after COUNT]\n"
+        "\t\t[--down-after COUNT] [--pre-probe PORT_RANGE]\n"
+        "\t\t[--min-timeout MS] [--max-timeout MS] [--retries COUNT]\n"
+        "\t\t[--max-rate-per-subnet RATE] [--subnet-prefix V4[,V6]]\n"
+        "\t\t[--deadline TIME] [--ordered] [--store STATES]\n"
+        "\t\t[--rdns] [--rdns-timeout MS] [--dns-cache CACHE]\n"
+        "\t\t[--tls PORT_RANGE] [--dialog PORT_RANGE] [--simulate SPEC]\n"
+        "\t\t[--stats STATS]\n"
+        "\t\t-p PORT_RANGE FILE\n\t";
+
+    static const char * HELP_MSG_DAEMON =
+        " --daemon SOCKET [-j COUNT] [--dns-cache CACHE] [--stats STATS]\n\t";
+
+    static const char * HELP_MSG_WATCH =
+        " --watch STATS | --metrics STATS\n\t";
+
+    static const char * HELP_MSG_QUERY =
+        " --query STATES QUERY\n\n"
         "Options:\n"
         "\tFILE\t\t file whith domain names or IP addresses\n"
         "\t-t TIME\t\t specify wait time\n"
         "\t-p PORT_RANGE\t comma-separated list of ports and port ranges\n"
-        "\t-v\t\t verbose info messages\n";
-
-    std::cout << HELP_MSG_BEGIN << progname << HELP_MSG_END;
+        "\t-v\t\t verbose info messages\n"
+        "\t-j COUNT\t number of probes in flight\n"
+        "\t--order ORDER\t 'numeric' (host by host) or 'frequency' (likeliest\n"
+        "\t\t\t ports first, across batches of hosts)\n"
+        "\t--top COUNT\t scan COUNT most frequent ports (up to 100)\n"
+        "\t--max-open-per-host COUNT\n"
+        "\t\t\t stop scanning a host after COUNT open ports\n"
+        "\t--stop-after COUNT\n"
+        "\t\t\t stop scanning after COUNT open ports\n"
+        "\t--down-after COUNT\n"
+        "\t\t\t skip a host after COUNT timeouts in a row if it has\n"
+        "\t\t\t never responded (not even by a reset)\n"
+        "\t--pre-probe PORT_RANGE\n"
+        "\t\t\t probe these ports first, skip a host if none responds\n"
+        "\t--min-timeout MS, --max-timeout MS\n"
+        "\t\t\t derive connect timeout from measured round-trip time\n"
+        "\t\t\t of each host, bounded by MS milliseconds\n"
+        "\t--retries COUNT\t try ports which got no answer up to COUNT more\n"
+        "\t\t\t times, with growing delays\n"
+        "\t--max-rate-per-subnet RATE\n"
+        "\t\t\t probe each subnet at most RATE times per second,\n"
+        "\t\t\t work is interleaved across subnets\n"
+        "\t--subnet-prefix V4[,V6]\n"
+        "\t\t\t prefix lengths of rate limited subnets (24,64)\n"
+        "\t--deadline TIME\t stop after TIME (e.g. 90s, 15m, 2h), scan the most\n"
+        "\t\t\t valuable ports first and report coverage\n"
+        "\t--ordered\t print hosts in input order, each once with its ports\n"
+        "\t\t\t ascending, as soon as the host is complete\n"
+        "\t--rdns\t\t look up names of numeric hosts in background and\n"
+        "\t\t\t print them with results (implies --ordered)\n"
+        "\t--rdns-timeout MS\n"
+        "\t\t\t wait at most MS milliseconds for a name (2000),\n"
+        "\t\t\t implies --rdns\n"
+        "\t--dns-cache CACHE\n"
+        "\t\t\t keep translated names in file CACHE shared by runs\n"
+        "\t\t\t and processes (1 hour, failures 10 minutes)\n"
+        "\t--tls PORT_RANGE\n"
+        "\t\t\t start TLS handshake on these ports and report version,\n"
+        "\t\t\t cipher and certificate instead of banner\n"
+        "\t--dialog PORT_RANGE\n"
+        "\t\t\t talk to SMTP, FTP, POP3, IMAP and SSH services on\n"
+        "\t\t\t these ports and add their capabilities to banner\n"
+        "\t--store STATES\t store state of every scanned port to file STATES\n"
+        "\t--query STATES QUERY\n"
+        "\t\t\t print hosts from file STATES matching QUERY, e.g.\n"
+        "\t\t\t '22=open,23=closed' (states are open, closed,\n"
+        "\t\t\t filtered and none)\n"
+        "\t--simulate SPEC\t scan a simulated network in virtual time instead,\n"
+        "\t\t\t SPEC is a list of seed=N, latency=MIN-MAX (ms),\n"
+        "\t\t\t loss=P, down=P, open=P and banner=MIN-MAX (bytes),\n"
+        "\t\t\t e.g. 'seed=7,loss=0.05'\n"
+        "\t--stats STATS\t publish progress counters in file STATS\n"
+        "\t--watch STATS\t print progress of the scan publishing to STATS\n"
+        "\t\t\t every second until it finishes\n"
+        "\t--metrics STATS\t print counters of the scan publishing to STATS\n"
+        "\t\t\t in Prometheus text format\n"
+        "\t--daemon SOCKET\t accept scan jobs on unix socket SOCKET\n\n"
+        "Daemon jobs:\n"
+        "\tthe first line of a job holds scan options (-p, -t, ...), following\n"
+        "\tlines are targets; the job starts once the client shuts down its\n"
+        "\tside of the connection and results are streamed back, e.g.:\n"
+        "\t  (echo '-p 22,80'; cat FILE) | nc -NU SOCKET\n";
+
+    std::cout << HELP_MSG_BEGIN << progname << HELP_MSG_END
+              << progname << HELP_MSG_DAEMON << progname << HELP_MSG_WATCH
+              << progname << HELP_MSG_QUERY;
 }
 
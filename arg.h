@@ -8,6 +8,7 @@
 #define ARG_H_
 
 #include <istream>
+#include <ostream>
 #include <list>
 #include <string>
 
@@ -24,6 +25,66 @@ class Port {
 
 typedef std::list<Port *> portlist_t;
 
+void free_ports(portlist_t & ports);
+
+/**
+ * @brief Options of a scan job, shared by command line and daemon jobs.
+ */
+class Settings {
+  public:
+    /**
+     * @brief Order in which ports are scanned.
+     */
+    enum order_t {
+        ORDER_NUMERIC,      ///<! host by host, ports as specified
+        ORDER_FREQUENCY     ///<! likeliest ports first across hosts
+    };
+
+    /**
+     * @brief Result of parsing one option.
+     */
+    enum parse_t {
+        PARSE_OK,           ///<! option was consumed
+        PARSE_UNKNOWN,      ///<! not a scan option
+        PARSE_ERROR         ///<! bad option, message was printed
+    };
+
+    Settings();
+    ~Settings();
+
+    parse_t parse(int argc, const char * const argv[], int & i, std::ostream & err);
+    bool    finish(std::ostream & err);
+
+    portlist_t ports;           ///<! port ranges to scan
+    delay_t    delay;           ///<! probe timeout in seconds, 0 for none
+    bool       verbose;         ///<! verbose output
+    unsigned   parallel;        ///<! probes in flight, 0 if not specified
+    order_t    order;           ///<! port order
+    unsigned   top;             ///<! count of most frequent ports to scan
+    unsigned   max_open;        ///<! open ports per host to stop at, 0 for all
+    unsigned   stop_after;      ///<! open ports to stop the job at, 0 for all
+    unsigned   down_after;      ///<! timeouts to consider host down, 0 for never
+    portlist_t pre_ports;       ///<! ports probed before scan to check host is up
+    portlist_t tls_ports;       ///<! ports where TLS handshake is read as banner
+    portlist_t dialog_ports;    ///<! ports where dialogue follows banner
+    unsigned   retries;         ///<! count of retries of unanswered probes
+    msec_t     min_timeout;     ///<! lower bound of adaptive connect timeout
+    msec_t     max_timeout;     ///<! upper bound of adaptive connect timeout,
+                                ///<! 0 if timeouts are not adaptive
+    unsigned   subnet_rate;     ///<! probes per second per subnet, 0 for any
+    unsigned   prefix4;         ///<! prefix length of IPv4 subnets
+    unsigned   prefix6;         ///<! prefix length of IPv6 subnets
+    msec_t     deadline;        ///<! time budget of the scan, 0 for none
+    bool       ordered;         ///<! results grouped by host, ports ascending
+    bool       rdns;            ///<! numeric hosts are looked up by name,
+                                ///<! implies ordered
+    msec_t     rdns_timeout;    ///<! time to wait for reverse lookup
+
+  private:
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Settings);
+}; // class Settings
+
 /**
  * @brief Command-line arguments.
  */
@@ -36,22 +97,45 @@ class Arg {
     const std::string & filename() const;
     const delay_t       delay() const;
     bool                verbose() const;
+    unsigned            parallel() const;
+    const std::string & daemon() const;
+    const std::string & store() const;
+    const std::string & query_file() const;
+    const std::string & query() const;
+    const std::string & simulate() const;
+    const std::string & dns_cache() const;
+    const std::string & stats() const;
+    const std::string & watch() const;
+    const std::string & metrics() const;
+    const Settings    & settings() const;
 
+    const portlist_t & ports() const;
     portlist_t::const_iterator ports_begin() const;
     portlist_t::const_iterator ports_end() const;
 
+    static bool parse_ports(const char * ports, portlist_t & list);
+    static bool parse_time(const char * time, delay_t & delay);
+    static bool parse_duration(const char * duration, msec_t & value);
+    static bool parse_count(const char * count, unsigned & value,
+                            unsigned max = 65535);
+
   private:
     Arg();
     ~Arg();
 
     void print_help(const char * progname) const;
-    bool parse_ports(char * ports);
-    bool parse_time(const char * ports);
 
     std::string m_filename;
-    portlist_t  m_ports;
-    delay_t     m_delay;
-    bool        m_verbose;
+    Settings    m_settings;
+    std::string m_daemon;
+    std::string m_store;
+    std::string m_query_file;
+    std::string m_query;
+    std::string m_simulate;
+    std::string m_dns_cache;
+    std::string m_stats;
+    std::string m_watch;
+    std::string m_metrics;
 
     // dissallow copy and assign
     DISABLE_COPY_AND_ASSIGN(Arg);
@@ -0,0 +1,318 @@
+/**
+ * @file   banner.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Interned service banners.
+ */
+
+#include "banner.h"
+
+#include <cstring>
+#include <cassert>
+
+const banner_t Banners::kEmpty;
+
+/**
+ * Size of arena chunk, longer banners get chunk of their own.
+ */
+static const size_t kChunkSize = 1024 * 1024;
+
+/**
+ * Initial count of hash table slots, has to be power of two.
+ */
+static const size_t kInitialSlots = 1024;
+
+/**
+ * Size of length prefix of stored banner.
+ */
+static const size_t kPrefix = sizeof(uint32_t);
+
+/**
+ * Record of the empty banner (zero length prefix and terminating NUL).
+ */
+static char s_empty[kPrefix + 1];
+
+/**
+ * Compute FNV-1a hash.
+ *
+ * @param data bytes to hash
+ * @param len count of bytes
+ * @return hash
+ */
+static uint32_t hash(const char * data, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/**
+ * Constructor.
+ */
+Banners::Banners()
+{
+    m_free = NULL;
+    m_left = 0;
+    m_live = 0;
+    m_used = 0;
+    m_dead = 0;
+
+    m_entries.push_back(s_empty);
+    m_hashes.push_back(0);
+    m_refs.push_back(0);
+    m_slots.assign(kInitialSlots, kEmpty);
+}
+
+/**
+ * Destructor.
+ */
+Banners::~Banners()
+{
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+        delete [] m_chunks[i];
+}
+
+/**
+ * Access singleton
+ *
+ * @return singleton instance
+ */
+Banners & Banners::get_instace()
+{
+    static Banners instance;
+    return instance;
+}
+
+/**
+ * Bump-allocate memory from the arena.
+ *
+ * @param size count of bytes
+ * @return allocated memory
+ */
+char * Banners::allocate(size_t size)
+{
+    if (size > kChunkSize / 4) {
+        char * chunk = new char[size];
+        m_chunks.push_back(chunk);
+        return chunk;
+    }
+
+    if (size > m_left) {
+        m_free = new char[kChunkSize];
+        m_left = kChunkSize;
+        m_chunks.push_back(m_free);
+    }
+
+    char * ret = m_free;
+    m_free += size;
+    m_left -= size;
+
+    return ret;
+}
+
+/**
+ * Double the hash table.
+ *
+ * @return void
+ */
+void Banners::grow()
+{
+    std::vector<banner_t> slots(m_slots.size() * 2, kEmpty);
+    size_t mask = slots.size() - 1;
+
+    for (banner_t id = 1; id < m_entries.size(); ++id) {
+        if (! m_entries[id])
+            continue;
+
+        size_t i = m_hashes[id] & mask;
+
+        while (slots[i] != kEmpty)
+            i = (i + 1) & mask;
+
+        slots[i] = id;
+    }
+
+    m_slots.swap(slots);
+}
+
+/**
+ * Get id of banner, store the banner if it was not seen yet. The caller
+ * owns a reference to the id.
+ *
+ * @param data banner
+ * @param len length of banner
+ * @return banner id
+ */
+banner_t Banners::intern(const char * data, size_t len)
+{
+    if (len == 0)
+        return kEmpty;
+
+    uint32_t h = hash(data, len);
+    size_t mask = m_slots.size() - 1;
+    size_t i = h & mask;
+
+    for (; m_slots[i] != kEmpty; i = (i + 1) & mask) {
+        banner_t id = m_slots[i];
+
+        if (m_hashes[id] == h && length(id) == len && ! memcmp(this->data(id), data, len)) {
+            ++m_refs[id];
+            return id;
+        }
+    }
+
+    size_t size = kPrefix + len + 1;
+    char * entry = allocate(size);
+    uint32_t prefix = len;
+
+    memcpy(entry, &prefix, kPrefix);
+    memcpy(entry + kPrefix, data, len);
+    entry[kPrefix + len] = '\0';
+
+    banner_t id;
+
+    if (m_unused.empty()) {
+        id = m_entries.size();
+        m_entries.push_back(entry);
+        m_hashes.push_back(h);
+        m_refs.push_back(1);
+    } else {
+        id = m_unused.back();
+        m_unused.pop_back();
+        m_entries[id] = entry;
+        m_hashes[id] = h;
+        m_refs[id] = 1;
+    }
+
+    m_slots[i] = id;
+    ++m_live;
+    m_used += size;
+
+    // keep load factor under one half
+    if (m_live * 2 > m_slots.size())
+        grow();
+
+    return id;
+}
+
+/**
+ * Drop reference to banner, the banner is dropped with its last reference.
+ *
+ * @param id banner id
+ * @return void
+ */
+void Banners::release(banner_t id)
+{
+    if (id == kEmpty)
+        return;
+
+    assert(id < m_entries.size() && m_entries[id] && m_refs[id]);
+
+    if (--m_refs[id] == 0)
+        erase(id);
+}
+
+/**
+ * Remove banner from the hash table and free its id.
+ *
+ * @param id banner id
+ * @return void
+ */
+void Banners::erase(banner_t id)
+{
+    size_t mask = m_slots.size() - 1;
+    size_t i = m_hashes[id] & mask;
+
+    while (m_slots[i] != id)
+        i = (i + 1) & mask;
+
+    // shift following ids of the cluster back unless it would move them
+    // before their home slot
+    for (size_t j = (i + 1) & mask; m_slots[j] != kEmpty; j = (j + 1) & mask) {
+        size_t home = m_hashes[m_slots[j]] & mask;
+
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+
+        m_slots[i] = m_slots[j];
+        i = j;
+    }
+
+    m_slots[i] = kEmpty;
+
+    size_t size = kPrefix + length(id) + 1;
+    m_used -= size;
+    m_dead += size;
+    --m_live;
+
+    m_entries[id] = NULL;
+    m_unused.push_back(id);
+
+    compact();
+}
+
+/**
+ * Move stored banners to new chunks once dropped ones take most of the arena,
+ * ids do not change.
+ *
+ * @return void
+ */
+void Banners::compact()
+{
+    if (m_dead < kChunkSize || m_dead < m_used)
+        return;
+
+    std::vector<char *> chunks;
+    chunks.swap(m_chunks);
+    m_free = NULL;
+    m_left = 0;
+
+    for (banner_t id = 1; id < m_entries.size(); ++id) {
+        if (! m_entries[id])
+            continue;
+
+        size_t size = kPrefix + length(id) + 1;
+        char * entry = allocate(size);
+
+        memcpy(entry, m_entries[id], size);
+        m_entries[id] = entry;
+    }
+
+    for (size_t i = 0; i < chunks.size(); ++i)
+        delete [] chunks[i];
+
+    m_dead = 0;
+}
+
+/**
+ * Access banner, it is NUL-terminated.
+ *
+ * @param id banner id
+ * @return banner
+ */
+const char * Banners::data(banner_t id) const
+{
+    assert(id < m_entries.size() && m_entries[id]);
+
+    return m_entries[id] + kPrefix;
+}
+
+/**
+ * Get banner length.
+ *
+ * @param id banner id
+ * @return length of banner
+ */
+size_t Banners::length(banner_t id) const
+{
+    assert(id < m_entries.size() && m_entries[id]);
+
+    uint32_t len;
+    memcpy(&len, m_entries[id], kPrefix);
+
+    return len;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file   banner.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Interned service banners.
+ */
+
+#ifndef BANNER_H_
+#define BANNER_H_
+
+#include "tcpsearch.h"
+
+#include <cstddef>
+#include <vector>
+
+typedef uint32_t banner_t;
+
+/**
+ * @brief Singleton storing each distinct banner once, banners are referred by
+ *        32-bit ids. Ids are counted references: a banner is dropped when its
+ *        last reference is released and its id is reused, the arena is
+ *        compacted once most of it is dead. Pointers returned by data() are
+ *        valid until the next intern() or release().
+ */
+class Banners {
+  public:
+    static Banners & get_instace();
+
+    /// id of the empty banner
+    static const banner_t kEmpty = 0;
+
+    banner_t     intern(const char * data, size_t len);
+    void         release(banner_t id);
+    const char * data(banner_t id) const;
+    size_t       length(banner_t id) const;
+    size_t       count() const { return m_live; }
+
+  private:
+    Banners();
+    ~Banners();
+
+    char * allocate(size_t size);
+    void   grow();
+    void   erase(banner_t id);
+    void   compact();
+
+    std::vector<char *>   m_chunks;    ///<! arena chunks
+    char                * m_free;      ///<! free space in the last chunk
+    size_t                m_left;      ///<! size of free space
+    std::vector<char *>   m_entries;   ///<! length-prefixed banners by id, NULL if unused
+    std::vector<uint32_t> m_hashes;    ///<! hashes of banners by id
+    std::vector<uint32_t> m_refs;      ///<! count of references by id
+    std::vector<banner_t> m_unused;    ///<! ids free for reuse
+    std::vector<banner_t> m_slots;     ///<! open addressing table of ids
+    size_t                m_live;      ///<! count of stored banners
+    size_t                m_used;      ///<! bytes taken by stored banners
+    size_t                m_dead;      ///<! bytes taken by dropped banners
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Banners);
+}; // class Banners
+
+#endif // BANNER_H_
@@ -0,0 +1,542 @@
+/**
+ * @file   bench.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Microbenchmarks of CPU-side hot paths, results are printed as JSON.
+ */
+
+#include "tcpsearch.h"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "arg.h"
+#include "connect.h"
+#include "host.h"
+#include "job.h"
+#include "text.h"
+
+/**
+ * Benchmark is repeated until it runs at least this long, nanoseconds.
+ */
+static const uint64_t kMinTime = 300 * 1000 * 1000ULL;
+
+/**
+ * Default count of lines of generated host file.
+ */
+static const unsigned long kHostLines = 2000000;
+
+/**
+ * Count of distinct addresses printed by pretty_host_print benchmark.
+ */
+static const unsigned kAddresses = 4096;
+
+/**
+ * Upper limit of probes, every probe leaves a connection in TIME_WAIT.
+ */
+static const unsigned long kMaxProbes = 4000;
+
+/**
+ * @brief Result of one benchmark.
+ */
+class Result {
+  public:
+    std::string   name;         ///<! benchmark name
+    unsigned long iterations;   ///<! count of runs
+    double        ns_per_op;    ///<! time of one run
+    unsigned long items;        ///<! items processed by one run
+    unsigned long bytes;        ///<! bytes processed by one run
+};
+
+/**
+ * @brief State shared by benchmarks.
+ */
+class Fixture {
+  public:
+    std::string              ports;      ///<! large port specification
+    std::string              hosts;      ///<! path of generated host file
+    unsigned long            lines;      ///<! count of lines in host file
+    unsigned long            host_bytes; ///<! size of host file
+    std::vector<std::string> addresses;  ///<! numeric addresses
+    addrlist_t               scanned;    ///<! addresses translated from them
+    std::string              banner;     ///<! banner sent by the server
+    int                      listener;   ///<! loopback server socket
+    Target                   target;     ///<! address of the server
+    port_t                   port;       ///<! port of the server
+};
+
+typedef unsigned long (* bench_t)(Fixture & fixture, unsigned long iterations);
+
+/**
+ * Sink which keeps the compiler from dropping benchmarked work.
+ */
+static volatile unsigned long s_sink;
+
+/**
+ * Get monotonic time.
+ *
+ * @return time in nanoseconds
+ */
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Parse and release a port specification of 20000 ranges.
+ *
+ * @param fixture shared state
+ * @param iterations count of runs
+ * @return count of runs done
+ */
+static unsigned long bench_parse_ports(Fixture & fixture, unsigned long iterations)
+{
+    for (unsigned long i = 0; i < iterations; ++i) {
+        portlist_t list;
+
+        if (! Arg::parse_ports(fixture.ports.c_str(), list))
+            abort();
+
+        s_sink += list.size();
+        free_ports(list);
+    }
+
+    return iterations;
+}
+
+/**
+ * Read all hosts of a generated file.
+ *
+ * @param fixture shared state
+ * @param iterations count of runs
+ * @return count of runs done
+ */
+static unsigned long bench_next_host(Fixture & fixture, unsigned long iterations)
+{
+    for (unsigned long i = 0; i < iterations; ++i) {
+        Host host;
+
+        if (! host.init(fixture.hosts))
+            abort();
+
+        while (host.next_host())
+            s_sink += host.host().size();
+    }
+
+    return iterations;
+}
+
+/**
+ * Connect to loopback server and read its banner.
+ *
+ * @param fixture shared state
+ * @param iterations count of runs
+ * @return count of runs done
+ */
+static unsigned long bench_banner_read(Fixture & fixture, unsigned long iterations)
+{
+    if (iterations > kMaxProbes)
+        iterations = kMaxProbes;
+
+    for (unsigned long i = 0; i < iterations; ++i) {
+        Connect probe(NULL, &fixture.target, fixture.port, 0);
+        probe.start();
+
+        int peer = accept(fixture.listener, NULL, NULL);
+        if (peer < 0
+                || write(peer, fixture.banner.data(), fixture.banner.size()) < 0)
+            abort();
+
+        close(peer);
+
+        while (! probe.done()) {
+            struct pollfd pfd;
+            pfd.fd = probe.fd();
+            pfd.events = probe.events();
+            pfd.revents = 0;
+
+            if (poll(&pfd, 1, 1000) <= 0)
+                abort();
+
+            probe.handle(pfd.revents);
+        }
+
+        if (probe.result() != Connect::RESULT_SERVICE)
+            abort();
+
+        s_sink += probe.service().size();
+    }
+
+    return iterations;
+}
+
+/**
+ * Print headers of hosts given by numeric addresses.
+ *
+ * @param fixture shared state
+ * @param iterations count of runs
+ * @return count of runs done
+ */
+static unsigned long bench_pretty_host_print(Fixture & fixture, unsigned long iterations)
+{
+    std::ostringstream out;
+
+    for (unsigned long i = 0; i < iterations; ++i) {
+        out.str("");
+        size_t n = i % fixture.addresses.size();
+        Connect::pretty_host_print(out, fixture.addresses[n], &fixture.scanned[n]);
+        s_sink += out.tellp();
+    }
+
+    return iterations;
+}
+
+/**
+ * Sanitize a binary-ish banner.
+ *
+ * @param fixture shared state
+ * @param iterations count of runs
+ * @return count of runs done
+ */
+static unsigned long bench_escape_banner(Fixture & fixture, unsigned long iterations)
+{
+    std::string out;
+
+    for (unsigned long i = 0; i < iterations; ++i) {
+        escape_banner(out, fixture.banner.data(), fixture.banner.size());
+        s_sink += out.size();
+    }
+
+    return iterations;
+}
+
+/**
+ * Prepare data for benchmarks.
+ *
+ * @param fixture state to be initialized
+ * @return false on error
+ */
+static bool setup(Fixture & fixture)
+{
+    std::ostringstream ports;
+
+    for (unsigned i = 0; i < 20000; ++i) {
+        port_t from = 1 + (i * 3) % 65000;
+
+        if (i)
+            ports << ',';
+
+        if (i % 2)
+            ports << from << '-' << from + 2;
+        else
+            ports << from;
+    }
+
+    fixture.ports = ports.str();
+
+    char path[] = "/tmp/tcpsearch-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "Err: mkstemp: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    close(fd);
+    fixture.hosts = path;
+
+    std::ofstream file(path);
+    for (unsigned long i = 0; i < fixture.lines; ++i) {
+        switch (i % 16) {
+            case 0:
+                file << "# comment " << i << '\n';
+                break;
+
+            case 1:
+                file << '\n';
+                break;
+
+            case 2:
+                file << "  host" << i << ".example.com\t# trailing\n";
+                break;
+
+            default:
+                file << "10." << (i >> 16 & 0xff) << '.' << (i >> 8 & 0xff)
+                     << '.' << (i & 0xff) << '\n';
+                break;
+        }
+    }
+
+    fixture.host_bytes = file.tellp();
+    file.close();
+
+    if (file.fail()) {
+        std::cerr << "Err: " << path << ": cannot write hosts" << std::endl;
+        return false;
+    }
+
+    for (unsigned i = 0; i < kAddresses; ++i) {
+        std::ostringstream addr;
+
+        if (i % 4 == 3)
+            addr << "2001:db8::" << std::hex << i;
+        else
+            addr << "10.1." << (i >> 8) << '.' << (i & 0xff);
+
+        // scan translates hosts before their headers are printed
+        addrlist_t addrs;
+        if (Resolver::get_instace().resolve(addr.str(), addrs) || addrs.empty()) {
+            std::cerr << "Err: " << addr.str() << ": cannot translate" << std::endl;
+            return false;
+        }
+
+        fixture.addresses.push_back(addr.str());
+        fixture.scanned.push_back(addrs.front());
+    }
+
+    // long first line with carriage returns, then binary garbage
+    fixture.banner = "SSH-2.0-OpenSSH_8.9p1 Ubuntu-3ubuntu0.1 \\ banner\r\r";
+    for (unsigned i = 0; i < 8; ++i)
+        fixture.banner += "\x1b[1m caf\xc3\xa9 \x80\xff padding padding padding ";
+    fixture.banner += "\r\n\x16\x03\x01\x02\x00";
+
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fixture.listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (fixture.listener < 0
+            || bind(fixture.listener, reinterpret_cast<struct sockaddr *>(&addr), len) < 0
+            || listen(fixture.listener, 16) < 0
+            || getsockname(fixture.listener, reinterpret_cast<struct sockaddr *>(&addr),
+                           &len) < 0) {
+        std::cerr << "Err: listen: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    memset(&fixture.target.addr, 0, sizeof(fixture.target.addr));
+    memcpy(&fixture.target.addr.addr, &addr, len);
+    fixture.target.addr.addrlen = len;
+    fixture.port = ntohs(addr.sin_port);
+
+    return true;
+}
+
+/**
+ * Run benchmark until it takes at least kMinTime.
+ *
+ * @param fixture shared state
+ * @param name benchmark name
+ * @param bench benchmark
+ * @param items items processed by one run
+ * @param bytes bytes processed by one run
+ * @return result
+ */
+static Result run(Fixture & fixture, const char * name, bench_t bench,
+                  unsigned long items, unsigned long bytes)
+{
+    Result result;
+    unsigned long iterations = 1;
+
+    // warm up caches
+    bench(fixture, 1);
+
+    for (;;) {
+        uint64_t start = now_ns();
+        unsigned long done = bench(fixture, iterations);
+        uint64_t elapsed = now_ns() - start;
+
+        if (elapsed >= kMinTime || done < iterations) {
+            result.iterations = done;
+            result.ns_per_op = static_cast<double>(elapsed) / done;
+            break;
+        }
+
+        // aim a bit over the minimal time
+        uint64_t guess = elapsed ? kMinTime * 12 / 10 * iterations / elapsed : 0;
+        iterations = std::max<uint64_t>(iterations * 2, guess);
+    }
+
+    result.name = name;
+    result.items = items;
+    result.bytes = bytes;
+
+    return result;
+}
+
+/**
+ * Read ns_per_op of benchmarks from JSON written by a previous run.
+ *
+ * @param path file name
+ * @param results results of benchmarks to look up
+ * @param values parsed values, 0 if the benchmark is not in the file
+ * @return false if the file cannot be read
+ */
+static bool load_baseline(const std::string & path,
+                          const std::vector<Result> & results,
+                          std::vector<double> & values)
+{
+    std::ifstream file(path.c_str());
+    if (! file.is_open())
+        return false;
+
+    std::stringstream buf;
+    buf << file.rdbuf();
+    std::string json = buf.str();
+
+    values.assign(results.size(), 0);
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        std::string key = "\"name\": \"" + results[i].name + "\"";
+        size_t pos = json.find(key);
+        if (pos == std::string::npos)
+            continue;
+
+        size_t end = json.find('}', pos);
+        pos = json.find("\"ns_per_op\": ", pos);
+        if (pos == std::string::npos || pos > end)
+            continue;
+
+        values[i] = strtod(json.c_str() + pos + strlen("\"ns_per_op\": "), NULL);
+    }
+
+    return true;
+}
+
+/**
+ * Print usage.
+ *
+ * @param progname program name
+ * @return void
+ */
+static void print_help(const char * progname)
+{
+    std::cout << "Usage:\n\t" << progname
+              << " [--baseline FILE] [--max-regression PERCENT] [--lines COUNT]\n\n"
+                 "Runs microbenchmarks and prints results as JSON. With a baseline\n"
+                 "written by a previous run, change against it is reported and the\n"
+                 "exit status is 1 if any benchmark is slower by more than PERCENT.\n";
+}
+
+/**
+ * Benchmarks' main()
+ *
+ * @param  argc argument count
+ * @return argv argument vector
+ */
+int main(int argc, char * argv[])
+{
+    Fixture fixture;
+    std::string baseline;
+    unsigned max_regression = 0;
+
+    fixture.lines = kHostLines;
+
+    for (int i = 1; i < argc; ++i) {
+        unsigned lines;
+
+        if (! strcmp(argv[i], "--baseline") && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (! strcmp(argv[i], "--max-regression") && i + 1 < argc) {
+            if (! Arg::parse_count(argv[++i], max_regression, 1000)) {
+                std::cerr << "Err: bad percentage specified\n";
+                return 2;
+            }
+        } else if (! strcmp(argv[i], "--lines") && i + 1 < argc) {
+            if (! Arg::parse_count(argv[++i], lines, 100000000)) {
+                std::cerr << "Err: bad count specified\n";
+                return 2;
+            }
+
+            fixture.lines = lines;
+        } else {
+            print_help(argv[0]);
+            return 2;
+        }
+    }
+
+    if (! setup(fixture)) {
+        if (! fixture.hosts.empty())
+            unlink(fixture.hosts.c_str());
+
+        return 2;
+    }
+
+    std::vector<Result> results;
+
+    results.push_back(run(fixture, "parse_ports", bench_parse_ports,
+                          20000, fixture.ports.size()));
+    results.push_back(run(fixture, "next_host", bench_next_host,
+                          fixture.lines, fixture.host_bytes));
+    results.push_back(run(fixture, "banner_read", bench_banner_read,
+                          1, fixture.banner.size()));
+    results.push_back(run(fixture, "pretty_host_print", bench_pretty_host_print,
+                          1, 0));
+    results.push_back(run(fixture, "escape_banner", bench_escape_banner,
+                          1, fixture.banner.size()));
+
+    unlink(fixture.hosts.c_str());
+    close(fixture.listener);
+
+    std::vector<double> values;
+    bool compare = ! baseline.empty() && load_baseline(baseline, results, values);
+    bool regressed = false;
+    char num[64];
+
+    std::cout << "{\n  \"kernel\": \"" << text_kernel() << "\",\n"
+              << "  \"benchmarks\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result & r = results[i];
+
+        snprintf(num, sizeof(num), "%.1f", r.ns_per_op);
+        std::cout << "    {\"name\": \"" << r.name << "\", \"iterations\": "
+                  << r.iterations << ", \"ns_per_op\": " << num;
+
+        snprintf(num, sizeof(num), "%.3f", r.ns_per_op / r.items);
+        std::cout << ", \"items_per_op\": " << r.items << ", \"ns_per_item\": " << num;
+
+        if (r.bytes) {
+            snprintf(num, sizeof(num), "%.1f", r.bytes * 1000.0 / r.ns_per_op);
+            std::cout << ", \"mb_per_s\": " << num;
+        }
+
+        if (compare && values[i] > 0) {
+            double change = (r.ns_per_op - values[i]) * 100.0 / values[i];
+
+            snprintf(num, sizeof(num), "%.1f", values[i]);
+            std::cout << ", \"baseline_ns_per_op\": " << num;
+            snprintf(num, sizeof(num), "%.1f", change);
+            std::cout << ", \"change_pct\": " << num;
+
+            if (max_regression && change > max_regression)
+                regressed = true;
+        }
+
+        std::cout << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+
+    return regressed ? 1 : 0;
+}
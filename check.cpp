@@ -0,0 +1,590 @@
+/**
+ * @file   check.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Checks of parsers against fixtures in tests/ and of the resolver,
+ *         run by make check.
+ */
+
+#include "tcpsearch.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "connect.h"
+#include "job.h"
+#include "text.h"
+#include "throttle.h"
+#include "tls.h"
+
+/**
+ * Description of tests/tls12.bin, the server's flight of a TLS 1.2
+ * handshake recorded from openssl s_server.
+ */
+static const char kTls12[] =
+    "TLSv1.2 ECDHE-RSA-AES128-GCM-SHA256 subject=CN=localhost,O=Test Org "
+    "san=localhost,example.test,127.0.0.1 expires=2027-10-19";
+
+/**
+ * Longest wait for the loopback handshake, milliseconds.
+ */
+static const int kHandshakeTimeout = 5000;
+
+/**
+ * Longest wait for a translation, milliseconds.
+ */
+static const int kResolveTimeout = 5000;
+
+/**
+ * Longest input of text kernels, covers several AVX2 blocks and a tail.
+ */
+static const size_t kTextLength = 97;
+
+/**
+ * Count of failed checks.
+ */
+static unsigned s_failed;
+
+/**
+ * Count of checks.
+ */
+static unsigned s_checks;
+
+/**
+ * Record result of a check, print it if it failed.
+ *
+ * @param ok the check passed
+ * @param what checked condition
+ * @param line line of the check
+ * @return void
+ */
+static void check(bool ok, const char * what, int line)
+{
+    ++s_checks;
+
+    if (! ok) {
+        ++s_failed;
+        std::cerr << "FAIL: check.cpp:" << line << ": " << what << std::endl;
+    }
+}
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+/**
+ * Read whole file.
+ *
+ * @param path file name
+ * @param data contents
+ * @return false on error
+ */
+static bool read_file(const std::string & path, std::string & data)
+{
+    std::ifstream file(path.c_str(), std::ifstream::in | std::ifstream::binary);
+    if (! file.is_open()) {
+        std::cerr << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::ostringstream buf;
+    buf << file.rdbuf();
+    data = buf.str();
+
+    return true;
+}
+
+/**
+ * Parse data from a buffer of exactly its size, so reads past the end are
+ * caught by memory checkers.
+ *
+ * @param data received data
+ * @param info parsed metadata
+ * @return status of parsing
+ */
+static tls_status_t parse(const std::string & data, TlsInfo & info)
+{
+    std::vector<char> buf(data.begin(), data.end());
+
+    return tls_parse(buf.empty() ? NULL : &buf[0], buf.size(), info);
+}
+
+/**
+ * Append big-endian number.
+ *
+ * @param out output
+ * @param value number
+ * @param bytes count of bytes
+ * @return void
+ */
+static void put(std::string & out, size_t value, unsigned bytes)
+{
+    while (bytes--)
+        out += static_cast<char>(value >> (8 * bytes) & 0xff);
+}
+
+/**
+ * Make a record with Certificate message. The certificate follows the
+ * length fields whatever they say, bytes past the message stay in the
+ * record.
+ *
+ * @param list length of certificate list
+ * @param cert length of the first certificate
+ * @param len length of the message
+ * @param der DER encoded certificate
+ * @return record
+ */
+static std::string certificate_record(size_t list, size_t cert, size_t len,
+                                      const std::string & der)
+{
+    std::string msg;
+
+    msg += '\x0b';
+    put(msg, len, 3);
+    put(msg, list, 3);
+    put(msg, cert, 3);
+    msg += der;
+
+    std::string record("\x16\x03\x03", 3);
+    put(record, msg.size(), 2);
+
+    return record + msg;
+}
+
+/**
+ * Recorded handshake is described in full.
+ *
+ * @param flight server's flight
+ * @return void
+ */
+static void check_tls_flight(const std::string & flight)
+{
+    TlsInfo info;
+
+    CHECK(parse(flight, info) == TLS_DONE);
+    CHECK(info.hello && info.cert);
+    CHECK(tls_describe(info) == kTls12);
+}
+
+/**
+ * Truncated handshake asks for more data until the certificate is read.
+ *
+ * @param flight server's flight
+ * @return void
+ */
+static void check_tls_prefixes(const std::string & flight)
+{
+    for (size_t len = 0; len < flight.size(); ++len) {
+        TlsInfo info;
+        tls_status_t status = parse(flight.substr(0, len), info);
+
+        CHECK(status == TLS_MORE || (status == TLS_DONE && info.cert));
+    }
+}
+
+/**
+ * Any byte of handshake may be corrupt, the parser stays within data.
+ *
+ * @param flight server's flight
+ * @return void
+ */
+static void check_tls_corrupt(const std::string & flight)
+{
+    static const unsigned char values[] = { 0x00, 0x01, 0x7f, 0x80, 0xff };
+
+    for (size_t pos = 0; pos < flight.size(); ++pos) {
+        for (size_t i = 0; i < sizeof(values); ++i) {
+            std::string data(flight);
+            data[pos] = values[i];
+
+            TlsInfo info;
+            parse(data, info);
+            CHECK(! tls_describe(info).empty());
+        }
+    }
+}
+
+/**
+ * Length fields of Certificate message which do not fit are rejected.
+ *
+ * @param der DER encoded certificate
+ * @return void
+ */
+static void check_tls_certificate_lengths(const std::string & der)
+{
+    size_t len = 6 + der.size();
+
+    /**
+     * @brief Length fields and whether the certificate is accepted.
+     */
+    class Case {
+      public:
+        size_t list;    ///<! length of certificate list
+        size_t cert;    ///<! length of the first certificate
+        size_t len;     ///<! length of the message
+        bool   valid;   ///<! certificate is parsed
+    };
+
+    const Case cases[] = {
+        { len - 3, der.size(), len, true },
+        // list shorter than its first length field, certificate past message
+        { 0, der.size(), 6, false },
+        { 1, der.size(), 6, false },
+        { 2, der.size(), 6, false },
+        { 2, der.size(), len, false },
+        // list longer than message
+        { len - 2, der.size(), len, false },
+        { 0xffffff, der.size(), len, false },
+        // certificate longer than list
+        { len - 3, der.size() + 1, len, false },
+        { len - 3, 0xffffff, len, false },
+        // truncated certificate
+        { len - 3, der.size() - 1, len, false },
+        { 3, 0, len, false },
+        // message shorter than length fields
+        { len - 3, der.size(), 5, false },
+        { len - 3, der.size(), 0, false }
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        TlsInfo info;
+        std::string record = certificate_record(cases[i].list, cases[i].cert,
+                                                cases[i].len, der);
+
+        parse(record, info);
+
+        CHECK(info.cert == cases[i].valid);
+        CHECK(info.subject.empty() != cases[i].valid);
+    }
+}
+
+/**
+ * ClientHello is a single handshake record naming the server.
+ *
+ * @return void
+ */
+static void check_tls_client_hello()
+{
+    std::string hello = tls_client_hello("example.test");
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(hello.data());
+
+    CHECK(hello.size() > 9);
+    CHECK(p[0] == 0x16 && p[1] == 3);
+    CHECK(static_cast<size_t>(p[3] << 8 | p[4]) == hello.size() - 5);
+    CHECK(p[5] == 1);
+    CHECK(static_cast<size_t>(p[6] << 16 | p[7] << 8 | p[8]) == hello.size() - 9);
+    CHECK(hello.find("example.test") != std::string::npos);
+}
+
+/**
+ * Probe sends ClientHello to a loopback server which answers by recorded
+ * flight, the handshake becomes the service banner.
+ *
+ * @param flight server's flight
+ * @return void
+ */
+static void check_tls_handshake(const std::string & flight)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0
+            || bind(listener, reinterpret_cast<struct sockaddr *>(&addr), len) < 0
+            || listen(listener, 1) < 0
+            || getsockname(listener, reinterpret_cast<struct sockaddr *>(&addr), &len) < 0) {
+        std::cerr << "Err: listen: " << std::strerror(errno) << std::endl;
+        check(false, "loopback server", __LINE__);
+
+        if (listener >= 0)
+            close(listener);
+
+        return;
+    }
+
+    Target target;
+    memset(&target.addr, 0, sizeof(target.addr));
+    memcpy(&target.addr.addr, &addr, len);
+    target.addr.addrlen = len;
+    target.name = "127.0.0.1";
+
+    Connect probe(NULL, &target, ntohs(addr.sin_port), 0);
+    probe.set_tls(true);
+    probe.start();
+
+    int peer = accept(listener, NULL, NULL);
+    CHECK(peer >= 0);
+
+    std::string hello;
+    size_t need = 5;
+    char buf[4096];
+
+    // server reads whole ClientHello record and answers by the flight
+    while (peer >= 0 && ! probe.done()) {
+        struct pollfd pfd[2];
+        pfd[0].fd = probe.fd();
+        pfd[0].events = probe.events();
+        pfd[0].revents = 0;
+        pfd[1].fd = hello.size() < need ? peer : -1;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+
+        if (poll(pfd, 2, kHandshakeTimeout) <= 0) {
+            probe.timeout();
+            break;
+        }
+
+        if (pfd[1].revents) {
+            ssize_t n = read(peer, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+
+            hello.append(buf, n);
+
+            if (hello.size() >= 5)
+                need = 5 + (static_cast<unsigned char>(hello[3]) << 8
+                            | static_cast<unsigned char>(hello[4]));
+
+            if (hello.size() >= need)
+                CHECK(write(peer, flight.data(), flight.size())
+                      == static_cast<ssize_t>(flight.size()));
+        }
+
+        if (pfd[0].revents)
+            probe.handle(pfd[0].revents);
+    }
+
+    CHECK(! hello.empty() && hello[0] == 0x16);
+    CHECK(probe.result() == Connect::RESULT_SERVICE);
+    CHECK(probe.result() == Connect::RESULT_SERVICE
+          && probe.service() == std::string(kTls12));
+
+    if (peer >= 0)
+        close(peer);
+
+    close(listener);
+}
+
+/**
+ * Check if addresses contain 127.0.0.1.
+ *
+ * @param addrs addresses
+ * @return true if 127.0.0.1 is found
+ */
+static bool has_loopback(const addrlist_t & addrs)
+{
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        const struct sockaddr_in * in =
+            reinterpret_cast<const struct sockaddr_in *>(&addrs[i].addr);
+
+        if (in->sin_family == AF_INET && in->sin_addr.s_addr == htonl(INADDR_LOOPBACK))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Numeric host is translated at once, name by a worker which wakes the loop
+ * through the resolver's descriptor. The name is expected in /etc/hosts.
+ *
+ * @return void
+ */
+static void check_resolver()
+{
+    Resolver & resolver = Resolver::get_instace();
+    addrlist_t addrs;
+    int error = -1;
+
+    resolver.request("127.0.0.1");
+    CHECK(resolver.result("127.0.0.1", error, addrs));
+    CHECK(error == 0 && has_loopback(addrs));
+
+    resolver.request("localhost");
+
+    bool done = resolver.result("localhost", error, addrs);
+    while (! done && resolver.events()) {
+        struct pollfd pfd;
+        pfd.fd = resolver.fd();
+        pfd.events = resolver.events();
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, kResolveTimeout) <= 0)
+            break;
+
+        resolver.handle(pfd.revents);
+        done = resolver.result("localhost", error, addrs);
+    }
+
+    CHECK(done);
+    CHECK(done && error == 0 && has_loopback(addrs));
+
+    resolver.release("localhost");
+
+    // released translation is still served from the cache
+    addrs.clear();
+    CHECK(resolver.resolve("localhost", addrs) == 0 && has_loopback(addrs));
+}
+
+/**
+ * Bucket of a subnet outlives its last target until it refills, the next
+ * target of the subnet does not get fresh tokens.
+ *
+ * @return void
+ */
+static void check_throttle()
+{
+    SubnetThrottle throttle(1, 24, 64);
+    Address first;
+    Address second;
+
+    memset(&first, 0, sizeof(first));
+    struct sockaddr_in * in = reinterpret_cast<struct sockaddr_in *>(&first.addr);
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(0xc0000201);
+    first.addrlen = sizeof(*in);
+
+    second = first;
+    in = reinterpret_cast<struct sockaddr_in *>(&second.addr);
+    in->sin_addr.s_addr = htonl(0xc0000202);
+
+    msec_t now = Engine::now();
+
+    Bucket * bucket = throttle.acquire(first);
+    CHECK(throttle.take(bucket, now) == 0);
+    CHECK(throttle.take(bucket, now) > now);
+    throttle.release(bucket);
+
+    CHECK(throttle.acquire(second) == bucket);
+    CHECK(throttle.take(bucket, now) > now);
+    throttle.release(bucket);
+}
+
+/**
+ * Build inputs of text kernels: printable text of each length up to
+ * kTextLength with a special byte at each offset, and text ending with
+ * a truncated UTF-8 sequence.
+ *
+ * @param inputs built inputs
+ * @return void
+ */
+static void text_inputs(std::vector<std::string> & inputs)
+{
+    static const char kSpecial[] = { '\r', '\n', '\\', '\x7f', '\x80', '\xc3', '\xff', '\x1f' };
+    static const char * const kSequences[] = { "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80" };
+
+    for (size_t len = 0; len <= kTextLength; ++len) {
+        std::string text;
+        for (size_t i = 0; i < len; ++i)
+            text += static_cast<char>('a' + i % 26);
+
+        inputs.push_back(text);
+
+        for (size_t at = 0; at < len; ++at) {
+            for (size_t i = 0; i < sizeof(kSpecial); ++i) {
+                inputs.push_back(text);
+                inputs.back()[at] = kSpecial[i];
+            }
+        }
+
+        for (size_t i = 0; i < sizeof(kSequences) / sizeof(kSequences[0]); ++i) {
+            std::string sequence = kSequences[i];
+
+            for (size_t cut = 1; cut < sequence.size() && cut <= len; ++cut)
+                inputs.push_back(text.substr(0, len - cut) + sequence.substr(0, cut));
+        }
+    }
+}
+
+/**
+ * Vector kernels give the same results as the scalar one, kernels not
+ * supported by the CPU are skipped.
+ *
+ * @return void
+ */
+static void check_text_kernels()
+{
+    static const char * const kKernels[] = { "sse2", "avx2" };
+
+    std::string chosen = text_kernel();
+    std::vector<std::string> inputs;
+    std::vector<size_t> eol;
+    std::vector<size_t> printable;
+    std::vector<std::string> escaped;
+    std::string out;
+
+    text_inputs(inputs);
+
+    CHECK(text_select("scalar"));
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        eol.push_back(scan_eol(inputs[i].data(), inputs[i].size()));
+        printable.push_back(scan_printable(inputs[i].data(), inputs[i].size()));
+        escape_banner(out, inputs[i].data(), inputs[i].size());
+        escaped.push_back(out);
+    }
+
+    for (size_t k = 0; k < sizeof(kKernels) / sizeof(kKernels[0]); ++k) {
+        if (! text_select(kKernels[k]))
+            continue;
+
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            CHECK(scan_eol(inputs[i].data(), inputs[i].size()) == eol[i]);
+            CHECK(scan_printable(inputs[i].data(), inputs[i].size()) == printable[i]);
+
+            escape_banner(out, inputs[i].data(), inputs[i].size());
+            CHECK(out == escaped[i]);
+        }
+    }
+
+    CHECK(text_select(chosen.c_str()));
+}
+
+/**
+ * Checks' main()
+ *
+ * @param  argc argument count
+ * @return argv argument vector
+ */
+int main(int argc, char * argv[])
+{
+    std::string dir = argc > 1 ? argv[1] : "tests";
+    std::string flight;
+    std::string der;
+
+    if (argc > 2) {
+        std::cout << "Usage:\n\t" << argv[0] << " [DIR]\n\n"
+                     "Checks parsers against fixtures in DIR (tests).\n";
+        return 2;
+    }
+
+    if (! read_file(dir + "/tls12.bin", flight) || ! read_file(dir + "/cert.der", der))
+        return 2;
+
+    check_tls_flight(flight);
+    check_tls_prefixes(flight);
+    check_tls_corrupt(flight);
+    check_tls_certificate_lengths(der);
+    check_tls_client_hello();
+    check_tls_handshake(flight);
+    check_resolver();
+    check_throttle();
+    check_text_kernels();
+
+    std::cout << (s_failed ? "FAIL" : "ok") << ": " << s_checks - s_failed
+              << " of " << s_checks << " checks passed" << std::endl;
+
+    return s_failed ? 1 : 0;
+}
@@ -6,15 +6,19 @@
 
 #include "connect.h"
 
-#include "arg.h"
-#include "arg-inl.h"
+#include "dialog.h"
+#include "job.h"
+#include "engine.h"
+#include "network.h"
+#include "resolver.h"
+#include "text.h"
+#include "tls.h"
 
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
 #include <cerrno>
-#include <unistd.h>
-#include <signal.h>
+#include <poll.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -22,13 +26,53 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+/**
+ * Banners longer than this are cut.
+ */
+static const size_t kMaxService = 64 * 1024;
+
+/**
+ * Time to wait for each reply of a dialogue.
+ */
+static const msec_t kDialogTimeout = 3000;
+
 /**
  * Constructor.
+ *
+ * @param job job the probe belongs to
+ * @param target host to connect to
+ * @param port a port to connect to
+ * @param delay timeout in seconds, 0 for none
+ * @param liveness probe only checks the host is up, result is not reported
  */
-Connect::Connect() : kNoSocket(-1)
+Connect::Connect(Job * job, Target * target, port_t port, delay_t delay,
+                 bool liveness)
+    : kNoSocket(-1)
 {
+    m_job = job;
+    m_target = target;
+    m_port = port;
+    m_delay = delay;
+    m_liveness = liveness;
+    m_tls = false;
+    m_dialogs = false;
+    m_dialog = NULL;
+    m_dialog_deadline = 0;
+    m_attempt = 1;
+
     // no socket is opened
     m_socket = kNoSocket;
+    m_deadline = 0;
+    m_connect_timeout = 0;
+    m_connect_deadline = 0;
+    m_expiry = 0;
+    m_started = 0;
+    m_rtt = 0;
+    m_measured = false;
+    m_established = false;
+    m_result = RESULT_NONE;
+    m_error = 0;
+    m_what = NULL;
 }
 
 /**
@@ -36,187 +80,253 @@ Connect::Connect() : kNoSocket(-1)
  */
 Connect::~Connect()
 {
+    delete m_dialog;
+    close_socket();
 }
 
 /**
- * Access singleton
+ * Close socket if opened
  *
- * @return singleton instance
+ * @return void
  */
-Connect & Connect::get_instace()
+void Connect::close_socket()
 {
-    static Connect instance;
-    return instance;
+    if (m_socket != kNoSocket)
+        Network::current().close(m_socket);
+
+    m_socket = kNoSocket;
 }
 
 /**
- * Close sockets on signal
+ * Mark probe as finished and release the socket.
  *
- * @param signum signal number
+ * @param result outcome of the probe
+ * @param what failed call for RESULT_ERROR
+ * @param err errno for RESULT_REFUSED or RESULT_ERROR
  * @return void
  */
-static void connect_socket_close(int signum)
+void Connect::finish(result_t result, const char * what, int err)
 {
-    UNUSED(signum);
+    m_result = result;
+    m_what = what;
+    m_error = err;
 
-    Connect::get_instace().close_socket();
+    // banner is kept until the job writes or buffers it
+    if (result != RESULT_SERVICE)
+        std::string().swap(m_service);
 
-    if (Arg::get_instace().verbose())
-        std::cerr << "Warn: Connection timeout!\n";
-    else if (Connect::get_instace().established()) // leave blank line if connection was estambished
-        std::cout << std::endl;
+    delete m_dialog;
+    m_dialog = NULL;
 
-    exit(0);
+    close_socket();
 }
 
 /**
- * Close socket if opened
+ * Time when the probe times out, connect may have tighter limit than the
+ * whole probe.
  *
- * @return void
+ * @return deadline, 0 for none
  */
-void Connect::close_socket()
+msec_t Connect::deadline() const
 {
-    if (m_socket != kNoSocket)
-        close(m_socket);
+    if (! m_established && m_connect_deadline
+            && (! m_deadline || m_connect_deadline < m_deadline))
+        return m_connect_deadline;
 
-    m_socket = kNoSocket;
+    if (m_dialog && (! m_deadline || m_dialog_deadline < m_deadline))
+        return m_dialog_deadline;
+
+    return m_deadline;
 }
 
 /**
- * Try to connect using ipv4 connection.
+ * Derive port state from the outcome of finished probe.
  *
- * @param service service to determinate
- * @param sockaddr initialized sockaddr_in for connect
- * @param port a port to connect to
+ * @return port state
  */
-bool Connect::examine_ipv4(std::string & service,
-                           struct sockaddr_in * sockaddr,
-                           port_t port)
+Connect::state_t Connect::state() const
 {
-    // create socket
-    signal(SIGTERM, connect_socket_close);
-    m_socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (m_established)
+        return STATE_OPEN;
+
+    switch (m_result) {
+        case RESULT_REFUSED:
+            // RST came from the host itself, ICMP errors did not
+            if (m_error == ECONNREFUSED)
+                return STATE_CLOSED;
+            else if (m_error == EHOSTUNREACH || m_error == ENETUNREACH
+                    || m_error == EHOSTDOWN || m_error == ETIMEDOUT)
+                return STATE_FILTERED;
+            break;
 
-    // estamblish connection...
-    if (connect(m_socket, reinterpret_cast<struct sockaddr *>(sockaddr),
-                sizeof(struct sockaddr_in)) < 0) {
-        // unable connect to given port
-        if (Arg::get_instace().verbose())
-            std::cerr << "Warn: Cannot connect to given port: "
-                      << std::strerror(errno)
-                      << std::endl;
+        case RESULT_TIMEOUT:
+            return STATE_FILTERED;
 
-        return false;
+        default:
+            break;
     }
 
-    // we are connected, print port
-    if (! Arg::get_instace().verbose())
-        std::cout << port << std::endl;
-    m_established = true;
-
-    bool ret = read_service(service);
-
-    // now we can close the socket
-    close_socket();
+    return STATE_UNKNOWN;
+}
 
-    return ret;
+/**
+ * Events the probe waits for.
+ *
+ * @return poll() events
+ */
+short Connect::events() const
+{
+    if (m_socket == kNoSocket)
+        return 0;
 
+    return m_established ? POLLIN : POLLOUT;
 }
 
 /**
- * Try to connect using ipv6 connection.
+ * Start non-blocking connect.
  *
- * @param service service to determinate
- * @param sockaddr initialized sockaddr_in for connect
- * @param port a port to connect to
+ * @return void
  */
-bool Connect::examine_ipv6(std::string & service,
-                           struct sockaddr_in6 * sockaddr,
-                           port_t port)
+void Connect::start()
 {
+    const struct sockaddr * addr =
+        reinterpret_cast<const struct sockaddr *>(&m_target->addr.addr);
+
+    m_started = Engine::now();
+
+    if (m_delay)
+        m_deadline = m_started + static_cast<msec_t>(m_delay) * 1000;
+
+    if (m_connect_timeout)
+        m_connect_deadline = m_started + m_connect_timeout;
+
+    // job's time budget cuts the probe
+    if (m_expiry && (! m_deadline || m_expiry < m_deadline))
+        m_deadline = m_expiry;
+
     // create socket
-    signal(SIGTERM, connect_socket_close);
-    m_socket = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    m_socket = Network::current().open(addr->sa_family);
+    if (m_socket < 0) {
+        m_socket = kNoSocket;
+        finish(RESULT_ERROR, "socket", errno);
+        return;
+    }
+
+    struct sockaddr_storage sockaddr = m_target->addr.addr;
+    if (addr->sa_family == AF_INET)
+        reinterpret_cast<struct sockaddr_in *>(&sockaddr)->sin_port = htons(m_port);
+    else
+        reinterpret_cast<struct sockaddr_in6 *>(&sockaddr)->sin6_port = htons(m_port);
 
     // estamblish connection...
-    if (connect(m_socket, reinterpret_cast<struct sockaddr *>(sockaddr),
-                sizeof(struct sockaddr_in6)) < 0) {
-        // unable connect to given port
-        if (Arg::get_instace().verbose())
-            std::cerr << "Warn: Cannot connect to given port: "
-                      << std::strerror(errno)
-                      << std::endl;
+    if (Network::current().connect(m_socket, reinterpret_cast<struct sockaddr *>(&sockaddr),
+                                   m_target->addr.addrlen) < 0) {
+        if (errno != EINPROGRESS)
+            finish(RESULT_REFUSED, NULL, errno);
 
-        return false;
+        return;
     }
 
-    // we are connected, print port
-    if (! Arg::get_instace().verbose())
-        std::cout << port << std::endl;
     m_established = true;
+    m_measured = true;
 
-    bool ret = read_service(service);
+    if (m_tls)
+        send_hello();
+}
 
-    // now we can close the socket
-    close_socket();
+/**
+ * Handle events on the socket.
+ *
+ * @param revents events returned by poll()
+ * @return void
+ */
+void Connect::handle(short revents)
+{
+    if (done() || m_socket == kNoSocket)
+        return;
+
+    if (! m_established)
+        check_connect();
+    else
+        read_service();
 
-    return ret;
+    UNUSED(revents);
 }
 
 /**
- * Check for connection on port `port' on host `host' and return service name
- * (if any).
+ * Timeout expired.
  *
- * @param   service service name for callee
- * @param   port port number to connect to
- * @param   host host name to connect to (IPv4, IPv6 or domain)
- * @return  true if connection was estambished and service contains service name
+ * @return void
  */
-bool Connect::examine(std::string & service, port_t port, const char * host)
+void Connect::timeout()
 {
-    service.erase(); // clear the output
-    m_established = false;
+    // banner was read, report what the dialogue got so far
+    if (m_dialog) {
+        finish_dialog();
+        return;
+    }
 
-    struct addrinfo     * res = NULL;
-    struct sockaddr_in  * addr;
-    struct sockaddr_in6 * addr6;
-
-    int ret = getaddrinfo(host, NULL, NULL, &res);
-
-    // if verbose, always print port
-    if (Arg::get_instace().verbose())
-        std::cout << port << std::endl;
-
-    // use first family with ipv6 or ipv4
-    if (! ret) {
-        for (struct addrinfo * result = res; result != NULL; result = result->ai_next) {
-            switch (result->ai_family) {
-                case AF_INET:
-                    addr = reinterpret_cast<struct sockaddr_in *>(result->ai_addr);
-                    addr->sin_port = htons(port);
-                    freeaddrinfo(res);
-                    return examine_ipv4(service, addr, port);
-                    break;
-
-                case AF_INET6:
-                    addr6 = reinterpret_cast<struct sockaddr_in6 *>(result->ai_addr);
-                    addr6->sin6_port = htons(port);
-                    freeaddrinfo(res);
-                    return examine_ipv6(service, addr6, port);
-                    break;
-
-               default:
-                    break;
-            }
-        }
+    finish(RESULT_TIMEOUT);
+}
+
+/**
+ * Cancel the probe without reporting it to its job.
+ *
+ * @return void
+ */
+void Connect::detach()
+{
+    m_job = NULL;
+
+    if (! done())
+        finish(RESULT_TIMEOUT);
+}
+
+/**
+ * Check result of non-blocking connect.
+ *
+ * @return void
+ */
+void Connect::check_connect()
+{
+    int err = 0;
+
+    if (Network::current().pending_error(m_socket, err) < 0)
+        err = errno;
+
+    if (err == EINPROGRESS || err == EALREADY)
+        return;
+
+    // SYN-ACK or RST came from the host itself
+    if (! err || err == ECONNREFUSED) {
+        m_rtt = Engine::now() - m_started;
+        m_measured = true;
     }
 
-    // this should never fail, try_translate() was called to be sure it can be
-    // translated
-    if (! ret)
-        std::cerr << "Err: failed to get info\n";
+    if (err) {
+        // unable connect to given port
+        finish(RESULT_REFUSED, NULL, err);
+        return;
+    }
+
+    // we are connected, wait for banner
+    m_established = true;
+
+    if (m_tls)
+        send_hello();
+}
+
+/**
+ * Send ClientHello, it fits into the empty send buffer of a new connection.
+ *
+ * @return void
+ */
+void Connect::send_hello()
+{
+    std::string hello = tls_client_hello(m_target->name);
 
-    return false;
+    if (Network::current().write(m_socket, hello.data(), hello.size()) < 0)
+        finish(RESULT_ERROR, "write", errno);
 }
 
 /**
@@ -224,154 +334,268 @@ bool Connect::examine(std::string & service, port_t port, const char * host)
  *
  * @param out output stream used to output the string
  * @param host host to print
+ * @param addr address the host was scanned at, NULL if it was not translated
+ * @param alias name found by reverse lookup of numeric host, optional
  * @return void
  */
-void Connect::pretty_host_print(std::ostream & out, const std::string & host)
+void Connect::pretty_host_print(std::ostream & out, const std::string & host,
+                                const Address * addr, const std::string & alias)
 {
     const int STR_SIZE = 80;
 
-    struct addrinfo * result;
-    struct addrinfo * res;
     char str[STR_SIZE];
+    bool ip_print = false;
+
+    if (addr) {
+        switch (addr->addr.ss_family) {
+            case AF_INET:
+                const struct sockaddr_in  *sockaddr_ipv4;
+                sockaddr_ipv4 = reinterpret_cast<const struct sockaddr_in *>(&addr->addr);
+                ip_print = inet_ntop(AF_INET, static_cast<const void *>(&sockaddr_ipv4->sin_addr),
+                                     str, STR_SIZE) != NULL;
+                break;
+
+            case AF_INET6:
+                const struct sockaddr_in6  *sockaddr_ipv6;
+                sockaddr_ipv6 = reinterpret_cast<const struct sockaddr_in6 *>(&addr->addr);
+                ip_print = inet_ntop(AF_INET6, static_cast<const void *>(&sockaddr_ipv6->sin6_addr),
+                                     str, STR_SIZE) != NULL
+                           && strncmp(str, "::", 2);
+                break;
 
-    // have we a record for ipv4 or ipv6?
-    bool ip6_printed = false;
-    bool ip4_printed = false;
-    bool ip_print = true;
-
-    // remembered adresses
-    std::string ip6;
-    std::string ip4;
-
-    // translate host!
-    if (! getaddrinfo(host.c_str() , NULL, NULL, &result)) {
-        for (res = result; res != NULL; res = res->ai_next) {
-            switch (res->ai_family) {
-                case AF_INET:
-                    struct sockaddr_in  *sockaddr_ipv4;
-                    sockaddr_ipv4 = reinterpret_cast<struct sockaddr_in *>(res->ai_addr);
-                    inet_ntop(AF_INET, static_cast<void *>(&sockaddr_ipv4->sin_addr),
-                              str, STR_SIZE);
-
-                    if (! strcmp(str, host.c_str()))
-                        ip_print = false;
-                    else if (! ip4_printed) {
-                        ip4_printed = true;
-                        ip4 = str;
-                    }
-
-                case AF_INET6:
-                    struct sockaddr_in6  *sockaddr_ipv6;
-                    sockaddr_ipv6 = reinterpret_cast<struct sockaddr_in6 *>(res->ai_addr);
-                    inet_ntop(AF_INET6, static_cast<void *>(&sockaddr_ipv6->sin6_addr),
-                              str, STR_SIZE);
-
-                    if (! strcmp(str, host.c_str()))
-                        ip_print = false;
-                    else if (! ip6_printed && strncmp(str, "::", 2)) {
-                        ip6 = str;
-                        ip6_printed = true;
-                    }
-                    break;
-
-                default:
-                    break;
-            }
+            default:
+                break;
         }
 
-        freeaddrinfo(result);
+        // numeric host is not repeated
+        if (ip_print && ! strcmp(str, host.c_str()))
+            ip_print = false;
     }
 
-    // prefer ipv6 when available
-    if (ip6_printed && ip_print)
-        out << ip6;
-    else if (ip4_printed && ip_print)
-        out << ip4;
-
-    if ((ip4_printed || ip6_printed) && ip_print)
-        out << " (" << host << ")\n";
+    if (ip_print)
+        out << str << " (" << host << ")\n";
+    else if (! alias.empty())
+        out << host << " (" << alias << ")" << std::endl;
     else
         out << host << std::endl;
 }
 
 /**
- * Try to translate address to ipv4 or ipv6.
+ * Print reason why host translation failed.
  *
- * @param host host to be translated
- * @return false if translation failed
+ * @param err output stream for error messages
+ * @param ret getaddrinfo() return value
+ * @return void
  */
-bool Connect::try_translate(const std::string & host)
+void Connect::print_translate_error(std::ostream & err, int ret)
 {
-    struct addrinfo * res;
-
-    int ret = getaddrinfo(host.c_str() , NULL, NULL, &res);
-
-    if (ret || res == NULL) {
-        switch(ret) {
+    switch(ret) {
 // on some systems (e.g. BSD) macros EAI_NODATA and EAI_ADDRFAMILY are marked as
 // obsolete
 #if defined(EAI_NODATA)
 #if defined(EAI_ADDRFAMILY)
-            case EAI_NODATA:
-            case EAI_ADDRFAMILY:
-                std::cerr << "Err: Server not found\n";
-                return false;
-                break;
+        case EAI_NODATA:
+        case EAI_ADDRFAMILY:
+            err << "Err: Server not found\n";
+            break;
 #endif
 #endif
 
-            case EAI_NONAME:
-                std::cerr << "Err: unknown service or name\n";
-                return false;
-                break;
+        case EAI_NONAME:
+            err << "Err: unknown service or name\n";
+            break;
 
-            case NO_RECOVERY:
-            case EAI_AGAIN:
-            case EAI_FAIL:
-            default:
-                std::cerr << "Err: DNS error\n";
-                return false;
-                break;
-        }
+        case NO_RECOVERY:
+        case EAI_AGAIN:
+        case EAI_FAIL:
+        default:
+            err << "Err: DNS error\n";
+            break;
+    }
+}
 
-        std::cerr << "Err: error while retrieving host info\n";
+/**
+ * Try to translate address to ipv4 or ipv6.
+ *
+ * @param err output stream for error messages
+ * @param host host to be translated
+ * @param addrs translated addresses
+ * @return false if translation failed
+ */
+bool Connect::try_translate(std::ostream & err, const std::string & host,
+                            addrlist_t & addrs)
+{
+    int ret = Resolver::get_instace().resolve(host, addrs);
 
+    if (ret || addrs.empty()) {
+        print_translate_error(err, ret);
         return false;
     }
 
-    if (! ret)
-        freeaddrinfo(res);
-
-    return ret == 0;
+    return true;
 }
 
 /**
  * Read data from opened socket.
  *
- * @param service service which was read from socket
- * @return false on error
+ * @return void
  */
-bool Connect::read_service(std::string & service)
+void Connect::read_service()
 {
-    char buf;
+    char buf[512];
+
+    ssize_t len = Network::current().read(m_socket, buf, sizeof(buf));
+
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            finish(RESULT_ERROR, "read", errno);
+
+        return;
+    }
 
-    for (;;) {
-        if (read(m_socket, &buf, 1) < 0) {
-            std::cerr << "Err: read: " << std::strerror(errno) << std::endl;
-            return false;
+    // peer closed the connection, take what we have
+    if (len == 0 && m_dialog) {
+        finish_dialog();
+        return;
+    }
+
+    if (len == 0) {
+        if (m_tls && ! m_service.empty()) {
+            TlsInfo info;
+            tls_parse(m_service.data(), m_service.size(), info);
+            m_service = tls_describe(info);
         }
 
-        // do not put \r to service name
-        if (buf == '\r')
-            continue;
+        finish(RESULT_SERVICE);
+        return;
+    }
 
-        // read till end-of-line
-        if (buf == '\n')
-            break;
+    if (m_dialog)
+        continue_dialog(buf, len);
+    else if (m_tls)
+        read_tls(buf, len);
+    else
+        read_line(buf, len);
+}
+
+/**
+ * Append received data to banner, finish at end of line.
+ *
+ * @param buf received data
+ * @param len count of bytes
+ * @return void
+ */
+void Connect::read_line(const char * buf, size_t len)
+{
+    // read till end-of-line, do not put \r to service name
+    bool eol = false;
 
-        service.append(1, buf);
+    for (const char * ptr = buf, * end = buf + len; ptr < end; ) {
+        size_t run = scan_eol(ptr, end - ptr);
+
+        m_service.append(ptr, run);
+        ptr += run;
+
+        if (ptr < end && *ptr++ == '\n') {
+            // the rest belongs to the dialogue
+            if (m_dialogs && start_dialog(ptr, end - ptr))
+                return;
+
+            eol = true;
+            break;
+        }
     }
 
+    if (eol || m_service.size() >= kMaxService)
+        finish(RESULT_SERVICE);
+}
+
+/**
+ * Start dialogue if there is a script for the banner.
+ *
+ * @param buf data received after the banner
+ * @param len count of bytes
+ * @return false if there is no script
+ */
+bool Connect::start_dialog(const char * buf, size_t len)
+{
+    const Dialog::Script * script = Dialog::find(m_service);
+
+    if (! script)
+        return false;
+
+    m_dialog = new Dialog(script, m_service);
+    continue_dialog(buf, len);
+
     return true;
 }
 
+/**
+ * Feed received data to the dialogue and send its reply.
+ *
+ * @param buf received data
+ * @param len count of bytes
+ * @return void
+ */
+void Connect::continue_dialog(const char * buf, size_t len)
+{
+    std::string send;
+
+    if (m_dialog->feed(buf, len, send) == DIALOG_DONE) {
+        if (! send.empty())
+            Network::current().write(m_socket, send.data(), send.size());
+
+        finish_dialog();
+        return;
+    }
+
+    // replies are short, they fit into the send buffer
+    if (! send.empty() && Network::current().write(m_socket, send.data(), send.size()) < 0) {
+        finish_dialog();
+        return;
+    }
+
+    m_dialog_deadline = Engine::now() + kDialogTimeout;
+}
+
+/**
+ * Report banner with whatever the dialogue collected.
+ *
+ * @return void
+ */
+void Connect::finish_dialog()
+{
+    m_service += m_dialog->result();
+    finish(RESULT_SERVICE);
+}
+
+/**
+ * Append received data to TLS handshake, finish with its description once
+ * the certificate was seen.
+ *
+ * @param buf received data
+ * @param len count of bytes
+ * @return void
+ */
+void Connect::read_tls(const char * buf, size_t len)
+{
+    m_service.append(buf, len);
+
+    TlsInfo info;
+    tls_status_t status = tls_parse(m_service.data(), m_service.size(), info);
+
+    // not TLS, the service sent its banner right away
+    if (status == TLS_ERROR && ! info.records) {
+        std::string data;
+
+        data.swap(m_service);
+        m_tls = false;
+        read_line(data.data(), data.size());
+        return;
+    }
+
+    if (status != TLS_MORE || m_service.size() >= kMaxService) {
+        m_service = tls_describe(info);
+        finish(RESULT_SERVICE);
+    }
+}
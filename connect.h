@@ -12,34 +12,119 @@
 #include <iostream>
 #include <string>
 
+#include "resolver.h"
+
+class Dialog;
+class Job;
+class Target;
+
 /**
- * @brief Singleton to estamblish connection and receive banner info
+ * @brief Non-blocking probe to estamblish connection and receive banner info
  */
 class Connect {
   public:
-    static Connect & get_instace();
-
-    bool examine(std::string & service, port_t port, const char * host);
-    void close_socket();
-    static void pretty_host_print(std::ostream & out, const std::string & host);
-    static bool try_translate(const std::string & host);
-    bool established() { return m_established; }
+    /**
+     * @brief Outcome of the probe.
+     */
+    enum result_t {
+        RESULT_NONE,      ///<! probe is still running
+        RESULT_SERVICE,   ///<! connected, service banner was read
+        RESULT_REFUSED,   ///<! unable to connect
+        RESULT_TIMEOUT,   ///<! timeout (connected or not, see established())
+        RESULT_ERROR      ///<! system error, see error() and what()
+    };
 
-  private:
-    bool examine_ipv4(std::string & service, struct sockaddr_in * sockaddr, port_t port);
-    bool examine_ipv6(std::string & service, struct sockaddr_in6 * sockaddr, port_t port);
-    bool read_service(std::string & service);
+    /**
+     * @brief State of the port derived from the outcome.
+     */
+    enum state_t {
+        STATE_UNKNOWN,    ///<! probe failed locally
+        STATE_OPEN,       ///<! connection was established
+        STATE_CLOSED,     ///<! host refused the connection
+        STATE_FILTERED    ///<! no answer from the host
+    };
 
-    Connect();
+    Connect(Job * job, Target * target, port_t port, delay_t delay,
+            bool liveness = false);
     ~Connect();
 
+    void start();
+    void handle(short revents);
+    void timeout();
+    void detach();
+    void set_connect_timeout(msec_t timeout) { m_connect_timeout = timeout; }
+    void set_attempt(unsigned attempt) { m_attempt = attempt; }
+    void set_expiry(msec_t expiry) { m_expiry = expiry; }
+    void set_tls(bool tls) { m_tls = tls; }
+    void set_dialog(bool dialog) { m_dialogs = dialog; }
+
+    int      fd() const { return m_socket; }
+    short    events() const;
+    msec_t   deadline() const;
+    bool     done() const { return m_result != RESULT_NONE; }
+
+    Job    * job() const { return m_job; }
+    Target * target() const { return m_target; }
+    port_t   port() const { return m_port; }
+    bool     liveness() const { return m_liveness; }
+
+    unsigned attempt() const { return m_attempt; }
+
+    result_t result() const { return m_result; }
+    state_t  state() const;
+    bool     established() const { return m_established; }
+    bool     measured() const { return m_measured; }
+    msec_t   rtt() const { return m_rtt; }
+    int      error() const { return m_error; }
+    const char * what() const { return m_what; }
+    const std::string & service() const { return m_service; }
+
+    static void pretty_host_print(std::ostream & out, const std::string & host,
+                                  const Address * addr,
+                                  const std::string & alias = std::string());
+    static bool try_translate(std::ostream & err, const std::string & host,
+                              addrlist_t & addrs);
+    static void print_translate_error(std::ostream & err, int ret);
+
+  private:
+    void close_socket();
+    void finish(result_t result, const char * what = NULL, int err = 0);
+    void check_connect();
+    void read_service();
+    void read_line(const char * buf, size_t len);
+    void read_tls(const char * buf, size_t len);
+    void send_hello();
+    bool start_dialog(const char * buf, size_t len);
+    void continue_dialog(const char * buf, size_t len);
+    void finish_dialog();
+
     const int kNoSocket;    ///<! no socket was opened
+    Job * m_job;            ///<! job the probe belongs to, NULL if detached
+    Target * m_target;      ///<! host to connect to
+    port_t m_port;          ///<! port to connect to
+    delay_t m_delay;        ///<! timeout in seconds, 0 for none
+    bool m_liveness;        ///<! probe only checks the host is up
+    bool m_tls;             ///<! TLS handshake is read instead of banner
+    bool m_dialogs;         ///<! dialogue follows banner if a script matches
+    Dialog * m_dialog;      ///<! dialogue in progress, NULL if none
+    msec_t m_dialog_deadline; ///<! time when dialogue step times out
+    unsigned m_attempt;     ///<! attempt number, starting from 1
     int m_socket;           ///<! opened socket to read from
+    msec_t m_deadline;      ///<! time when the probe times out, 0 for none
+    msec_t m_connect_timeout; ///<! time to wait for connect, 0 for m_delay
+    msec_t m_connect_deadline; ///<! time when connect times out, 0 for none
+    msec_t m_expiry;        ///<! time the probe cannot run past, 0 for none
+    msec_t m_started;       ///<! time when the probe was started
+    msec_t m_rtt;           ///<! time it took the host to answer connect
+    bool m_measured;        ///<! m_rtt holds round-trip time of the host
     bool m_established;     ///<! true if connection was established
+    result_t m_result;      ///<! outcome of the probe
+    int m_error;            ///<! errno for RESULT_REFUSED and RESULT_ERROR
+    const char * m_what;    ///<! failed call for RESULT_ERROR
+    std::string m_service;  ///<! banner read so far
 
     // dissallow copy and assign
     DISABLE_COPY_AND_ASSIGN(Connect);
 }; // class Connect
 
 #endif // CONNECT_H_
-
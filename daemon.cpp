@@ -0,0 +1,396 @@
+/**
+ * @file   daemon.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Daemon accepting scan jobs on unix domain socket.
+ */
+
+#include "daemon.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "host.h"
+#include "job.h"
+
+/**
+ * Maximum size of a job request (options and targets).
+ */
+static const size_t kMaxRequest = 16 * 1024 * 1024;
+
+/**
+ * Set descriptor to non-blocking mode.
+ *
+ * @param fd descriptor
+ * @return false on error
+ */
+static bool set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+/**
+ * Stop the daemon on signal.
+ *
+ * @param signum signal number
+ * @return void
+ */
+static void daemon_stop(int signum)
+{
+    UNUSED(signum);
+
+    Engine::stop();
+}
+
+/**
+ * Constructor.
+ *
+ * @param socket accepted client socket
+ */
+Client::Client(int socket)
+{
+    m_socket = socket;
+    m_in = NULL;
+    m_hosts = NULL;
+    m_job = NULL;
+    m_reading = true;
+}
+
+/**
+ * Destructor.
+ */
+Client::~Client()
+{
+    close_client();
+
+    delete m_hosts;
+    delete m_in;
+}
+
+/**
+ * Cancel the job and close the connection.
+ *
+ * @return void
+ */
+void Client::close_client()
+{
+    if (m_job) {
+        Engine::get_instace().remove_job(m_job);
+        delete m_job;
+        m_job = NULL;
+    }
+
+    if (m_socket >= 0)
+        close(m_socket);
+
+    m_socket = -1;
+}
+
+/**
+ * Events the client waits for.
+ *
+ * @return poll() events
+ */
+short Client::events() const
+{
+    if (m_socket < 0)
+        return 0;
+
+    if (m_reading)
+        return POLLIN;
+
+    if (! m_pending.empty() || m_out.tellp() > 0)
+        return POLLOUT;
+
+    return 0;
+}
+
+/**
+ * Check if the client can be released.
+ *
+ * @return true if the job is done and all its output was sent
+ */
+bool Client::done() const
+{
+    if (m_socket < 0)
+        return true;
+
+    return ! m_reading && (m_job == NULL || m_job->done())
+        && m_pending.empty() && m_out.tellp() <= 0;
+}
+
+/**
+ * Reject the job.
+ *
+ * @param msg error message sent to the client
+ * @return void
+ */
+void Client::fail(const char * msg)
+{
+    m_out << "Err: " << msg << std::endl;
+}
+
+/**
+ * Parse job request and submit the job to the engine.
+ *
+ * The first line of the request holds options, other lines are targets.
+ *
+ * @return false if the request is malformed
+ */
+bool Client::start_job()
+{
+    size_t eol = m_request.find('\n');
+    std::istringstream options(m_request.substr(0, eol));
+    std::vector<std::string> tokens;
+    std::vector<const char *> argv;
+    std::string token;
+
+    while (options >> token)
+        tokens.push_back(token);
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+        argv.push_back(tokens[i].c_str());
+
+    int argc = argv.size();
+    for (int i = 0; i < argc; ++i) {
+        switch (m_settings.parse(argc, &argv[0], i, m_out)) {
+            case Settings::PARSE_OK:
+                break;
+
+            case Settings::PARSE_UNKNOWN:
+                fail("bad arguments");
+                return false;
+
+            default:
+                return false;
+        }
+    }
+
+    if (! m_settings.finish(m_out))
+        return false;
+
+    m_in = new std::istringstream(eol == std::string::npos ? "" : m_request.substr(eol + 1));
+    m_request.clear();
+
+    m_hosts = new Host();
+    m_hosts->init(m_in);
+
+    m_job = new Job(m_hosts, m_settings, m_out, m_out);
+    Engine::get_instace().add_job(m_job);
+
+    return true;
+}
+
+/**
+ * Send output produced by the job.
+ *
+ * @return void
+ */
+void Client::write_output()
+{
+    if (m_out.tellp() > 0) {
+        m_pending.append(m_out.str());
+        m_out.str("");
+    }
+
+    while (! m_pending.empty()) {
+        ssize_t len = write(m_socket, m_pending.data(), m_pending.size());
+
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EINTR)
+                close_client();
+
+            return;
+        }
+
+        m_pending.erase(0, len);
+    }
+}
+
+/**
+ * Handle events on client socket.
+ *
+ * @param revents events returned by poll()
+ * @return void
+ */
+void Client::handle(short revents)
+{
+    if (m_reading && (revents & (POLLIN | POLLHUP))) {
+        char buf[4096];
+        ssize_t len = read(m_socket, buf, sizeof(buf));
+
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EINTR)
+                close_client();
+            return;
+        }
+
+        if (len > 0) {
+            m_request.append(buf, len);
+
+            if (m_request.size() > kMaxRequest) {
+                m_reading = false;
+                fail("request too long");
+            }
+
+            return;
+        }
+
+        // client shut down its side, the request is complete
+        m_reading = false;
+        start_job();
+        return;
+    }
+
+    if (revents & (POLLERR | POLLHUP)) {
+        close_client();
+        return;
+    }
+
+    if (revents & POLLOUT)
+        write_output();
+}
+
+/**
+ * Constructor.
+ */
+Daemon::Daemon()
+{
+    m_socket = -1;
+}
+
+/**
+ * Destructor.
+ */
+Daemon::~Daemon()
+{
+    if (m_socket >= 0)
+        close(m_socket);
+}
+
+/**
+ * Access singleton
+ *
+ * @return singleton instance
+ */
+Daemon & Daemon::get_instace()
+{
+    static Daemon instance;
+    return instance;
+}
+
+/**
+ * Events the daemon waits for.
+ *
+ * @return poll() events
+ */
+short Daemon::events() const
+{
+    return POLLIN;
+}
+
+/**
+ * Accept new clients.
+ *
+ * @param revents events returned by poll()
+ * @return void
+ */
+void Daemon::handle(short revents)
+{
+    UNUSED(revents);
+
+    for (;;) {
+        int client = accept(m_socket, NULL, NULL);
+
+        if (client < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                std::cerr << "Err: accept: " << std::strerror(errno) << std::endl;
+
+            return;
+        }
+
+        if (! set_nonblock(client)) {
+            close(client);
+            continue;
+        }
+
+        Engine::get_instace().watch(new Client(client));
+    }
+}
+
+/**
+ * Listen on unix domain socket and serve jobs until a signal is received.
+ *
+ * @param path path of the socket
+ * @return false if an error occourred
+ */
+bool Daemon::run(const std::string & path)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Err: " << path << ": socket path too long\n";
+        return false;
+    }
+
+    strcpy(addr.sun_path, path.c_str());
+
+    m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_socket < 0) {
+        std::cerr << "Err: socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // remove stale socket left by a daemon which is not running anymore
+    struct stat st;
+    if (! stat(path.c_str(), &st) && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool running = probe >= 0
+            && ! connect(probe, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+
+        if (probe >= 0)
+            close(probe);
+
+        if (running) {
+            std::cerr << "Err: " << path << ": daemon is already running\n";
+            return false;
+        }
+
+        unlink(path.c_str());
+    }
+
+    if (bind(m_socket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0
+            || listen(m_socket, SOMAXCONN) < 0
+            || ! set_nonblock(m_socket)) {
+        std::cerr << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_path = path;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, daemon_stop);
+    signal(SIGTERM, daemon_stop);
+
+    Engine::get_instace().watch(this);
+    bool ret = Engine::get_instace().run(true);
+
+    unlink(m_path.c_str());
+
+    return ret;
+}
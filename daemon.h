@@ -0,0 +1,79 @@
+/**
+ * @file   daemon.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Daemon accepting scan jobs on unix domain socket.
+ */
+
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include "tcpsearch.h"
+
+#include <sstream>
+#include <string>
+
+#include "arg.h"
+#include "engine.h"
+
+class Host;
+class Job;
+
+/**
+ * @brief Connected client submitting one job
+ */
+class Client : public Pollable {
+  public:
+    explicit Client(int socket);
+    virtual ~Client();
+
+    virtual int   fd() const { return m_socket; }
+    virtual short events() const;
+    virtual void  handle(short revents);
+    virtual bool  done() const;
+
+  private:
+    bool start_job();
+    void fail(const char * msg);
+    void close_client();
+    void write_output();
+
+    int                  m_socket;     ///<! client socket, -1 when closed
+    std::string          m_request;    ///<! request read so far
+    std::string          m_pending;    ///<! output not sent yet
+    mutable std::ostringstream m_out;  ///<! output produced by the job
+    std::istringstream * m_in;         ///<! targets of the job
+    Host               * m_hosts;      ///<! target getter
+    Settings             m_settings;   ///<! options of the job
+    Job                * m_job;        ///<! running job, NULL if none
+    bool                 m_reading;    ///<! request is being read
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Client);
+}; // class Client
+
+/**
+ * @brief Singleton listening on unix domain socket for jobs
+ */
+class Daemon : public Pollable {
+  public:
+    static Daemon & get_instace();
+
+    bool run(const std::string & path);
+
+    virtual int   fd() const { return m_socket; }
+    virtual short events() const;
+    virtual void  handle(short revents);
+    virtual bool  done() const { return false; }
+
+  private:
+    Daemon();
+    virtual ~Daemon();
+
+    int         m_socket;   ///<! listening socket
+    std::string m_path;     ///<! path of the socket
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Daemon);
+}; // class Daemon
+
+#endif // DAEMON_H_
@@ -0,0 +1,628 @@
+/**
+ * @file   decompress.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Decompression of compressed host files in a reader thread.
+ */
+
+#include "decompress.h"
+
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/**
+ * Count and size of buffers of decompressed data.
+ */
+static const size_t kBuffers = 4;
+static const size_t kBufferSize = 1 << 20;
+
+/**
+ * Size of buffer of compressed input.
+ */
+static const size_t kInputSize = 256 * 1024;
+
+/**
+ * Exit status of the child if zstd(1) could not be run.
+ */
+static const int kExecFailed = 127;
+
+/**
+ * Constructor.
+ *
+ * @param in compressed input, it is not owned
+ * @param format compression format
+ */
+Decompressor::Decompressor(FILE * in, format_t format)
+{
+    m_in = in;
+    m_format = format;
+    m_member = false;
+    m_read = 0;
+    m_begin = 0;
+    memset(&m_zstream, 0, sizeof(m_zstream));
+#ifdef HAVE_ZSTD
+    m_zstd = NULL;
+    m_zin.src = NULL;
+    m_zin.size = 0;
+    m_zin.pos = 0;
+#else
+    m_child = -1;
+    m_child_in = -1;
+    m_child_out = -1;
+    m_feeding = false;
+#endif
+    m_running = false;
+    m_current = NULL;
+    m_finished = false;
+    m_quit = false;
+    m_reported = false;
+
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_changed, NULL);
+}
+
+/**
+ * Destructor, stops the reader thread.
+ */
+Decompressor::~Decompressor()
+{
+    pthread_mutex_lock(&m_lock);
+    m_quit = true;
+    pthread_cond_broadcast(&m_changed);
+    pthread_mutex_unlock(&m_lock);
+
+#ifndef HAVE_ZSTD
+    // wakes up threads blocked on the child
+    pthread_mutex_lock(&m_lock);
+    if (m_child > 0)
+        kill(m_child, SIGTERM);
+    pthread_mutex_unlock(&m_lock);
+#endif
+
+    if (m_running)
+        pthread_join(m_thread, NULL);
+
+#ifdef HAVE_ZSTD
+    if (m_zstd)
+        ZSTD_freeDStream(m_zstd);
+#else
+    if (m_feeding)
+        pthread_join(m_feeder, NULL);
+
+    if (m_child_in >= 0)
+        close(m_child_in);
+
+    if (m_child_out >= 0)
+        close(m_child_out);
+
+    if (m_child > 0)
+        waitpid(m_child, NULL, 0);
+#endif
+
+    if (m_format == FORMAT_GZIP)
+        inflateEnd(&m_zstream);
+
+    delete m_current;
+
+    for (size_t i = 0; i < m_full.size(); ++i)
+        delete m_full[i];
+
+    for (size_t i = 0; i < m_free.size(); ++i)
+        delete m_free[i];
+
+    pthread_cond_destroy(&m_changed);
+    pthread_mutex_destroy(&m_lock);
+}
+
+/**
+ * Detect compressed input by its first byte, the rest of magic is checked
+ * by the decompressor.
+ *
+ * @param byte first byte of input
+ * @param format detected format
+ * @return false if input is not compressed
+ */
+bool Decompressor::detect(int byte, format_t & format)
+{
+    // 1f 8b is gzip, 28 b5 2f fd is zstd; neither starts a host name
+    if (byte == 0x1f)
+        format = FORMAT_GZIP;
+    else if (byte == 0x28)
+        format = FORMAT_ZSTD;
+    else
+        return false;
+
+    return true;
+}
+
+/**
+ * Start decompression.
+ *
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool Decompressor::start(std::ostream & err)
+{
+    m_input.resize(kInputSize);
+
+    for (size_t i = 0; i < kBuffers; ++i) {
+        Buffer * buf = new Buffer();
+        buf->data.resize(kBufferSize);
+        buf->len = 0;
+        buf->end = 0;
+        m_free.push_back(buf);
+    }
+
+    if (m_format == FORMAT_GZIP) {
+        // gzip or zlib header is detected automatically
+        if (inflateInit2(&m_zstream, 15 + 32) != Z_OK) {
+            err << "Err: gzip: " << (m_zstream.msg ? m_zstream.msg : "init failed")
+                << std::endl;
+            return false;
+        }
+    } else {
+#ifdef HAVE_ZSTD
+        m_zstd = ZSTD_createDStream();
+        if (! m_zstd || ZSTD_isError(ZSTD_initDStream(m_zstd))) {
+            err << "Err: zstd: init failed" << std::endl;
+            return false;
+        }
+#else
+        if (! spawn(err))
+            return false;
+#endif
+    }
+
+    if (pthread_create(&m_thread, NULL, reader, this)) {
+        err << "Err: pthread_create: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_running = true;
+
+    return true;
+}
+
+/**
+ * Print reason of failure once.
+ *
+ * @param err output stream for error messages
+ * @param name name of input
+ * @return void
+ */
+void Decompressor::report(std::ostream & err, const std::string & name)
+{
+    pthread_mutex_lock(&m_lock);
+
+    if (! m_error.empty() && ! m_reported) {
+        err << "Err: " << name << ": " << m_error << std::endl;
+        m_reported = true;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+/**
+ * Count compressed bytes consumed, interpolated within the buffer being
+ * consumed.
+ *
+ * @return count of bytes
+ */
+uint64_t Decompressor::consumed() const
+{
+    if (! m_current || ! m_current->len)
+        return m_begin;
+
+    uint64_t used = gptr() - eback();
+
+    return m_begin + (m_current->end - m_begin) * used / m_current->len;
+}
+
+/**
+ * Check if decompression failed.
+ *
+ * @return true if input is corrupt or could not be read
+ */
+bool Decompressor::failed()
+{
+    pthread_mutex_lock(&m_lock);
+    bool ret = ! m_error.empty();
+    pthread_mutex_unlock(&m_lock);
+
+    return ret;
+}
+
+/**
+ * Remember reason of failure.
+ *
+ * @param error reason
+ * @return void
+ */
+void Decompressor::fail(const std::string & error)
+{
+    pthread_mutex_lock(&m_lock);
+
+    if (m_error.empty())
+        m_error = error;
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+/**
+ * Hand over next buffer of decompressed data, wait for the reader thread if
+ * there is none.
+ *
+ * @return first character of the buffer, EOF at the end of input
+ */
+Decompressor::int_type Decompressor::underflow()
+{
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+
+    pthread_mutex_lock(&m_lock);
+
+    if (m_current) {
+        m_begin = m_current->end;
+        m_free.push_back(m_current);
+        m_current = NULL;
+        pthread_cond_broadcast(&m_changed);
+    }
+
+    while (m_full.empty() && ! m_finished)
+        pthread_cond_wait(&m_changed, &m_lock);
+
+    if (! m_full.empty()) {
+        m_current = m_full.front();
+        m_full.pop_front();
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    if (! m_current) {
+        setg(NULL, NULL, NULL);
+        return traits_type::eof();
+    }
+
+    char * begin = &m_current->data[0];
+    setg(begin, begin, begin + m_current->len);
+
+    return traits_type::to_int_type(*gptr());
+}
+
+/**
+ * Entry point of reader thread.
+ *
+ * @param arg decompressor
+ * @return NULL
+ */
+void * Decompressor::reader(void * arg)
+{
+    static_cast<Decompressor *>(arg)->run();
+    return NULL;
+}
+
+/**
+ * Fill free buffers until the end of input or until the consumer is gone.
+ *
+ * @return void
+ */
+void Decompressor::run()
+{
+    for (;;) {
+        pthread_mutex_lock(&m_lock);
+
+        while (m_free.empty() && ! m_quit)
+            pthread_cond_wait(&m_changed, &m_lock);
+
+        if (m_quit) {
+            pthread_mutex_unlock(&m_lock);
+            return;
+        }
+
+        Buffer * buf = m_free.front();
+        m_free.pop_front();
+
+        pthread_mutex_unlock(&m_lock);
+
+        buf->len = 0;
+        bool more = fill(*buf);
+
+        pthread_mutex_lock(&m_lock);
+
+        if (buf->len)
+            m_full.push_back(buf);
+        else
+            m_free.push_back(buf);
+
+        if (! more)
+            m_finished = true;
+
+        pthread_cond_broadcast(&m_changed);
+        pthread_mutex_unlock(&m_lock);
+
+        if (! more)
+            return;
+    }
+}
+
+/**
+ * Decompress data to buffer.
+ *
+ * @param buf buffer to be filled
+ * @return false at the end of input or on error
+ */
+bool Decompressor::fill(Buffer & buf)
+{
+    if (m_format == FORMAT_GZIP)
+        return fill_gzip(buf);
+
+#ifdef HAVE_ZSTD
+    return fill_zstd(buf);
+#else
+    return fill_child(buf);
+#endif
+}
+
+/**
+ * Decompress gzip data to buffer, members may be concatenated.
+ *
+ * @param buf buffer to be filled
+ * @return false at the end of input or on error
+ */
+bool Decompressor::fill_gzip(Buffer & buf)
+{
+    m_zstream.next_out = reinterpret_cast<Bytef *>(&buf.data[0]);
+    m_zstream.avail_out = buf.data.size();
+
+    bool more = true;
+
+    while (m_zstream.avail_out) {
+        if (! m_zstream.avail_in) {
+            size_t n = fread(&m_input[0], 1, m_input.size(), m_in);
+
+            if (! n) {
+                if (ferror(m_in))
+                    fail(std::string("read: ") + std::strerror(errno));
+                else if (m_member)
+                    fail("unexpected end of gzip input");
+
+                more = false;
+                break;
+            }
+
+            m_zstream.next_in = reinterpret_cast<Bytef *>(&m_input[0]);
+            m_zstream.avail_in = n;
+            m_read += n;
+        }
+
+        int ret = inflate(&m_zstream, Z_NO_FLUSH);
+
+        if (ret == Z_STREAM_END) {
+            inflateReset(&m_zstream);
+            m_member = false;
+        } else if (ret == Z_OK) {
+            m_member = true;
+        } else {
+            fail(std::string("gzip: ") + (m_zstream.msg ? m_zstream.msg : "corrupt input"));
+            more = false;
+            break;
+        }
+    }
+
+    buf.len = buf.data.size() - m_zstream.avail_out;
+    buf.end = m_read - m_zstream.avail_in;
+
+    return more;
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * Decompress zstd data to buffer, frames may be concatenated.
+ *
+ * @param buf buffer to be filled
+ * @return false at the end of input or on error
+ */
+bool Decompressor::fill_zstd(Buffer & buf)
+{
+    ZSTD_outBuffer out;
+    out.dst = &buf.data[0];
+    out.size = buf.data.size();
+    out.pos = 0;
+
+    bool more = true;
+
+    while (out.pos < out.size) {
+        if (m_zin.pos == m_zin.size) {
+            size_t n = fread(&m_input[0], 1, m_input.size(), m_in);
+
+            if (! n) {
+                if (ferror(m_in))
+                    fail(std::string("read: ") + std::strerror(errno));
+                else if (m_member)
+                    fail("unexpected end of zstd input");
+
+                more = false;
+                break;
+            }
+
+            m_zin.src = &m_input[0];
+            m_zin.size = n;
+            m_zin.pos = 0;
+            m_read += n;
+        }
+
+        size_t ret = ZSTD_decompressStream(m_zstd, &out, &m_zin);
+
+        if (ZSTD_isError(ret)) {
+            fail(std::string("zstd: ") + ZSTD_getErrorName(ret));
+            more = false;
+            break;
+        }
+
+        // 0 means a frame was completed
+        m_member = ret != 0;
+    }
+
+    buf.len = out.pos;
+    buf.end = m_read - (m_zin.size - m_zin.pos);
+
+    return more;
+}
+#else
+/**
+ * Run zstd(1) decompressing input fed by feeder thread.
+ *
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool Decompressor::spawn(std::ostream & err)
+{
+    int in[2];
+    int out[2];
+
+    // socket, so that feeding a dead child does not raise SIGPIPE
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) < 0) {
+        err << "Err: socketpair: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (pipe(out) < 0) {
+        err << "Err: pipe: " << std::strerror(errno) << std::endl;
+        close(in[0]);
+        close(in[1]);
+        return false;
+    }
+
+    m_child = fork();
+
+    if (m_child == 0) {
+        dup2(in[1], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+
+        // failures are reported by exit status
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+            dup2(null, STDERR_FILENO);
+
+        execlp("zstd", "zstd", "-dcq", static_cast<char *>(NULL));
+        _exit(kExecFailed);
+    }
+
+    close(in[1]);
+    close(out[1]);
+
+    if (m_child < 0) {
+        err << "Err: fork: " << std::strerror(errno) << std::endl;
+        close(in[0]);
+        close(out[0]);
+        return false;
+    }
+
+    m_child_in = in[0];
+    m_child_out = out[0];
+
+    if (pthread_create(&m_feeder, NULL, feeder, this)) {
+        err << "Err: pthread_create: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_feeding = true;
+
+    return true;
+}
+
+/**
+ * Entry point of feeder thread.
+ *
+ * @param arg decompressor
+ * @return NULL
+ */
+void * Decompressor::feeder(void * arg)
+{
+    static_cast<Decompressor *>(arg)->feed();
+    return NULL;
+}
+
+/**
+ * Copy compressed input to the child.
+ *
+ * @return void
+ */
+void Decompressor::feed()
+{
+    bool ok = true;
+
+    while (ok) {
+        size_t n = fread(&m_input[0], 1, m_input.size(), m_in);
+        if (! n)
+            break;
+
+        // read by the reader thread as well
+        __atomic_add_fetch(&m_read, n, __ATOMIC_RELAXED);
+
+        for (size_t off = 0; ok && off < n; ) {
+            ssize_t sent = send(m_child_in, &m_input[off], n - off, MSG_NOSIGNAL);
+
+            if (sent >= 0)
+                off += sent;
+            else if (errno != EINTR)
+                ok = false;
+        }
+    }
+
+    if (ok && ferror(m_in))
+        fail(std::string("read: ") + std::strerror(errno));
+
+    shutdown(m_child_in, SHUT_WR);
+}
+
+/**
+ * Read output of zstd(1) to buffer.
+ *
+ * @param buf buffer to be filled
+ * @return false at the end of input or on error
+ */
+bool Decompressor::fill_child(Buffer & buf)
+{
+    while (buf.len < buf.data.size()) {
+        ssize_t n = read(m_child_out, &buf.data[buf.len], buf.data.size() - buf.len);
+
+        if (n > 0) {
+            // output of the child lags behind its input by its buffers only
+            buf.len += n;
+            buf.end = __atomic_load_n(&m_read, __ATOMIC_RELAXED);
+            continue;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            fail(std::string("read: ") + std::strerror(errno));
+            return false;
+        }
+
+        int status = 0;
+        waitpid(m_child, &status, 0);
+
+        pthread_mutex_lock(&m_lock);
+        m_child = -1;
+        pthread_mutex_unlock(&m_lock);
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == kExecFailed)
+            fail("zstd: cannot run zstd(1)");
+        else if (! WIFEXITED(status) || WEXITSTATUS(status))
+            fail("zstd: corrupt input");
+
+        return false;
+    }
+
+    return true;
+}
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file   decompress.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Decompression of compressed host files in a reader thread.
+ */
+
+#ifndef DECOMPRESS_H_
+#define DECOMPRESS_H_
+
+#include "tcpsearch.h"
+
+#include <cstdio>
+#include <deque>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * @brief Stream buffer filled by a reader thread which decompresses input
+ *        into large buffers, so decompression runs in parallel with the
+ *        consumer. Without libzstd, zstd input is decompressed by zstd(1).
+ */
+class Decompressor : public std::streambuf {
+  public:
+    /**
+     * @brief Compression format of input.
+     */
+    enum format_t {
+        FORMAT_GZIP,        ///<! gzip (or zlib), members may be concatenated
+        FORMAT_ZSTD         ///<! zstd, frames may be concatenated
+    };
+
+    Decompressor(FILE * in, format_t format);
+    ~Decompressor();
+
+    static bool detect(int byte, format_t & format);
+
+    bool start(std::ostream & err);
+    void report(std::ostream & err, const std::string & name);
+    bool failed();
+    uint64_t consumed() const;
+
+  protected:
+    virtual int_type underflow();
+
+  private:
+    /**
+     * @brief Buffer of decompressed data.
+     */
+    class Buffer {
+      public:
+        std::vector<char> data;     ///<! allocated space
+        size_t            len;      ///<! count of valid bytes
+        uint64_t          end;      ///<! compressed bytes consumed once
+                                    ///<! the buffer was filled
+    };
+
+    static void * reader(void * arg);
+
+    void run();
+    bool fill(Buffer & buf);
+    bool fill_gzip(Buffer & buf);
+#ifdef HAVE_ZSTD
+    bool fill_zstd(Buffer & buf);
+#else
+    static void * feeder(void * arg);
+
+    bool spawn(std::ostream & err);
+    bool fill_child(Buffer & buf);
+    void feed();
+#endif
+    void fail(const std::string & error);
+
+    FILE            * m_in;         ///<! compressed input
+    format_t          m_format;     ///<! compression format
+    std::vector<char> m_input;      ///<! buffer of compressed input
+    z_stream          m_zstream;    ///<! gzip state
+    bool              m_member;     ///<! inside of a gzip member or zstd frame
+    uint64_t          m_read;       ///<! compressed bytes read from m_in
+    uint64_t          m_begin;      ///<! compressed bytes consumed before
+                                    ///<! the buffer being consumed
+#ifdef HAVE_ZSTD
+    ZSTD_DStream    * m_zstd;       ///<! zstd state
+    ZSTD_inBuffer     m_zin;        ///<! unconsumed compressed input
+#else
+    pid_t             m_child;      ///<! zstd(1) process, -1 if none
+    int               m_child_in;   ///<! socket feeding the child
+    int               m_child_out;  ///<! pipe with output of the child
+    pthread_t         m_feeder;     ///<! thread copying input to the child
+    bool              m_feeding;    ///<! feeder thread was started
+#endif
+
+    pthread_t         m_thread;     ///<! reader thread
+    bool              m_running;    ///<! reader thread was started
+    pthread_mutex_t   m_lock;       ///<! guards members below
+    pthread_cond_t    m_changed;    ///<! buffer was filled or released
+    std::deque<Buffer *> m_full;    ///<! buffers ready to be consumed
+    std::deque<Buffer *> m_free;    ///<! buffers ready to be filled
+    Buffer          * m_current;    ///<! buffer being consumed
+    bool              m_finished;   ///<! reader thread produced everything
+    bool              m_quit;       ///<! consumer is gone
+    std::string       m_error;      ///<! reason of failure, empty if none
+    bool              m_reported;   ///<! failure was reported
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Decompressor);
+}; // class Decompressor
+
+#endif // DECOMPRESS_H_
@@ -0,0 +1,351 @@
+/**
+ * @file   dialog.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Multi-step protocol dialogues driven by send/expect scripts.
+ *
+ * A script is a table of steps: data to send, a line-based reply to read
+ * (capabilities are collected from its lines) or an SSH key exchange packet
+ * to parse. Adding a protocol means adding a table, not code.
+ */
+
+#include "dialog.h"
+
+#include <cstring>
+
+/**
+ * Received data beyond this ends the dialogue.
+ */
+static const size_t kMaxInput = 64 * 1024;
+
+/**
+ * Longest SSH packet accepted (RFC 4253 requires 35000 to be supported).
+ */
+static const size_t kMaxPacket = 35000;
+
+/**
+ * SSH_MSG_KEXINIT message number.
+ */
+static const unsigned char kSshKexinit = 20;
+
+/**
+ * @brief Kind of step.
+ */
+enum step_t {
+    STEP_SEND,          ///<! send text
+    STEP_LINES,         ///<! read reply line by line
+    STEP_KEXINIT        ///<! read SSH key exchange packet
+};
+
+/**
+ * @brief Step of a script. For STEP_LINES, the first line must start with
+ *        ok (and is not collected, it only says the command succeeded),
+ *        the reply ends by a line starting with end and lines starting with
+ *        item are collected.
+ */
+class Dialog::Step {
+  public:
+    step_t       kind;      ///<! what the step does
+    const char * text;      ///<! data to send, label of collected items
+    const char * ok;        ///<! prefix of first line, NULL if not checked
+    const char * end;       ///<! prefix of last line
+    const char * item;      ///<! prefix of collected lines
+    size_t       strip;     ///<! leading bytes removed from collected lines
+    bool         keep_end;  ///<! last line is collected too
+};
+
+/**
+ * @brief Script chosen by greeting of the service.
+ */
+class Dialog::Script {
+  public:
+    const char * greeting;  ///<! prefix of greeting
+    const char * contains;  ///<! text greeting must contain, NULL if any
+    const char * more;      ///<! prefix of continued greeting, NULL if none
+    const char * last;      ///<! prefix of last line of continued greeting
+    const Step * steps;     ///<! steps to follow
+    size_t       count;     ///<! count of steps
+};
+
+static const Dialog::Step kSmtp[] = {
+    { STEP_SEND,  "EHLO tcpsearch\r\n", NULL, NULL, NULL, 0, false },
+    { STEP_LINES, "EHLO", "250", "250 ", "250", 4, true },
+    { STEP_SEND,  "QUIT\r\n", NULL, NULL, NULL, 0, false }
+};
+
+static const Dialog::Step kFtp[] = {
+    { STEP_SEND,  "FEAT\r\n", NULL, NULL, NULL, 0, false },
+    { STEP_LINES, "FEAT", "211", "211 ", " ", 1, false },
+    { STEP_SEND,  "QUIT\r\n", NULL, NULL, NULL, 0, false }
+};
+
+static const Dialog::Step kPop3[] = {
+    { STEP_SEND,  "CAPA\r\n", NULL, NULL, NULL, 0, false },
+    { STEP_LINES, "CAPA", "+OK", ".", "", 0, false },
+    { STEP_SEND,  "QUIT\r\n", NULL, NULL, NULL, 0, false }
+};
+
+static const Dialog::Step kImap[] = {
+    { STEP_SEND,  "a1 CAPABILITY\r\n", NULL, NULL, NULL, 0, false },
+    { STEP_LINES, "CAPABILITY", NULL, "a1 ", "* CAPABILITY ", 13, false },
+    { STEP_SEND,  "a2 LOGOUT\r\n", NULL, NULL, NULL, 0, false }
+};
+
+static const Dialog::Step kSsh[] = {
+    { STEP_SEND,  "SSH-2.0-tcpsearch\r\n", NULL, NULL, NULL, 0, false },
+    { STEP_KEXINIT, NULL, NULL, NULL, NULL, 0, false }
+};
+
+#define STEPS(steps) steps, sizeof(steps) / sizeof(steps[0])
+
+/**
+ * Scripts, first one matching the greeting is followed.
+ */
+static const Dialog::Script kScripts[] = {
+    { "220", "SMTP", "220-", "220 ", STEPS(kSmtp) },
+    { "220", NULL,   "220-", "220 ", STEPS(kFtp) },
+    { "+OK", NULL,   NULL,   NULL,   STEPS(kPop3) },
+    { "* OK", NULL,  NULL,   NULL,   STEPS(kImap) },
+    { "SSH-2.0-", NULL, NULL, NULL,  STEPS(kSsh) },
+    { "SSH-1.99-", NULL, NULL, NULL, STEPS(kSsh) }
+};
+
+#undef STEPS
+
+/**
+ * Check if text starts with prefix.
+ *
+ * @param text text
+ * @param prefix prefix
+ * @return true if text starts with prefix
+ */
+static bool starts(const std::string & text, const char * prefix)
+{
+    return ! text.compare(0, strlen(prefix), prefix);
+}
+
+/**
+ * Get big-endian 32 bit number.
+ *
+ * @param p bytes
+ * @return number
+ */
+static size_t get32(const unsigned char * p)
+{
+    return (static_cast<size_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * Constructor.
+ *
+ * @param script script to follow
+ * @param greeting first line sent by the service
+ */
+Dialog::Dialog(const Script * script, const std::string & greeting)
+{
+    m_script = script;
+    m_step = 0;
+    m_lines = 0;
+    m_items = 0;
+    m_greeting = script->more && starts(greeting, script->more);
+    m_offset = 0;
+}
+
+/**
+ * Find script for a service.
+ *
+ * @param greeting first line sent by the service
+ * @return script, NULL if there is none
+ */
+const Dialog::Script * Dialog::find(const std::string & greeting)
+{
+    for (size_t i = 0; i < sizeof(kScripts) / sizeof(kScripts[0]); ++i) {
+        if (! starts(greeting, kScripts[i].greeting))
+            continue;
+
+        if (kScripts[i].contains && greeting.find(kScripts[i].contains) == std::string::npos)
+            continue;
+
+        return &kScripts[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Take next complete line of received data, without its terminator.
+ *
+ * @param line the line
+ * @return false if there is no complete line
+ */
+bool Dialog::next_line(std::string & line)
+{
+    size_t eol = m_input.find('\n', m_offset);
+
+    if (eol == std::string::npos)
+        return false;
+
+    line.assign(m_input, m_offset, eol - m_offset);
+    m_offset = eol + 1;
+
+    if (! line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+
+    return true;
+}
+
+/**
+ * Append collected item to the result.
+ *
+ * @param label label of the step
+ * @param item collected item
+ * @return void
+ */
+void Dialog::collect(const char * label, const std::string & item)
+{
+    if (item.empty())
+        return;
+
+    if (! m_items++) {
+        m_result += " | ";
+        m_result += label;
+        m_result += ": ";
+    } else
+        m_result += ", ";
+
+    m_result += item;
+}
+
+/**
+ * Process a line of reply.
+ *
+ * @param step current step
+ * @param line line of reply
+ * @return false if the reply does not follow the script
+ */
+bool Dialog::expect_line(const Step & step, const std::string & line)
+{
+    bool first = ! m_lines++;
+    bool last = starts(line, step.end);
+
+    if (first && step.ok) {
+        if (! starts(line, step.ok))
+            return false;
+    } else if (! last || step.keep_end) {
+        if (starts(line, step.item) && line.size() > step.strip)
+            collect(step.text, line.substr(step.strip));
+    }
+
+    if (last) {
+        ++m_step;
+        m_lines = 0;
+        m_items = 0;
+    }
+
+    return true;
+}
+
+/**
+ * Parse SSH_MSG_KEXINIT, collect key exchange and host key algorithms.
+ * Malformed packet ends the script.
+ *
+ * @return false if the packet was not received yet
+ */
+bool Dialog::expect_kexinit()
+{
+    const unsigned char * p =
+        reinterpret_cast<const unsigned char *>(m_input.data()) + m_offset;
+    size_t len = m_input.size() - m_offset;
+
+    if (len < 4)
+        return false;
+
+    size_t packet = get32(p);
+    if (packet >= 2 && packet <= kMaxPacket && len - 4 < packet)
+        return false;
+
+    // payload follows padding length and is followed by padding
+    const unsigned char * payload = p + 5;
+    const unsigned char * end = payload;
+
+    if (packet >= 2 && packet <= kMaxPacket && p[4] + 1u <= packet)
+        end = payload + packet - p[4] - 1;
+
+    m_step = m_script->count;
+
+    // message number and cookie
+    if (end - payload < 17 || payload[0] != kSshKexinit)
+        return true;
+
+    payload += 17;
+
+    static const char * const labels[] = { "kex", "hostkey" };
+
+    for (size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); ++i) {
+        if (end - payload < 4)
+            break;
+
+        size_t list = get32(payload);
+        payload += 4;
+
+        if (static_cast<size_t>(end - payload) < list)
+            break;
+
+        m_items = 0;
+        collect(labels[i], std::string(reinterpret_cast<const char *>(payload), list));
+        payload += list;
+    }
+
+    return true;
+}
+
+/**
+ * Feed received data and follow the script as far as possible.
+ *
+ * @param data received data
+ * @param len count of bytes
+ * @param send data to be sent to the service is appended here
+ * @return DIALOG_DONE if the dialogue is over
+ */
+dialog_status_t Dialog::feed(const char * data, size_t len, std::string & send)
+{
+    std::string line;
+
+    m_input.append(data, len);
+
+    if (m_input.size() > kMaxInput)
+        return DIALOG_DONE;
+
+    // rest of greeting was not read together with its first line
+    while (m_greeting) {
+        if (! next_line(line))
+            return DIALOG_MORE;
+
+        m_greeting = ! starts(line, m_script->last);
+    }
+
+    while (m_step < m_script->count) {
+        const Step & step = m_script->steps[m_step];
+
+        switch (step.kind) {
+            case STEP_SEND:
+                send += step.text;
+                ++m_step;
+                break;
+
+            case STEP_LINES:
+                if (! next_line(line))
+                    return DIALOG_MORE;
+
+                if (! expect_line(step, line))
+                    return DIALOG_DONE;
+                break;
+
+            case STEP_KEXINIT:
+                if (! expect_kexinit())
+                    return DIALOG_MORE;
+                break;
+        }
+    }
+
+    return DIALOG_DONE;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file   dialog.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Multi-step protocol dialogues driven by send/expect scripts.
+ */
+
+#ifndef DIALOG_H_
+#define DIALOG_H_
+
+#include "tcpsearch.h"
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Progress of a dialogue.
+ */
+enum dialog_status_t {
+    DIALOG_MORE,    ///<! more data is needed
+    DIALOG_DONE     ///<! script finished or the server deviated from it
+};
+
+/**
+ * @brief Conversation with a service following a script chosen by its
+ *        greeting. The dialogue does no I/O itself, it is fed received data
+ *        and returns data to be sent, so the probe can run it from the event
+ *        loop.
+ */
+class Dialog {
+  public:
+    class Step;
+    class Script;
+
+    Dialog(const Script * script, const std::string & greeting);
+
+    static const Script * find(const std::string & greeting);
+
+    dialog_status_t feed(const char * data, size_t len, std::string & send);
+    const std::string & result() const { return m_result; }
+
+  private:
+    bool next_line(std::string & line);
+    bool expect_line(const Step & step, const std::string & line);
+    bool expect_kexinit();
+    void collect(const char * label, const std::string & item);
+
+    const Script * m_script;    ///<! script being followed
+    size_t      m_step;         ///<! index of current step
+    unsigned    m_lines;        ///<! lines of reply read in current step
+    unsigned    m_items;        ///<! items collected in current step
+    bool        m_greeting;     ///<! rest of multi-line greeting is skipped
+    std::string m_input;        ///<! received data
+    size_t      m_offset;       ///<! count of consumed bytes of m_input
+    std::string m_result;       ///<! collected items, e.g. " | EHLO: SIZE, STARTTLS"
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Dialog);
+}; // class Dialog
+
+#endif // DIALOG_H_
@@ -0,0 +1,376 @@
+/**
+ * @file   dnscache.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Host name translations cached in a file shared across runs.
+ */
+
+#include "dnscache.h"
+
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+/**
+ * Identification of cache file and its format.
+ */
+static const char     kMagic[4] = { 'T', 'S', 'D', 'C' };
+static const uint32_t kVersion = 1;
+
+/**
+ * Count of slots of a new file; the file is sparse, only used pages take
+ * space on disk.
+ */
+static const uint32_t kSlots = 1 << 18;
+
+/**
+ * Count of slots where a host name may be stored.
+ */
+static const unsigned kProbes = 8;
+
+/**
+ * Limits of stored translation.
+ */
+static const size_t   kMaxName = 256;
+static const unsigned kMaxAddrs = 8;
+
+/**
+ * How long is a translation considered valid, seconds (getaddrinfo() does
+ * not expose record TTLs).
+ */
+static const int64_t kPositiveTtl = 3600;
+
+/**
+ * How long is a failed translation remembered, seconds.
+ */
+static const int64_t kNegativeTtl = 600;
+
+/**
+ * Attempts to read a slot which is being written.
+ */
+static const unsigned kReadAttempts = 4;
+
+/**
+ * @brief Beginning of the file.
+ */
+class DnsCacheFile::Header {
+  public:
+    char     magic[4];      ///<! kMagic
+    uint32_t version;       ///<! kVersion
+    uint32_t count;         ///<! count of slots, power of two
+    uint32_t slot_size;     ///<! size of slot, checks layout
+    uint8_t  reserved[48];  ///<! zero
+};
+
+/**
+ * @brief Cached translation. Sequence is odd while the slot is written.
+ */
+class DnsCacheFile::Slot {
+  public:
+    uint32_t seq;                   ///<! sequence lock
+    int32_t  error;                 ///<! getaddrinfo() return value
+    int64_t  expires;               ///<! wall clock time, seconds
+    uint64_t hash;                  ///<! hash of name
+    uint16_t namelen;               ///<! length of name, 0 if slot is free
+    uint8_t  naddrs;                ///<! count of addresses
+    uint8_t  family[kMaxAddrs];     ///<! 4 or 6
+    char     name[kMaxName];        ///<! host name, not terminated
+    uint8_t  addr[kMaxAddrs][16];   ///<! IPv4 or IPv6 address
+};
+
+/**
+ * Hash host name (FNV-1a).
+ *
+ * @param host host name
+ * @return hash
+ */
+static uint64_t hash_name(const std::string & host)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < host.size(); ++i) {
+        h ^= static_cast<unsigned char>(host[i]);
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/**
+ * Constructor.
+ */
+DnsCacheFile::DnsCacheFile()
+{
+    m_map = NULL;
+    m_size = 0;
+    m_slots = NULL;
+    m_count = 0;
+}
+
+/**
+ * Destructor.
+ */
+DnsCacheFile::~DnsCacheFile()
+{
+    if (m_map)
+        munmap(m_map, m_size);
+}
+
+/**
+ * Map cache file, create it if it does not exist.
+ *
+ * @param path file name
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool DnsCacheFile::open(const std::string & path, std::ostream & err)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // only creation needs to be exclusive
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    bool created = ok && st.st_size == 0;
+    size_t size = created ? sizeof(Header) + static_cast<size_t>(kSlots) * sizeof(Slot)
+                          : static_cast<size_t>(st.st_size);
+
+    if (created && ftruncate(fd, size) < 0)
+        ok = false;
+
+    void * map = MAP_FAILED;
+    if (ok && size >= sizeof(Header))
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    else if (ok)
+        errno = EINVAL;
+
+    if (map == MAP_FAILED) {
+        if (errno == EINVAL)
+            err << "Err: " << path << ": not a DNS cache file" << std::endl;
+        else
+            err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+
+        flock(fd, LOCK_UN);
+        ::close(fd);
+        return false;
+    }
+
+    Header * header = static_cast<Header *>(map);
+
+    if (created) {
+        memcpy(header->magic, kMagic, sizeof(kMagic));
+        header->version = kVersion;
+        header->count = kSlots;
+        header->slot_size = sizeof(Slot);
+    }
+
+    flock(fd, LOCK_UN);
+    ::close(fd);
+
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) || header->version != kVersion
+            || header->slot_size != sizeof(Slot) || ! header->count
+            || (header->count & (header->count - 1))
+            || size < sizeof(Header) + static_cast<size_t>(header->count) * sizeof(Slot)) {
+        err << "Err: " << path << ": not a DNS cache file" << std::endl;
+        munmap(map, size);
+        return false;
+    }
+
+    m_map = map;
+    m_size = size;
+    m_count = header->count;
+    m_slots = reinterpret_cast<Slot *>(static_cast<char *>(map) + sizeof(Header));
+
+    return true;
+}
+
+/**
+ * Get slot where a host name may be stored.
+ *
+ * @param hash hash of host name
+ * @param probe index of the slot, 0 to kProbes - 1
+ * @return slot
+ */
+DnsCacheFile::Slot * DnsCacheFile::slot(uint64_t hash, unsigned probe) const
+{
+    return m_slots + ((hash + probe) & (m_count - 1));
+}
+
+/**
+ * Copy slot consistently.
+ *
+ * @param slot slot in the file
+ * @param copy copy of the slot
+ * @param size size of slot
+ * @return false if the slot is being written
+ */
+static bool read_slot(void * slot, void * copy, size_t size)
+{
+    uint32_t * seq = static_cast<uint32_t *>(slot);
+
+    for (unsigned i = 0; i < kReadAttempts; ++i) {
+        uint32_t before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+
+        if (before & 1)
+            continue;
+
+        memcpy(copy, slot, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == before)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Find translation in the file.
+ *
+ * @param host host name
+ * @param error getaddrinfo() return value
+ * @param addrs translated addresses
+ * @return false if there is no valid translation
+ */
+bool DnsCacheFile::lookup(const std::string & host, int & error, addrlist_t & addrs) const
+{
+    if (! m_map || host.empty() || host.size() >= kMaxName)
+        return false;
+
+    uint64_t hash = hash_name(host);
+    int64_t now = time(NULL);
+
+    for (unsigned probe = 0; probe < kProbes; ++probe) {
+        Slot copy;
+
+        if (! read_slot(slot(hash, probe), &copy, sizeof(copy)))
+            continue;
+
+        // free slot ends the chain
+        if (! copy.namelen)
+            return false;
+
+        if (copy.hash != hash || copy.namelen != host.size()
+                || memcmp(copy.name, host.data(), host.size()))
+            continue;
+
+        if (copy.expires <= now || copy.naddrs > kMaxAddrs)
+            return false;
+
+        addrs.clear();
+        for (unsigned i = 0; i < copy.naddrs; ++i) {
+            Address addr;
+            memset(&addr.addr, 0, sizeof(addr.addr));
+
+            if (copy.family[i] == 6) {
+                struct sockaddr_in6 * in6 = reinterpret_cast<struct sockaddr_in6 *>(&addr.addr);
+                in6->sin6_family = AF_INET6;
+                memcpy(&in6->sin6_addr, copy.addr[i], sizeof(in6->sin6_addr));
+                addr.addrlen = sizeof(*in6);
+            } else {
+                struct sockaddr_in * in = reinterpret_cast<struct sockaddr_in *>(&addr.addr);
+                in->sin_family = AF_INET;
+                memcpy(&in->sin_addr, copy.addr[i], sizeof(in->sin_addr));
+                addr.addrlen = sizeof(*in);
+            }
+
+            addrs.push_back(addr);
+        }
+
+        error = copy.error;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Store translation to the file, replace the entry which expires first if
+ * there is no free slot. Nothing is stored if the slot is locked by another
+ * writer.
+ *
+ * @param host host name
+ * @param error getaddrinfo() return value
+ * @param addrs translated addresses
+ * @return void
+ */
+void DnsCacheFile::store(const std::string & host, int error, const addrlist_t & addrs)
+{
+    if (! m_map || host.empty() || host.size() >= kMaxName)
+        return;
+
+    uint64_t hash = hash_name(host);
+    int64_t now = time(NULL);
+    Slot * victim = NULL;
+    int64_t oldest = 0;
+
+    for (unsigned probe = 0; probe < kProbes; ++probe) {
+        Slot copy;
+        Slot * current = slot(hash, probe);
+
+        if (! read_slot(current, &copy, sizeof(copy)))
+            continue;
+
+        if (! copy.namelen || (copy.hash == hash && copy.namelen == host.size()
+                    && ! memcmp(copy.name, host.data(), host.size()))) {
+            victim = current;
+            break;
+        }
+
+        if (! victim || copy.expires < oldest) {
+            victim = current;
+            oldest = copy.expires;
+        }
+    }
+
+    if (! victim)
+        return;
+
+    uint32_t seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+
+    if ((seq & 1) || ! __atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, false,
+                                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    victim->error = error;
+    victim->expires = now + (error ? kNegativeTtl : kPositiveTtl);
+    victim->hash = hash;
+    victim->namelen = host.size();
+    memcpy(victim->name, host.data(), host.size());
+
+    unsigned n = 0;
+    for (addrlist_t::const_iterator it = addrs.begin();
+            it != addrs.end() && n < kMaxAddrs;
+            ++it) {
+        if (it->addr.ss_family == AF_INET6) {
+            const struct sockaddr_in6 * in6 =
+                reinterpret_cast<const struct sockaddr_in6 *>(&it->addr);
+            victim->family[n] = 6;
+            memcpy(victim->addr[n], &in6->sin6_addr, sizeof(in6->sin6_addr));
+        } else {
+            const struct sockaddr_in * in =
+                reinterpret_cast<const struct sockaddr_in *>(&it->addr);
+            victim->family[n] = 4;
+            memcpy(victim->addr[n], &in->sin_addr, sizeof(in->sin_addr));
+        }
+
+        ++n;
+    }
+
+    victim->naddrs = n;
+
+    __atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
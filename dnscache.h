@@ -0,0 +1,48 @@
+/**
+ * @file   dnscache.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Host name translations cached in a file shared across runs.
+ */
+
+#ifndef DNSCACHE_H_
+#define DNSCACHE_H_
+
+#include "tcpsearch.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+#include "resolver.h"
+
+/**
+ * @brief Hash table of translations in a memory-mapped file. Slots are
+ *        updated in place under a per-slot sequence lock, so any number of
+ *        processes can read and update the file at once; a slot being
+ *        written is skipped rather than waited for.
+ */
+class DnsCacheFile {
+  public:
+    DnsCacheFile();
+    ~DnsCacheFile();
+
+    bool open(const std::string & path, std::ostream & err);
+    bool lookup(const std::string & host, int & error, addrlist_t & addrs) const;
+    void store(const std::string & host, int error, const addrlist_t & addrs);
+
+  private:
+    class Header;
+    class Slot;
+
+    Slot * slot(uint64_t hash, unsigned probe) const;
+
+    void   * m_map;     ///<! mapped file, NULL if not opened
+    size_t   m_size;    ///<! size of mapping
+    Slot   * m_slots;   ///<! hash table
+    uint32_t m_count;   ///<! count of slots, power of two
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(DnsCacheFile);
+}; // class DnsCacheFile
+
+#endif // DNSCACHE_H_
@@ -0,0 +1,318 @@
+/**
+ * @file   engine.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Event loop multiplexing probes of all running jobs.
+ */
+
+#include "engine.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <poll.h>
+
+#include "connect.h"
+#include "job.h"
+#include "network.h"
+#include "stats.h"
+
+/**
+ * Set from signal handler when the engine should quit.
+ */
+static volatile sig_atomic_t s_stop = 0;
+
+/**
+ * Constructor.
+ */
+Engine::Engine()
+{
+    m_max_probes = 1;
+}
+
+/**
+ * Destructor.
+ */
+Engine::~Engine()
+{
+    for (probelist_t::iterator it = m_probes.begin();
+            it != m_probes.end();
+            it = m_probes.erase(it)) {
+        delete *it;
+    }
+}
+
+/**
+ * Access singleton
+ *
+ * @return singleton instance
+ */
+Engine & Engine::get_instace()
+{
+    static Engine instance;
+    return instance;
+}
+
+/**
+ * Get monotonic time in milliseconds from the network backend.
+ *
+ * @return current time
+ */
+msec_t Engine::now()
+{
+    return Network::current().now();
+}
+
+/**
+ * Ask the engine to quit its loop, safe to call from signal handler.
+ *
+ * @return void
+ */
+void Engine::stop()
+{
+    s_stop = 1;
+}
+
+/**
+ * Add job to be served.
+ *
+ * @param job job to be served, job is not owned by the engine
+ * @return void
+ */
+void Engine::add_job(Job * job)
+{
+    m_jobs.push_back(job);
+}
+
+/**
+ * Remove job before it is done, its probes are cancelled.
+ *
+ * @param job job to be removed
+ * @return void
+ */
+void Engine::remove_job(Job * job)
+{
+    m_jobs.remove(job);
+
+    for (probelist_t::iterator it = m_probes.begin(); it != m_probes.end(); ++it) {
+        if ((*it)->job() == job)
+            (*it)->detach();
+    }
+}
+
+/**
+ * Watch descriptor, engine deletes the pollable once it is done.
+ *
+ * @param pollable pollable to watch
+ * @return void
+ */
+void Engine::watch(Pollable * pollable)
+{
+    m_pollables.push_back(pollable);
+}
+
+/**
+ * Start new probes while there are free slots. Jobs are rotated so each of
+ * them gets a probe per round.
+ *
+ * @return void
+ */
+void Engine::schedule()
+{
+    bool progress = true;
+
+    while (progress && m_probes.size() < m_max_probes) {
+        progress = false;
+
+        for (size_t n = m_jobs.size(); n > 0 && m_probes.size() < m_max_probes; --n) {
+            Job * job = m_jobs.front();
+            m_jobs.pop_front();
+            m_jobs.push_back(job);
+
+            Connect * probe = job->next_probe();
+            if (probe == NULL)
+                continue;
+
+            progress = true;
+            probe->start();
+            m_probes.push_back(probe);
+            Stats::get_instace().add(Stats::PROBES_STARTED);
+        }
+    }
+
+    for (joblist_t::iterator it = m_jobs.begin(); it != m_jobs.end(); ) {
+        if ((*it)->done())
+            it = m_jobs.erase(it);
+        else
+            ++it;
+    }
+}
+
+/**
+ * Compute poll() timeout from the nearest probe deadline or job wakeup.
+ *
+ * @return timeout in milliseconds, -1 for none
+ */
+int Engine::poll_timeout() const
+{
+    msec_t now = Engine::now();
+    msec_t nearest = 0;
+
+    for (probelist_t::const_iterator it = m_probes.begin(); it != m_probes.end(); ++it) {
+        msec_t deadline = (*it)->deadline();
+
+        // probe finished right after start, reap it without waiting
+        if ((*it)->done())
+            return 0;
+
+        if (deadline && (! nearest || deadline < nearest))
+            nearest = deadline;
+    }
+
+    // no free slot, a finishing probe wakes us up
+    for (joblist_t::const_iterator it = m_jobs.begin();
+            it != m_jobs.end() && m_probes.size() < m_max_probes;
+            ++it) {
+        msec_t wakeup = (*it)->wakeup();
+
+        if (wakeup && (! nearest || wakeup < nearest))
+            nearest = wakeup;
+    }
+
+    if (! nearest)
+        return -1;
+
+    return nearest > now ? static_cast<int>(nearest - now) : 0;
+}
+
+/**
+ * Count finished probe by its outcome.
+ *
+ * @param probe finished probe
+ * @return void
+ */
+void Engine::count(const Connect * probe)
+{
+    switch (probe->state()) {
+        case Connect::STATE_OPEN:
+            Stats::get_instace().add(Stats::PROBES_OPEN);
+            break;
+
+        case Connect::STATE_CLOSED:
+            Stats::get_instace().add(Stats::PROBES_CLOSED);
+            break;
+
+        case Connect::STATE_FILTERED:
+            Stats::get_instace().add(Stats::PROBES_FILTERED);
+            break;
+
+        default:
+            Stats::get_instace().add(Stats::PROBES_UNKNOWN);
+            break;
+    }
+}
+
+/**
+ * Expire probes and release everything what is done.
+ *
+ * @param now current time
+ * @return void
+ */
+void Engine::reap(msec_t now)
+{
+    for (probelist_t::iterator it = m_probes.begin(); it != m_probes.end(); ) {
+        Connect * probe = *it;
+
+        if (! probe->done() && probe->deadline() && probe->deadline() <= now)
+            probe->timeout();
+
+        if (probe->done()) {
+            count(probe);
+
+            if (probe->job())
+                probe->job()->finish(probe);
+
+            delete probe;
+            it = m_probes.erase(it);
+        } else
+            ++it;
+    }
+
+    for (pollablelist_t::iterator it = m_pollables.begin(); it != m_pollables.end(); ) {
+        if ((*it)->done()) {
+            delete *it;
+            it = m_pollables.erase(it);
+        } else
+            ++it;
+    }
+}
+
+/**
+ * Run the event loop.
+ *
+ * @param forever do not return once all jobs are done
+ * @return false if an error occourred
+ */
+bool Engine::run(bool forever)
+{
+    std::vector<struct pollfd> fds;
+    std::vector<Connect *>     probes;
+    std::vector<Pollable *>    pollables;
+
+    for (;;) {
+        schedule();
+
+        if (s_stop)
+            return true;
+
+        if (! forever && m_jobs.empty() && m_probes.empty())
+            return true;
+
+        fds.clear();
+        probes.assign(m_probes.begin(), m_probes.end());
+        pollables.assign(m_pollables.begin(), m_pollables.end());
+
+        for (size_t i = 0; i < probes.size(); ++i) {
+            struct pollfd pfd;
+            pfd.fd = probes[i]->fd();
+            pfd.events = probes[i]->events();
+            pfd.revents = 0;
+            fds.push_back(pfd);
+        }
+
+        for (size_t i = 0; i < pollables.size(); ++i) {
+            struct pollfd pfd;
+            pfd.fd = pollables[i]->fd();
+            pfd.events = pollables[i]->events();
+            pfd.revents = 0;
+            fds.push_back(pfd);
+        }
+
+        int ret = Network::current().poll(fds.empty() ? NULL : &fds[0], fds.size(), poll_timeout());
+
+        if (ret < 0 && errno != EINTR) {
+            std::cerr << "Err: poll: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        if (ret > 0) {
+            for (size_t i = 0; i < probes.size(); ++i) {
+                if (fds[i].revents)
+                    probes[i]->handle(fds[i].revents);
+            }
+
+            for (size_t i = 0; i < pollables.size(); ++i) {
+                if (fds[probes.size() + i].revents)
+                    pollables[i]->handle(fds[probes.size() + i].revents);
+            }
+        }
+
+        msec_t now = Engine::now();
+
+        reap(now);
+        Stats::get_instace().set(Stats::PROBES_RUNNING, m_probes.size());
+        Stats::get_instace().tick(now);
+    }
+}
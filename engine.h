@@ -0,0 +1,71 @@
+/**
+ * @file   engine.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Event loop multiplexing probes of all running jobs.
+ */
+
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include "tcpsearch.h"
+
+#include <list>
+
+class Connect;
+class Job;
+
+/**
+ * @brief Descriptor watched by the engine (besides probes)
+ */
+class Pollable {
+  public:
+    virtual ~Pollable() {}
+
+    virtual int   fd() const = 0;
+    virtual short events() const = 0;
+    virtual void  handle(short revents) = 0;
+    virtual bool  done() const = 0;
+}; // class Pollable
+
+/**
+ * @brief Singleton running probes of jobs, shared by all jobs
+ */
+class Engine {
+  public:
+    static Engine & get_instace();
+    static msec_t now();
+    static void stop();
+
+    void set_max_probes(unsigned count) { m_max_probes = count; }
+    unsigned max_probes() const { return m_max_probes; }
+
+    void add_job(Job * job);
+    void remove_job(Job * job);
+    void watch(Pollable * pollable);
+
+    bool run(bool forever);
+
+  private:
+    typedef std::list<Connect *>  probelist_t;
+    typedef std::list<Job *>      joblist_t;
+    typedef std::list<Pollable *> pollablelist_t;
+
+    Engine();
+    ~Engine();
+
+    void schedule();
+    int  poll_timeout() const;
+    void reap(msec_t now);
+
+    static void count(const Connect * probe);
+
+    probelist_t    m_probes;       ///<! probes in flight
+    joblist_t      m_jobs;         ///<! jobs served round-robin
+    pollablelist_t m_pollables;    ///<! other watched descriptors
+    unsigned       m_max_probes;   ///<! maximum count of probes in flight
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Engine);
+}; // class Engine
+
+#endif // ENGINE_H_
@@ -10,12 +10,22 @@
 #include <cstring>
 #include <cerrno>
 
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "decompress.h"
+
 /**
  * Constructor.
  */
 Host::Host()
 {
     m_file = NULL;
+    m_input = NULL;
+    m_decompressor = NULL;
+    m_failed = false;
+    m_size = 0;
+    m_offset = 0;
 }
 
 /**
@@ -29,6 +39,15 @@ Host::~Host()
         delete m_file;
         m_file = NULL;
     }
+
+    if (m_decompressor) {
+        delete m_file;
+        delete m_decompressor;
+        m_file = NULL;
+    }
+
+    if (m_input && m_input != stdin)
+        fclose(m_input);
 }
 
 /**
@@ -57,9 +76,52 @@ bool Host::init(const std::string & filename)
 
     m_filename = filename;
 
+    // lets the count of hosts be estimated as they are read, stdin
+    // redirected from a file counts as well
+    struct stat st;
+    int ret = m_file != &std::cin ? stat(filename.c_str(), &st) : fstat(STDIN_FILENO, &st);
+    if (ret == 0 && S_ISREG(st.st_mode))
+        m_size = st.st_size;
+
+    Decompressor::format_t format;
+    if (! Decompressor::detect(m_file->peek(), format))
+        return true;
+
+    // compressed, read by decompressor; std::cin shares the buffer of stdin
+    if (m_file != &std::cin) {
+        delete m_file;
+        m_file = NULL;
+
+        m_input = fopen(filename.c_str(), "rb");
+        if (! m_input) {
+            std::cerr << "Err: "
+                      << filename << ": "
+                      << std::strerror(errno) << std::endl;
+            return false;
+        }
+    } else
+        m_input = stdin;
+
+    m_decompressor = new Decompressor(m_input, format);
+    if (! m_decompressor->start(std::cerr))
+        return false;
+
+    m_file = new std::istream(m_decompressor);
+
     return true;
 }
 
+/**
+ * Initialize host getter with already opened stream, the stream is not owned.
+ *
+ * @param  file stream with hosts
+ * @return void
+ */
+void Host::init(std::istream * file)
+{
+    m_file = file;
+}
+
 /**
  * Remove blank space before and after the word.
  *
@@ -95,10 +157,17 @@ bool Host::next_host()
 
     do {
         std::getline(*m_file, m_host);
+        m_offset += m_host.size() + 1;
         // skip blank lines or lines which are commented out
     } while ((m_host.empty() || m_host[0] == '#') && ! m_file->eof());
 
-    if (m_file->eof()) {
+    // last line may lack its newline
+    if (m_file->eof() && (m_host.empty() || m_host[0] == '#')) {
+        if (m_decompressor) {
+            m_decompressor->report(std::cerr, m_filename);
+            m_failed = m_decompressor->failed();
+        }
+
         return false;
     }
 
@@ -107,6 +176,17 @@ bool Host::next_host()
     return true;
 }
 
+/**
+ * Count bytes of input file read so far, compressed input is counted before
+ * decompression.
+ *
+ * @return count of bytes
+ */
+uint64_t Host::offset() const
+{
+    return m_decompressor ? m_decompressor->consumed() : m_offset;
+}
+
 /**
  * Access host string.
  *
@@ -9,29 +9,42 @@
 
 #include "tcpsearch.h"
 
+#include <cstddef>
+#include <cstdio>
 #include <string>
 #include <fstream>
 
+class Decompressor;
+
 /**
  * @brief Host getter and parser
  */
 class Host {
   public:
+    Host();
+    ~Host();
+
     bool init(const std::string & filename);
+    void init(std::istream * file);
     static Host & get_instace() { static Host instance; return instance; }
 
     bool next_host();
+    bool failed() const { return m_failed; }
+    uint64_t size() const { return m_size; }
+    uint64_t offset() const;
     const std::string & host() const;
 
     const std::string & filename() { return m_filename; }
 
   private:
-    Host();
-    ~Host();
-
     std::string   m_filename;
     std::string   m_host;
     std::istream  * m_file;
+    FILE          * m_input;        ///<! compressed input, NULL if plain
+    Decompressor  * m_decompressor; ///<! decompresses m_input, optional
+    bool            m_failed;       ///<! input ended by an error
+    uint64_t        m_size;         ///<! size of input file, 0 if unknown
+    uint64_t        m_offset;       ///<! count of bytes read from plain input
 
     void remove_blank(std::string & s);
 
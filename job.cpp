@@ -0,0 +1,1174 @@
+/**
+ * @file   job.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Scan job - targets, ports and results of one scan.
+ */
+
+#include "job.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+
+#include <arpa/inet.h>
+
+#include "connect.h"
+#include "engine.h"
+#include "host.h"
+#include "matrix.h"
+#include "ports.h"
+#include "rdns.h"
+#include "reorder.h"
+#include "stats.h"
+#include "text.h"
+#include "throttle.h"
+
+/**
+ * Count of hosts scanned together when the likeliest ports go first.
+ */
+static const size_t kFrequencyWindow = 256;
+
+/**
+ * Count of hosts scanned together when subnets are rate limited, so that
+ * a sorted input still provides hosts of several subnets.
+ */
+static const size_t kThrottleWindow = 4096;
+
+/**
+ * Delay before the first retry of a port which got no answer, milliseconds.
+ */
+static const msec_t kRetryDelay = 250;
+
+/**
+ * Retry delay stops doubling after this many attempts.
+ */
+static const unsigned kRetryMaxShift = 6;
+
+/**
+ * Count of results and hosts the reorder buffer holds before no more hosts
+ * are read.
+ */
+static const size_t kReorderLimit = 65536;
+
+/**
+ * Interval between estimates of remaining work, milliseconds.
+ */
+static const msec_t kEstimateInterval = 1000;
+
+/**
+ * Count of hosts translated ahead of the window, so their names are ready
+ * once they are scanned.
+ */
+static const size_t kLookahead = 64;
+
+/**
+ * Compare ports by their frequency rank.
+ *
+ * @param a port
+ * @param b port
+ * @return true if port a is more likely to be open
+ */
+static bool rank_less(port_t a, port_t b)
+{
+    return port_rank(a) < port_rank(b);
+}
+
+/**
+ * @brief Orders ports by value, ports found open on scanned hosts go first,
+ *        then the more frequent ones.
+ */
+class ValueLess {
+  public:
+    ValueLess(const std::vector<unsigned> & hits) : m_hits(hits) {}
+
+    bool operator()(port_t a, port_t b) const
+    {
+        if (m_hits[a] != m_hits[b])
+            return m_hits[a] > m_hits[b];
+
+        return port_rank(a) < port_rank(b);
+    }
+
+  private:
+    const std::vector<unsigned> & m_hits;
+};
+
+/**
+ * Constructor.
+ *
+ * @param hosts source of targets
+ * @param settings scan options, port list has to be non-empty
+ * @param out output stream for results
+ * @param err output stream for warnings and errors
+ */
+Job::Job(Host * hosts, const Settings & settings,
+         std::ostream & out, std::ostream & err)
+    : m_settings(settings), m_out(out), m_err(err)
+{
+    assert(hosts);
+    assert(! settings.ports.empty());
+
+    m_hosts = hosts;
+    // job without its own limit uses the whole limit of the engine
+    m_parallel = settings.parallel ? settings.parallel
+                                   : Engine::get_instace().max_probes();
+
+    // expand port ranges, every port is scanned once
+    std::vector<bool> seen(kMaxPort + 1, false);
+    for (portlist_t::const_iterator it = settings.ports.begin();
+            it != settings.ports.end();
+            ++it) {
+        for (port_t port = (*it)->port_from; port <= (*it)->port_to; ++port) {
+            if (! seen[port]) {
+                seen[port] = true;
+                m_order.push_back(port);
+            }
+        }
+    }
+
+    std::fill(seen.begin(), seen.end(), false);
+    for (portlist_t::const_iterator it = settings.pre_ports.begin();
+            it != settings.pre_ports.end();
+            ++it) {
+        for (port_t port = (*it)->port_from; port <= (*it)->port_to; ++port) {
+            if (! seen[port]) {
+                seen[port] = true;
+                m_pre.push_back(port);
+            }
+        }
+    }
+
+    m_tls.assign(kMaxPort + 1, false);
+    for (portlist_t::const_iterator it = settings.tls_ports.begin();
+            it != settings.tls_ports.end();
+            ++it) {
+        for (port_t port = (*it)->port_from; port <= (*it)->port_to; ++port)
+            m_tls[port] = true;
+    }
+
+    m_dialog.assign(kMaxPort + 1, false);
+    for (portlist_t::const_iterator it = settings.dialog_ports.begin();
+            it != settings.dialog_ports.end();
+            ++it) {
+        for (port_t port = (*it)->port_from; port <= (*it)->port_to; ++port)
+            m_dialog[port] = true;
+    }
+
+    if (settings.order == Settings::ORDER_FREQUENCY) {
+        std::stable_sort(m_order.begin(), m_order.end(), rank_less);
+        m_window_size = kFrequencyWindow;
+    } else
+        m_window_size = 1;
+
+    if (settings.subnet_rate) {
+        m_throttle = new SubnetThrottle(settings.subnet_rate,
+                                        settings.prefix4, settings.prefix6);
+        m_window_size = std::max(m_window_size, kThrottleWindow);
+    } else
+        m_throttle = NULL;
+
+    m_cursor = 0;
+    m_live = 0;
+    m_running = 0;
+    m_seq = 0;
+    m_shown = 0;
+    m_open = 0;
+    m_exhausted = false;
+    m_stopped = false;
+    m_retry_turn = false;
+    m_seed = static_cast<unsigned>(Engine::now());
+    m_matrix = NULL;
+    m_throttled = 0;
+
+    m_started = Engine::now();
+    m_estimated = m_started;
+    m_limit = m_order.size();
+    m_completed = 0;
+    m_covered = 0;
+    m_expired = false;
+    m_concluded = false;
+    // names are attached to results through the reorder buffer
+    m_reorder = settings.ordered ? new Reorder(out) : NULL;
+
+    // time budget given, most valuable ports go first
+    if (settings.deadline) {
+        m_expires = m_started + settings.deadline;
+        m_hits.assign(kMaxPort + 1, 0);
+        std::stable_sort(m_order.begin(), m_order.end(), ValueLess(m_hits));
+    } else
+        m_expires = 0;
+
+    m_published = 0;
+    m_ended = false;
+}
+
+/**
+ * Destructor.
+ */
+Job::~Job()
+{
+    for (size_t i = 0; i < m_lookups.size(); ++i)
+        Resolver::get_instace().release(m_lookups[i]);
+
+    for (std::list<Naming>::const_iterator it = m_naming.begin(); it != m_naming.end(); ++it)
+        ReverseResolver::get_instace().release(it->addr);
+
+    // probes still referencing targets were detached by the engine
+    for (std::list<Target *>::iterator it = m_targets.begin();
+            it != m_targets.end();
+            it = m_targets.erase(it)) {
+        destroy(*it);
+    }
+
+    delete m_throttle;
+    delete m_reorder;
+}
+
+/**
+ * Release target which is no longer needed.
+ *
+ * @param target target to be released
+ * @return void
+ */
+void Job::release(Target * target)
+{
+    if (! target->active && target->probes == 0) {
+        m_targets.remove(target);
+        destroy(target);
+    }
+}
+
+/**
+ * Delete target and drop its rate limit.
+ *
+ * @param target target to be deleted
+ * @return void
+ */
+void Job::destroy(Target * target)
+{
+    if (target->bucket)
+        m_throttle->release(target->bucket);
+
+    delete target;
+}
+
+/**
+ * Stop scanning target.
+ *
+ * @param target target to be finished
+ * @return void
+ */
+void Job::finish_target(Target * target)
+{
+    if (target->finished)
+        return;
+
+    target->finished = true;
+    if (target->active)
+        --m_live;
+}
+
+/**
+ * Print host header for target.
+ *
+ * @param target target to print header for
+ * @return void
+ */
+void Job::print_header(const Target * target)
+{
+    Connect::pretty_host_print(m_out, target->name,
+                               target->addr.addrlen ? &target->addr : NULL);
+    m_shown = target->seq;
+}
+
+/**
+ * Read hosts ahead of the window and start their translation, names are
+ * translated while other hosts are scanned.
+ *
+ * @return void
+ */
+void Job::read_ahead()
+{
+    while (! m_ended && m_lookups.size() < m_window_size + kLookahead) {
+        if (! m_hosts->next_host()) {
+            m_ended = true;
+            break;
+        }
+
+        m_lookups.push_back(m_hosts->host());
+        Resolver::get_instace().request(m_lookups.back());
+    }
+}
+
+/**
+ * Take next translated hosts to be scanned, in input order.
+ *
+ * @return false if there is no host to scan, either all hosts were read or
+ *         the next one is still being translated
+ */
+bool Job::next_window()
+{
+    for (size_t i = 0; i < m_window.size(); ++i) {
+        m_window[i]->active = false;
+        release(m_window[i]);
+    }
+
+    m_window.clear();
+
+    // no host is being scanned, ports can be reordered by what was found
+    if (m_expires)
+        std::stable_sort(m_order.begin(), m_order.end(), ValueLess(m_hits));
+
+    read_ahead();
+
+    addrlist_t addrs;
+    int ret;
+
+    // hosts of a window are scanned together, wait until all of them are
+    // translated; resolver wakes the loop once a translation finishes
+    for (size_t i = 0; i < m_window_size && i < m_lookups.size(); ++i) {
+        if (! Resolver::get_instace().result(m_lookups[i], ret, addrs))
+            return false;
+    }
+
+    while (m_window.size() < m_window_size && ! m_lookups.empty()) {
+        // failed hosts leave room for hosts not translated yet
+        if (! Resolver::get_instace().result(m_lookups.front(), ret, addrs))
+            break;
+
+        Resolver::get_instace().release(m_lookups.front());
+
+        Target * target = new Target();
+        target->name = m_lookups.front();
+        m_lookups.pop_front();
+        target->seq = ++m_seq;
+        target->probes = 0;
+        target->open = 0;
+        target->active = true;
+        target->finished = false;
+        target->settled = false;
+        target->index = 0;
+        target->pre_index = 0;
+        target->pending = 0;
+        target->timeouts = 0;
+        target->responded = false;
+        target->up = m_pre.empty();
+        target->srtt = 0;
+        target->rttvar = 0;
+        target->measured = false;
+        target->stopped = false;
+        target->row = m_matrix ? m_matrix->add_host(target->name) : 0;
+        target->bucket = NULL;
+
+        // use first family with ipv6 or ipv4
+        if (ret)
+            memset(&target->addr, 0, sizeof(target->addr));
+        else
+            target->addr = addrs.front();
+
+        Stats::get_instace().add(Stats::TARGETS_READ);
+        Stats::get_instace().add(ret ? Stats::TARGETS_FAILED : Stats::TARGETS_RESOLVED);
+
+        // scanning host by host, header goes first; otherwise headers are
+        // printed with results
+        if (m_reorder)
+            m_reorder->open(target->seq, target->name, target->addr);
+        else if (m_window_size == 1 || ret)
+            print_header(target);
+
+        // check if server exists...
+        if (ret) {
+            Connect::print_translate_error(m_err, ret);
+
+            if (m_reorder)
+                m_reorder->close(target->seq);
+
+            delete target;
+            continue;
+        }
+
+        // numeric host, its name is looked up while it is scanned
+        unsigned char buf[sizeof(struct in6_addr)];
+        if (m_settings.rdns
+                && (inet_pton(AF_INET, target->name.c_str(), buf) == 1
+                    || inet_pton(AF_INET6, target->name.c_str(), buf) == 1)) {
+            Naming naming;
+            naming.seq = target->seq;
+            naming.addr = target->addr;
+            naming.expires = Engine::now() + m_settings.rdns_timeout;
+            m_naming.push_back(naming);
+
+            ReverseResolver::get_instace().lookup(target->addr);
+            m_reorder->hold(target->seq);
+        }
+
+        if (m_throttle)
+            target->bucket = m_throttle->acquire(target->addr);
+
+        m_window.push_back(target);
+        m_targets.push_back(target);
+    }
+
+    read_ahead();
+    publish_total();
+
+    m_cursor = 0;
+    m_live = m_window.size();
+
+    return ! m_window.empty();
+}
+
+/**
+ * Estimate count of hosts in input. Hosts are not counted ahead, count of
+ * a file is extrapolated from the part read so far.
+ *
+ * @return count of hosts, exact once all hosts were read; 0 if unknown
+ */
+uint64_t Job::total_hosts() const
+{
+    uint64_t read = m_seq + m_lookups.size();
+
+    if (m_ended)
+        return read;
+
+    if (m_hosts->size() && m_hosts->offset())
+        return std::max(read, read * m_hosts->size() / m_hosts->offset());
+
+    return 0;
+}
+
+/**
+ * Update count of targets in stats, watchers estimate remaining time from it.
+ *
+ * @return void
+ */
+void Job::publish_total()
+{
+    if (! Stats::get_instace().published())
+        return;
+
+    uint64_t total = total_hosts();
+
+    // counter is shared by jobs of a daemon, adjust it by the change
+    Stats::get_instace().add(Stats::TARGETS_TOTAL, total - m_published);
+    m_published = total;
+}
+
+/**
+ * Create next probe of target.
+ *
+ * @param target target to be probed
+ * @return probe or NULL if the target waits for its pre-probes or its subnet
+ *         is throttled
+ */
+Connect * Job::target_probe(Target * target)
+{
+    Connect * probe;
+
+    if (target->pre_index >= m_pre.size() && ! target->up)
+        return NULL;
+
+    msec_t ready = throttle(target);
+    if (ready) {
+        if (! m_throttled || ready < m_throttled)
+            m_throttled = ready;
+
+        return NULL;
+    }
+
+    if (target->pre_index < m_pre.size()) {
+        probe = new_probe(target, m_pre[target->pre_index++], true);
+        ++target->pending;
+    } else {
+        probe = new_probe(target, m_order[target->index++], false);
+
+        if (target->index >= m_limit)
+            finish_target(target);
+    }
+
+    return probe;
+}
+
+/**
+ * Take token of target's subnet for a probe.
+ *
+ * @param target target to be probed
+ * @return 0 if the probe can be run, otherwise time when it can
+ */
+msec_t Job::throttle(Target * target)
+{
+    if (! target->bucket)
+        return 0;
+
+    return m_throttle->take(target->bucket, Engine::now());
+}
+
+/**
+ * Create probe of port on target.
+ *
+ * @param target target to be probed
+ * @param port port to be probed
+ * @param liveness probe only checks the host is up
+ * @return new probe
+ */
+Connect * Job::new_probe(Target * target, port_t port, bool liveness)
+{
+    Connect * probe = new Connect(this, target, port, m_settings.delay, liveness);
+
+    if (m_settings.max_timeout)
+        probe->set_connect_timeout(connect_timeout(target));
+
+    if (m_expires)
+        probe->set_expiry(m_expires);
+
+    if (! liveness && m_tls[port])
+        probe->set_tls(true);
+
+    if (! liveness && m_dialog[port])
+        probe->set_dialog(true);
+
+    ++target->probes;
+    ++m_running;
+
+    return probe;
+}
+
+/**
+ * Compute connect timeout of target from its round-trip time estimate
+ * (Jacobson/Karels, RTO = SRTT + 4 * RTTVAR).
+ *
+ * @param target target to be probed
+ * @return timeout in milliseconds
+ */
+msec_t Job::connect_timeout(const Target * target) const
+{
+    // nothing measured yet, give the host as much time as allowed
+    if (! target->measured)
+        return m_settings.max_timeout;
+
+    msec_t timeout = (target->srtt >> 3) + std::max<msec_t>(1, target->rttvar);
+
+    return std::min(std::max(timeout, m_settings.min_timeout), m_settings.max_timeout);
+}
+
+/**
+ * Update round-trip time estimate of target.
+ *
+ * @param target probed target
+ * @param rtt measured round-trip time
+ * @return void
+ */
+void Job::track_rtt(Target * target, msec_t rtt)
+{
+    if (! target->measured) {
+        target->srtt = rtt << 3;
+        target->rttvar = rtt << 1;
+        target->measured = true;
+        return;
+    }
+
+    // rttvar += (|srtt - rtt| - rttvar) / 4, srtt += (rtt - srtt) / 8
+    msec_t srtt = target->srtt >> 3;
+    msec_t delta = srtt > rtt ? srtt - rtt : rtt - srtt;
+
+    target->rttvar = target->rttvar - (target->rttvar >> 2) + delta;
+    target->srtt = target->srtt - (target->srtt >> 3) + rtt;
+}
+
+/**
+ * Create probe of port which was not scanned yet.
+ *
+ * Hosts in the window are served round-robin, each of them gets a port in
+ * m_order per round. Hosts of throttled subnets are skipped, so the others
+ * go on meanwhile.
+ *
+ * @return probe or NULL if there is nothing to run now
+ */
+Connect * Job::next_fresh()
+{
+    m_throttled = 0;
+
+    if (m_exhausted)
+        return NULL;
+
+    // reorder buffer is full, let hosts being scanned complete first
+    if (m_live == 0 && m_reorder && m_reorder->size() >= kReorderLimit)
+        return NULL;
+
+    while (m_live == 0) {
+        if (next_window())
+            continue;
+
+        // next host is being translated, otherwise all hosts were scanned
+        if (m_lookups.empty())
+            m_exhausted = true;
+
+        return NULL;
+    }
+
+    for (size_t n = 0; n < m_window.size(); ++n) {
+        Target * target = m_window[m_cursor];
+        m_cursor = (m_cursor + 1) % m_window.size();
+
+        if (target->finished)
+            continue;
+
+        Connect * probe = target_probe(target);
+        if (probe)
+            return probe;
+    }
+
+    // all hosts wait for their pre-probes or for their subnets
+    return NULL;
+}
+
+/**
+ * Create probe of port to be retried.
+ *
+ * @param now current time
+ * @return probe or NULL if no retry is due
+ */
+Connect * Job::next_retry(msec_t now)
+{
+    while (! m_retries.empty() && m_retries.begin()->first <= now) {
+        Retry retry = m_retries.begin()->second;
+        m_retries.erase(m_retries.begin());
+
+        // the queue held a reference of the target
+        --retry.target->probes;
+
+        if (retry.target->stopped) {
+            settle(retry.target);
+            release(retry.target);
+            continue;
+        }
+
+        // subnet is throttled, postpone the retry
+        msec_t ready = throttle(retry.target);
+        if (ready) {
+            ++retry.target->probes;
+            m_retries.insert(std::make_pair(ready, retry));
+            continue;
+        }
+
+        Connect * probe = new_probe(retry.target, retry.port, false);
+        probe->set_attempt(retry.attempt);
+
+        return probe;
+    }
+
+    return NULL;
+}
+
+/**
+ * Queue probe which got no answer to be tried again later. The delay doubles
+ * with each attempt and has up to a half of it added at random.
+ *
+ * @param probe timed out probe
+ * @return void
+ */
+void Job::schedule_retry(const Connect * probe)
+{
+    msec_t delay = kRetryDelay << std::min(probe->attempt() - 1, kRetryMaxShift);
+    msec_t jitter = rand_r(&m_seed) % (delay / 2 + 1);
+
+    Retry retry;
+    retry.target = probe->target();
+    retry.port = probe->port();
+    retry.attempt = probe->attempt() + 1;
+
+    ++retry.target->probes;
+    m_retries.insert(std::make_pair(Engine::now() + delay + jitter, retry));
+}
+
+/**
+ * Create next probe to be run. Due retries take turns with fresh ports so
+ * neither of them holds back the other.
+ *
+ * @return probe or NULL if there is nothing to run now
+ */
+Connect * Job::next_probe()
+{
+    msec_t now = Engine::now();
+    Connect * probe = NULL;
+
+    if (m_expires && ! m_stopped)
+        check_budget(now);
+
+    if (! m_naming.empty())
+        collect_names(now);
+
+    if (m_stopped || m_running >= m_parallel) {
+        if (done())
+            conclude();
+
+        return NULL;
+    }
+
+    if (m_retry_turn)
+        probe = next_retry(now);
+
+    if (probe == NULL)
+        probe = next_fresh();
+
+    if (probe == NULL && ! m_retry_turn)
+        probe = next_retry(now);
+
+    if (probe)
+        m_retry_turn = ! m_retry_turn;
+    else if (done())
+        conclude();
+
+    return probe;
+}
+
+/**
+ * Check time budget, stop the job if it ran out. Otherwise estimate from
+ * throughput so far how many ports can be scanned on each remaining host
+ * and limit the scan to the most valuable ones.
+ *
+ * @param now current time
+ * @return void
+ */
+void Job::check_budget(msec_t now)
+{
+    if (now >= m_expires) {
+        expire();
+        return;
+    }
+
+    if (now < m_estimated + kEstimateInterval)
+        return;
+
+    // remaining work cannot be estimated without count of hosts
+    uint64_t total = total_hosts();
+    if (! total)
+        return;
+
+    m_estimated = now;
+
+    // probes in flight count as well, otherwise the rate is underestimated
+    // until the first probes time out
+    uint64_t started = m_completed + m_running;
+    uint64_t budget = started * (m_expires - now) / (now - m_started);
+    uint64_t scanned = 0;
+    uint64_t hosts = total > m_seq ? total - m_seq : 0;
+
+    for (size_t i = 0; i < m_window.size(); ++i) {
+        if (! m_window[i]->finished) {
+            scanned += m_window[i]->index;
+            ++hosts;
+        }
+    }
+
+    if (! hosts)
+        return;
+
+    // spread the budget evenly, ports already scanned count as spent
+    uint64_t limit = (budget + scanned) / hosts;
+    m_limit = std::max<uint64_t>(1, std::min<uint64_t>(limit, m_order.size()));
+
+    for (size_t i = 0; i < m_window.size(); ++i) {
+        if (! m_window[i]->finished && m_window[i]->index >= m_limit) {
+            finish_target(m_window[i]);
+            settle(m_window[i]);
+        }
+    }
+}
+
+/**
+ * Stop the job, time budget ran out. Probes in flight are cut at the same
+ * time.
+ *
+ * @return void
+ */
+void Job::expire()
+{
+    m_expired = true;
+    m_stopped = true;
+}
+
+/**
+ * Write remaining results and report coverage once the job is done.
+ *
+ * @return void
+ */
+void Job::conclude()
+{
+    if (m_concluded)
+        return;
+
+    m_concluded = true;
+
+    if (m_reorder)
+        m_reorder->flush();
+
+    if (m_expires)
+        report();
+}
+
+/**
+ * Print coverage of the job with time budget.
+ *
+ * @return void
+ */
+void Job::report()
+{
+    m_err << "Coverage: " << m_covered;
+
+    uint64_t total = total_hosts();
+
+    if (total) {
+        // input was not read to its end, its size is estimated
+        const char * about = m_ended ? "" : "~";
+        uint64_t planned = total * m_order.size();
+        uint64_t permille = m_covered * 1000 / planned;
+
+        m_err << " of " << about << planned << " ports (" << permille / 10 << '.'
+              << permille % 10 << "%), " << m_seq << " of " << about << total;
+    } else
+        m_err << " ports, " << m_seq;
+
+    m_err << " hosts, " << m_open << " open";
+
+    if (m_limit < m_order.size())
+        m_err << ", top " << m_limit << " ports per host";
+
+    if (m_expired)
+        m_err << ", deadline reached";
+
+    m_err << std::endl;
+}
+
+/**
+ * Time when the job has something to run even without any probe finishing.
+ *
+ * @return time of the nearest retry, throttled target, end of time budget or
+ *         timeout of reverse lookups, 0 for none
+ */
+msec_t Job::wakeup() const
+{
+    // finished lookups wake the loop themselves, only timeouts are due
+    msec_t ret = m_naming.empty() ? 0 : m_naming.front().expires;
+
+    if (m_stopped || m_running >= m_parallel)
+        return ret;
+
+    if (m_throttled && (! ret || m_throttled < ret))
+        ret = m_throttled;
+
+    if (m_expires && (! ret || m_expires < ret))
+        ret = m_expires;
+
+    if (! m_retries.empty() && (! ret || m_retries.begin()->first < ret))
+        ret = m_retries.begin()->first;
+
+    return ret;
+}
+
+/**
+ * Store port states of targets to matrix, has to be called before the job
+ * runs. Ports of the matrix have to cover ports of the job.
+ *
+ * @param matrix state matrix, it is not owned
+ * @return void
+ */
+void Job::record(StateMatrix * matrix)
+{
+    m_matrix = matrix;
+}
+
+/**
+ * Print outcome of the probe, warnings and errors go to error stream.
+ *
+ * @param probe finished probe
+ * @return void
+ */
+void Job::print_result(const Connect * probe)
+{
+    // if verbose, always print port, leave blank line if connection was
+    // established but timed out
+    bool shown = m_settings.verbose || probe->established();
+    bool line = probe->result() == Connect::RESULT_SERVICE
+                || (probe->result() == Connect::RESULT_TIMEOUT
+                    && ! m_settings.verbose && probe->established());
+    const std::string & banner = probe->service();
+
+    if (shown && m_reorder) {
+        m_reorder->add(probe->target()->seq, probe->port(), line, banner);
+    } else if (shown) {
+        if (m_shown != probe->target()->seq)
+            print_header(probe->target());
+
+        m_out << probe->port() << std::endl;
+
+        if (line) {
+            escape_banner(m_escaped, banner.data(), banner.size());
+            m_out << m_escaped << std::endl;
+        }
+    }
+
+    write_warnings(probe);
+}
+
+/**
+ * Write warnings and errors of the probe to error stream.
+ *
+ * @param probe finished probe
+ * @return void
+ */
+void Job::write_warnings(const Connect * probe)
+{
+    switch (probe->result()) {
+        case Connect::RESULT_REFUSED:
+            if (m_settings.verbose)
+                m_err << "Warn: Cannot connect to given port: "
+                      << std::strerror(probe->error())
+                      << std::endl;
+            break;
+
+        case Connect::RESULT_TIMEOUT:
+            if (m_settings.verbose && probe->attempt() > 1 && ! probe->established())
+                m_err << "Warn: Connection timeout! (filtered after "
+                      << probe->attempt() << " attempts)" << std::endl;
+            else if (m_settings.verbose)
+                m_err << "Warn: Connection timeout!" << std::endl;
+            break;
+
+        case Connect::RESULT_ERROR:
+            m_err << "Err: " << probe->what() << ": "
+                  << std::strerror(probe->error()) << std::endl;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Store state of probed port to the state matrix.
+ *
+ * @param probe finished probe
+ * @return void
+ */
+void Job::record_result(const Connect * probe)
+{
+    if (! m_matrix)
+        return;
+
+    StateMatrix::state_t state;
+
+    switch (probe->state()) {
+        case Connect::STATE_OPEN:
+            state = StateMatrix::STATE_OPEN;
+            break;
+
+        case Connect::STATE_CLOSED:
+            state = StateMatrix::STATE_CLOSED;
+            break;
+
+        case Connect::STATE_FILTERED:
+            state = StateMatrix::STATE_FILTERED;
+            break;
+
+        default:
+            state = StateMatrix::STATE_NONE;
+            break;
+    }
+
+    m_matrix->set(probe->target()->row, probe->port(), state);
+}
+
+/**
+ * Stop scanning target and drop its retries.
+ *
+ * @param target target to be stopped
+ * @return void
+ */
+void Job::stop_target(Target * target)
+{
+    target->stopped = true;
+    finish_target(target);
+}
+
+/**
+ * Stop scanning target which does not respond.
+ *
+ * @param target target to be finished
+ * @return void
+ */
+void Job::mark_down(Target * target)
+{
+    if (target->stopped)
+        return;
+
+    if (m_settings.verbose)
+        m_err << "Warn: " << target->name
+              << " seems to be down, skipping remaining ports" << std::endl;
+
+    stop_target(target);
+}
+
+/**
+ * Update liveness of target using outcome of its probe.
+ *
+ * @param target probed target
+ * @param probe finished probe
+ * @return void
+ */
+void Job::track_liveness(Target * target, const Connect * probe)
+{
+    Connect::state_t state = probe->state();
+    bool responded = state == Connect::STATE_OPEN || state == Connect::STATE_CLOSED;
+    bool silent = state == Connect::STATE_FILTERED;
+
+    if (responded) {
+        target->responded = true;
+        target->up = true;
+        target->timeouts = 0;
+    } else if (silent) {
+        ++target->timeouts;
+
+        if (m_settings.down_after && ! target->responded
+                && target->timeouts >= m_settings.down_after)
+            mark_down(target);
+    }
+
+    // none of pre-probes got a response
+    if (probe->liveness() && ! target->up && target->pending == 0
+            && target->pre_index == m_pre.size())
+        mark_down(target);
+}
+
+/**
+ * Probe finished, report its outcome.
+ *
+ * @param probe finished probe
+ * @return void
+ */
+void Job::finish(Connect * probe)
+{
+    Target * target = probe->target();
+
+    --m_running;
+    --target->probes;
+    ++m_completed;
+
+    if (probe->liveness())
+        --target->pending;
+
+    if (m_expires && ! m_expired && Engine::now() >= m_expires)
+        expire();
+
+    // probe was cut by the end of time budget, the port has no result
+    bool cut = m_expired && probe->result() == Connect::RESULT_TIMEOUT
+               && ! probe->established();
+
+    if (! cut)
+        track_liveness(target, probe);
+
+    // no answer, try again later
+    if (! probe->liveness() && probe->state() == Connect::STATE_FILTERED
+            && probe->attempt() <= m_settings.retries
+            && ! target->stopped && ! m_stopped) {
+        schedule_retry(probe);
+        return;
+    }
+
+    if (! probe->liveness() && ! cut) {
+        print_result(probe);
+        record_result(probe);
+        ++m_covered;
+    }
+
+    if (probe->measured())
+        track_rtt(target, probe->rtt());
+
+    if (probe->established() && ! probe->liveness()) {
+        ++target->open;
+        ++m_open;
+
+        if (m_expires)
+            ++m_hits[probe->port()];
+
+        if (m_settings.max_open && target->open >= m_settings.max_open)
+            stop_target(target);
+
+        if (m_settings.stop_after && m_open >= m_settings.stop_after)
+            m_stopped = true;
+    }
+
+    settle(target);
+    release(target);
+
+    if (! m_naming.empty())
+        collect_names(Engine::now());
+
+    if (done())
+        conclude();
+}
+
+/**
+ * Count target as done and write its results to reorder buffer once its
+ * last probe or retry is over.
+ *
+ * @param target target
+ * @return void
+ */
+void Job::settle(Target * target)
+{
+    if (! target->finished || target->probes || target->settled)
+        return;
+
+    target->settled = true;
+    Stats::get_instace().add(Stats::TARGETS_DONE);
+
+    if (m_reorder)
+        m_reorder->close(target->seq);
+}
+
+/**
+ * Attach names of finished reverse lookups to their hosts, give up on those
+ * which take too long.
+ *
+ * @param now current time
+ * @return void
+ */
+void Job::collect_names(msec_t now)
+{
+    for (std::list<Naming>::iterator it = m_naming.begin(); it != m_naming.end(); ) {
+        std::string name;
+
+        if (ReverseResolver::get_instace().name(it->addr, name)) {
+            m_reorder->label(it->seq, name);
+        } else if (now >= it->expires) {
+            if (m_settings.verbose)
+                m_err << "Warn: Reverse lookup timeout!" << std::endl;
+
+            m_reorder->label(it->seq, "");
+        } else {
+            ++it;
+            continue;
+        }
+
+        ReverseResolver::get_instace().release(it->addr);
+        it = m_naming.erase(it);
+    }
+}
+
+/**
+ * Check if the job is done.
+ *
+ * @return true if all targets were scanned
+ */
+bool Job::done() const
+{
+    if (! m_naming.empty())
+        return false;
+
+    if (m_stopped)
+        return m_running == 0;
+
+    return m_exhausted && m_running == 0 && m_retries.empty();
+}
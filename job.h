@@ -0,0 +1,175 @@
+/**
+ * @file   job.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Scan job - targets, ports and results of one scan.
+ */
+
+#ifndef JOB_H_
+#define JOB_H_
+
+#include "tcpsearch.h"
+
+#include <deque>
+#include <list>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "arg.h"
+#include "resolver.h"
+
+class Bucket;
+class Connect;
+class Host;
+class Reorder;
+class StateMatrix;
+class SubnetThrottle;
+
+/**
+ * @brief Translated host which is being scanned.
+ */
+class Target {
+  public:
+    std::string   name;     ///<! host as stated in the input
+    Address       addr;     ///<! address used to connect
+    unsigned long seq;      ///<! sequence number of the target in its job
+    unsigned      probes;   ///<! count of probes and retries referencing the target
+    unsigned      open;     ///<! count of open ports found
+    bool          active;   ///<! target is in the window being scanned
+    bool          finished; ///<! no more ports will be scanned
+    bool          settled;  ///<! all probes and retries are over
+    size_t        index;    ///<! next port to scan in job's port order
+    size_t        pre_index;///<! next pre-probe port
+    unsigned      pending;  ///<! pre-probes in flight
+    unsigned      timeouts; ///<! consecutive probes without response
+    bool          responded;///<! host answered at least once (even by RST)
+    bool          up;       ///<! host is considered up, ports can be scanned
+    msec_t        srtt;     ///<! smoothed round-trip time, scaled by 8
+    msec_t        rttvar;   ///<! round-trip time variation, scaled by 4
+    bool          measured; ///<! srtt and rttvar hold a measurement
+    bool          stopped;  ///<! port cutoff reached or host down, no retries
+    size_t        row;      ///<! row of the target in the state matrix
+    Bucket      * bucket;   ///<! rate limit of target's subnet, optional
+};
+
+/**
+ * @brief Scan of targets read using Host on given ports.
+ */
+class Job {
+  public:
+    Job(Host * hosts, const Settings & settings,
+        std::ostream & out, std::ostream & err);
+    ~Job();
+
+    Connect * next_probe();
+    void finish(Connect * probe);
+    bool done() const;
+    msec_t wakeup() const;
+    void record(StateMatrix * matrix);
+
+  private:
+    /**
+     * @brief Port to be probed again.
+     */
+    class Retry {
+      public:
+        Target * target;
+        port_t   port;
+        unsigned attempt;
+    };
+
+    typedef std::multimap<msec_t, Retry> retrymap_t;
+
+    /**
+     * @brief Host waiting for its reverse lookup.
+     */
+    class Naming {
+      public:
+        unsigned long seq;      ///<! sequence number of the target
+        Address       addr;     ///<! address being looked up
+        msec_t        expires;  ///<! time to give up waiting
+    };
+
+    Connect * next_fresh();
+    Connect * next_retry(msec_t now);
+    void schedule_retry(const Connect * probe);
+    void stop_target(Target * target);
+    void read_ahead();
+    bool next_window();
+    uint64_t total_hosts() const;
+    void publish_total();
+    Connect * target_probe(Target * target);
+    msec_t throttle(Target * target);
+    void check_budget(msec_t now);
+    void expire();
+    void conclude();
+    void report();
+    void settle(Target * target);
+    void collect_names(msec_t now);
+    void finish_target(Target * target);
+    void mark_down(Target * target);
+    void track_liveness(Target * target, const Connect * probe);
+    void track_rtt(Target * target, msec_t rtt);
+    msec_t connect_timeout(const Target * target) const;
+    Connect * new_probe(Target * target, port_t port, bool liveness);
+    void release(Target * target);
+    void destroy(Target * target);
+    void print_header(const Target * target);
+    void print_result(const Connect * probe);
+    void write_warnings(const Connect * probe);
+    void record_result(const Connect * probe);
+
+    Host              * m_hosts;      ///<! source of targets
+    const Settings    & m_settings;   ///<! scan options
+    std::ostream      & m_out;        ///<! results
+    std::ostream      & m_err;        ///<! warnings and errors
+
+    std::vector<port_t> m_order;      ///<! ports in order they are scanned
+    std::vector<port_t> m_pre;        ///<! ports probed to check the host is up
+    std::vector<bool> m_tls;          ///<! ports where TLS handshake is read
+    std::vector<bool> m_dialog;       ///<! ports where dialogue follows banner
+    size_t              m_window_size;///<! count of hosts scanned together
+    std::vector<Target *> m_window;   ///<! hosts being scanned
+    std::list<Target *> m_targets;    ///<! targets referenced by the job
+    size_t              m_cursor;     ///<! next host in m_window to scan
+    size_t              m_live;       ///<! hosts in m_window not finished
+
+    unsigned            m_parallel;   ///<! maximum count of probes in flight
+    unsigned            m_running;    ///<! count of probes in flight
+    unsigned long       m_seq;        ///<! count of targets read so far
+    unsigned long       m_shown;      ///<! sequence of target printed last
+    unsigned            m_open;       ///<! count of open ports found
+    bool                m_exhausted;  ///<! no more targets to read
+    bool                m_stopped;    ///<! enough open ports were found
+    retrymap_t          m_retries;    ///<! ports to be retried by time
+    bool                m_retry_turn; ///<! retries go before fresh ports
+    unsigned            m_seed;       ///<! state of retry jitter generator
+    std::string         m_escaped;    ///<! buffer for sanitized banner
+    StateMatrix       * m_matrix;     ///<! port states of targets, optional
+    SubnetThrottle    * m_throttle;   ///<! per-subnet rate limit, optional
+    msec_t              m_throttled;  ///<! when a throttled target can go on,
+                                      ///<! 0 if none is throttled
+    msec_t              m_started;    ///<! time the job was created
+    msec_t              m_expires;    ///<! end of time budget, 0 for none
+    msec_t              m_estimated;  ///<! time of the last work estimate
+    uint64_t            m_published;  ///<! count of hosts added to stats
+    size_t              m_limit;      ///<! ports of m_order scanned per host
+    uint64_t            m_completed;  ///<! count of finished probes
+    uint64_t            m_covered;    ///<! count of ports with a result
+    bool                m_expired;    ///<! time budget ran out
+    bool                m_concluded;  ///<! results were flushed and coverage
+                                      ///<! reported
+    Reorder           * m_reorder;    ///<! restores host by host output,
+                                      ///<! optional
+    std::vector<unsigned> m_hits;     ///<! open ports found, indexed by port
+    std::list<Naming>   m_naming;     ///<! hosts waiting for their names
+    std::deque<std::string> m_lookups;///<! hosts read ahead of the window,
+                                      ///<! being translated
+    bool                m_ended;      ///<! all hosts were read
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Job);
+}; // class Job
+
+#endif // JOB_H_
@@ -0,0 +1,422 @@
+/**
+ * @file   matrix.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Bit-packed matrix of port states of scanned hosts.
+ */
+
+#include "matrix.h"
+
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cassert>
+
+#include "ports.h"
+
+/**
+ * Count of rows in one block, one bit of a word per row.
+ */
+static const size_t kBlockRows = 64;
+
+/**
+ * Column of port which is not in the matrix.
+ */
+static const uint32_t kNoColumn = 0xffffffffu;
+
+/**
+ * File header, followed by ports, host names and bit-planes.
+ */
+static const char     kMagic[4] = { 'T', 'S', 'P', 'M' };
+static const uint32_t kVersion = 1;
+
+/**
+ * Limits checked when a dump is loaded.
+ */
+static const uint64_t kMaxRows = 1ULL << 32;
+static const uint32_t kMaxName = 4096;
+
+/**
+ * Names of states as used in queries.
+ */
+static const char * const kStateNames[] = { "none", "open", "closed", "filtered" };
+
+/**
+ * Constructor.
+ */
+StateMatrix::StateMatrix()
+{
+}
+
+/**
+ * Destructor.
+ */
+StateMatrix::~StateMatrix()
+{
+}
+
+/**
+ * Set ports of the matrix, has to be called before any host is added.
+ *
+ * @param ports port ranges to be scanned
+ * @return void
+ */
+void StateMatrix::set_ports(const portlist_t & ports)
+{
+    assert(m_names.empty());
+
+    m_columns.assign(kMaxPort + 1, kNoColumn);
+
+    for (portlist_t::const_iterator it = ports.begin(); it != ports.end(); ++it) {
+        for (port_t port = (*it)->port_from; port <= (*it)->port_to; ++port)
+            m_columns[port] = 0;
+    }
+
+    m_ports.clear();
+    for (port_t port = 0; port <= kMaxPort; ++port) {
+        if (m_columns[port] != kNoColumn) {
+            m_columns[port] = m_ports.size();
+            m_ports.push_back(port);
+        }
+    }
+}
+
+/**
+ * Add row of host, all its ports are in STATE_NONE.
+ *
+ * @param name host as stated in the input
+ * @return row of the host
+ */
+size_t StateMatrix::add_host(const std::string & name)
+{
+    size_t row = m_names.size();
+
+    if (row % kBlockRows == 0)
+        m_bits.resize(m_bits.size() + m_ports.size() * 2, 0);
+
+    m_names.push_back(name);
+
+    return row;
+}
+
+/**
+ * Get column of port.
+ *
+ * @param port port
+ * @return column or kNoColumn if the port is not in the matrix
+ */
+size_t StateMatrix::column(port_t port) const
+{
+    if (port > kMaxPort || m_columns.empty())
+        return kNoColumn;
+
+    return m_columns[port];
+}
+
+/**
+ * Store state of port of host.
+ *
+ * @param row row of the host
+ * @param port port, it has to be in the matrix
+ * @param state state of the port
+ * @return void
+ */
+void StateMatrix::set(size_t row, port_t port, state_t state)
+{
+    assert(row < rows());
+    assert(column(port) != kNoColumn);
+
+    size_t word = (row / kBlockRows * m_ports.size() + column(port)) * 2;
+    uint64_t bit = 1ULL << (row % kBlockRows);
+
+    m_bits[word] = (state & 1) ? m_bits[word] | bit : m_bits[word] & ~bit;
+    m_bits[word + 1] = (state & 2) ? m_bits[word + 1] | bit : m_bits[word + 1] & ~bit;
+}
+
+/**
+ * Get state of port of host.
+ *
+ * @param row row of the host
+ * @param port port
+ * @return state of the port, STATE_NONE if the port is not in the matrix
+ */
+StateMatrix::state_t StateMatrix::get(size_t row, port_t port) const
+{
+    assert(row < rows());
+
+    if (column(port) == kNoColumn)
+        return STATE_NONE;
+
+    size_t word = (row / kBlockRows * m_ports.size() + column(port)) * 2;
+    size_t shift = row % kBlockRows;
+
+    return static_cast<state_t>(((m_bits[word] >> shift) & 1)
+                                | (((m_bits[word + 1] >> shift) & 1) << 1));
+}
+
+/**
+ * Get mask of rows of block which are in use.
+ *
+ * @param block block of rows
+ * @return mask of rows
+ */
+uint64_t StateMatrix::valid(size_t block) const
+{
+    size_t used = rows() - block * kBlockRows;
+
+    return used >= kBlockRows ? ~0ULL : (1ULL << used) - 1;
+}
+
+/**
+ * Get mask of rows of block with port in given state.
+ *
+ * @param block block of rows
+ * @param column column of the port
+ * @param state required state
+ * @return mask of rows
+ */
+uint64_t StateMatrix::match(size_t block, size_t column, state_t state) const
+{
+    size_t word = (block * m_ports.size() + column) * 2;
+    uint64_t lo = m_bits[word];
+    uint64_t hi = m_bits[word + 1];
+
+    return ((state & 1) ? lo : ~lo) & ((state & 2) ? hi : ~hi) & valid(block);
+}
+
+/**
+ * Count hosts with port in given state.
+ *
+ * @param port port
+ * @param state required state
+ * @return count of hosts
+ */
+size_t StateMatrix::count(port_t port, state_t state) const
+{
+    size_t col = column(port);
+    size_t blocks = (rows() + kBlockRows - 1) / kBlockRows;
+    size_t ret = 0;
+
+    if (col == kNoColumn)
+        return state == STATE_NONE ? rows() : 0;
+
+    for (size_t block = 0; block < blocks; ++block)
+        ret += __builtin_popcountll(match(block, col, state));
+
+    return ret;
+}
+
+/**
+ * Find hosts matching all conditions.
+ *
+ * @param conditions conditions to be met
+ * @param rows rows of matching hosts in ascending order
+ * @return count of matching hosts
+ */
+size_t StateMatrix::query(const condlist_t & conditions, std::vector<size_t> & rows) const
+{
+    size_t blocks = (this->rows() + kBlockRows - 1) / kBlockRows;
+    std::vector<uint64_t> masks(blocks);
+    size_t ret = 0;
+
+    for (size_t block = 0; block < blocks; ++block) {
+        uint64_t mask = valid(block);
+
+        for (size_t i = 0; mask && i < conditions.size(); ++i) {
+            size_t col = column(conditions[i].port);
+
+            // ports which were not scanned are in STATE_NONE everywhere
+            if (col == kNoColumn)
+                mask = conditions[i].state == STATE_NONE ? mask : 0;
+            else
+                mask &= match(block, col, conditions[i].state);
+        }
+
+        masks[block] = mask;
+        ret += __builtin_popcountll(mask);
+    }
+
+    rows.clear();
+    rows.reserve(ret);
+
+    for (size_t block = 0; block < blocks; ++block) {
+        for (uint64_t mask = masks[block]; mask; mask &= mask - 1)
+            rows.push_back(block * kBlockRows + __builtin_ctzll(mask));
+    }
+
+    return ret;
+}
+
+/**
+ * Write the matrix to file, numbers are in host byte order.
+ *
+ * @param path file name
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool StateMatrix::save(const std::string & path, std::ostream & err) const
+{
+    std::ofstream file(path.c_str(), std::ofstream::out | std::ofstream::binary
+                                     | std::ofstream::trunc);
+
+    if (! file.is_open()) {
+        err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    uint32_t nports = m_ports.size();
+    uint64_t nrows = rows();
+
+    file.write(kMagic, sizeof(kMagic));
+    file.write(reinterpret_cast<const char *>(&kVersion), sizeof(kVersion));
+    file.write(reinterpret_cast<const char *>(&nports), sizeof(nports));
+    file.write(reinterpret_cast<const char *>(&nrows), sizeof(nrows));
+
+    for (size_t i = 0; i < m_ports.size(); ++i) {
+        uint16_t port = m_ports[i];
+        file.write(reinterpret_cast<const char *>(&port), sizeof(port));
+    }
+
+    for (size_t i = 0; i < m_names.size(); ++i) {
+        uint32_t len = m_names[i].size();
+        file.write(reinterpret_cast<const char *>(&len), sizeof(len));
+        file.write(m_names[i].data(), len);
+    }
+
+    if (! m_bits.empty())
+        file.write(reinterpret_cast<const char *>(&m_bits[0]),
+                   m_bits.size() * sizeof(uint64_t));
+
+    file.close();
+
+    if (file.fail()) {
+        err << "Err: " << path << ": cannot write port states" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Read matrix written by save().
+ *
+ * @param path file name
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool StateMatrix::load(const std::string & path, std::ostream & err)
+{
+    std::ifstream file(path.c_str(), std::ifstream::in | std::ifstream::binary);
+
+    if (! file.is_open()) {
+        err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(kMagic)];
+    uint32_t version = 0;
+    uint32_t nports = 0;
+    uint64_t nrows = 0;
+
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&nports), sizeof(nports));
+    file.read(reinterpret_cast<char *>(&nrows), sizeof(nrows));
+
+    if (! file || memcmp(magic, kMagic, sizeof(kMagic)) || version != kVersion
+            || nports > kMaxPort || nrows >= kMaxRows) {
+        err << "Err: " << path << ": not a port state file" << std::endl;
+        return false;
+    }
+
+    portlist_t ports;
+    for (uint32_t i = 0; file && i < nports; ++i) {
+        uint16_t port = 0;
+        file.read(reinterpret_cast<char *>(&port), sizeof(port));
+
+        Port * range = new Port();
+        range->port_from = range->port_to = port;
+        ports.push_back(range);
+    }
+
+    m_names.clear();
+    m_bits.clear();
+    set_ports(ports);
+    free_ports(ports);
+
+    std::string name;
+    for (uint64_t i = 0; file && i < nrows; ++i) {
+        uint32_t len = 0;
+        file.read(reinterpret_cast<char *>(&len), sizeof(len));
+
+        if (len > kMaxName)
+            break;
+
+        name.resize(len);
+        if (len)
+            file.read(&name[0], len);
+
+        add_host(name);
+    }
+
+    if (file && ! m_bits.empty())
+        file.read(reinterpret_cast<char *>(&m_bits[0]),
+                  m_bits.size() * sizeof(uint64_t));
+
+    if (! file || m_ports.size() != nports || rows() != nrows) {
+        err << "Err: " << path << ": truncated or corrupted port state file"
+            << std::endl;
+        m_names.clear();
+        m_bits.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Parse query, e.g. "22=open,23=closed".
+ *
+ * @param query query from command line
+ * @param conditions parsed conditions
+ * @return false on error
+ */
+bool StateMatrix::parse_query(const char * query, condlist_t & conditions)
+{
+    assert(query);
+
+    const char * ptr = query;
+    char * endptr;
+
+    conditions.clear();
+
+    do {
+        long port = strtol(ptr, &endptr, 10);
+
+        if (endptr == ptr || *endptr != '=' || port <= 0
+                || port > static_cast<long>(kMaxPort))
+            return false;
+
+        ptr = endptr + 1;
+
+        size_t len = strcspn(ptr, ",");
+        size_t state = 0;
+
+        while (state < sizeof(kStateNames) / sizeof(kStateNames[0])
+                && (strlen(kStateNames[state]) != len
+                    || strncmp(kStateNames[state], ptr, len)))
+            ++state;
+
+        if (state == sizeof(kStateNames) / sizeof(kStateNames[0]))
+            return false;
+
+        Condition condition;
+        condition.port = port;
+        condition.state = static_cast<state_t>(state);
+        conditions.push_back(condition);
+
+        ptr += len;
+    } while (*ptr++ == ',');
+
+    return true;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file   matrix.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Bit-packed matrix of port states of scanned hosts.
+ */
+
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include "tcpsearch.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "arg.h"
+
+/**
+ * @brief Port states of all scanned hosts, 2 bits per host and port.
+ *
+ * Rows are stored in blocks of 64 hosts. Each block holds two bit-planes per
+ * port (low and high bit of the state), so a whole block can be matched
+ * against a state by a few word operations.
+ */
+class StateMatrix {
+  public:
+    /**
+     * @brief State of port, fits 2 bits.
+     */
+    enum state_t {
+        STATE_NONE,         ///<! not scanned or probe failed locally
+        STATE_OPEN,         ///<! connection was established
+        STATE_CLOSED,       ///<! host refused the connection
+        STATE_FILTERED      ///<! no answer from the host
+    };
+
+    /**
+     * @brief Port has to be in given state.
+     */
+    class Condition {
+      public:
+        port_t  port;
+        state_t state;
+    };
+
+    typedef std::vector<Condition> condlist_t;
+
+    StateMatrix();
+    ~StateMatrix();
+
+    void    set_ports(const portlist_t & ports);
+    size_t  add_host(const std::string & name);
+    void    set(size_t row, port_t port, state_t state);
+    state_t get(size_t row, port_t port) const;
+
+    size_t  rows() const { return m_names.size(); }
+    const std::string & name(size_t row) const { return m_names[row]; }
+
+    size_t  count(port_t port, state_t state) const;
+    size_t  query(const condlist_t & conditions, std::vector<size_t> & rows) const;
+
+    bool    save(const std::string & path, std::ostream & err) const;
+    bool    load(const std::string & path, std::ostream & err);
+
+    static bool parse_query(const char * query, condlist_t & conditions);
+
+  private:
+    size_t   column(port_t port) const;
+    uint64_t match(size_t block, size_t column, state_t state) const;
+    uint64_t valid(size_t block) const;
+
+    std::vector<port_t>      m_ports;   ///<! scanned ports in ascending order
+    std::vector<uint32_t>    m_columns; ///<! column of port, indexed by port
+    std::vector<std::string> m_names;   ///<! host names by row
+    std::vector<uint64_t>    m_bits;    ///<! bit-planes of blocks of rows
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(StateMatrix);
+}; // class StateMatrix
+
+#endif // MATRIX_H_
@@ -0,0 +1,218 @@
+/**
+ * @file   network.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Network backend used by probes, resolver and the event loop.
+ */
+
+#include "network.h"
+
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+/**
+ * Backend in use, NULL for the system one.
+ */
+static Network * s_current = NULL;
+
+/**
+ * Access backend in use.
+ *
+ * @return backend
+ */
+Network & Network::current()
+{
+    if (s_current)
+        return *s_current;
+
+    return SystemNetwork::get_instace();
+}
+
+/**
+ * Switch backend, has to be done before any probe is started.
+ *
+ * @param network backend to be used, NULL for the system one; not owned
+ * @return void
+ */
+void Network::use(Network * network)
+{
+    s_current = network;
+}
+
+/**
+ * Access singleton
+ *
+ * @return singleton instance
+ */
+SystemNetwork & SystemNetwork::get_instace()
+{
+    static SystemNetwork instance;
+    return instance;
+}
+
+/**
+ * Get monotonic time in milliseconds.
+ *
+ * @return current time
+ */
+msec_t SystemNetwork::now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<msec_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Translate host using getaddrinfo().
+ *
+ * @param host host to be translated
+ * @param addrs IPv4/IPv6 addresses in order given by getaddrinfo()
+ * @return getaddrinfo() return value, 0 on success
+ */
+int SystemNetwork::resolve(const std::string & host, addrlist_t & addrs)
+{
+    struct addrinfo hints;
+    struct addrinfo * res = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int ret = getaddrinfo(host.c_str(), NULL, &hints, &res);
+
+    addrs.clear();
+    if (! ret) {
+        for (struct addrinfo * result = res; result != NULL; result = result->ai_next) {
+            if (result->ai_family != AF_INET && result->ai_family != AF_INET6)
+                continue;
+
+            Address addr;
+            memset(&addr.addr, 0, sizeof(addr.addr));
+            memcpy(&addr.addr, result->ai_addr, result->ai_addrlen);
+            addr.addrlen = result->ai_addrlen;
+            addrs.push_back(addr);
+        }
+
+        freeaddrinfo(res);
+
+        if (addrs.empty())
+            ret = EAI_NONAME;
+    }
+
+    return ret;
+}
+
+/**
+ * Check if translation waits for the network, it is then done off the event
+ * loop.
+ *
+ * @return true, getaddrinfo() may ask name servers
+ */
+bool SystemNetwork::resolve_blocks()
+{
+    return true;
+}
+
+/**
+ * Open non-blocking TCP socket.
+ *
+ * @param family address family
+ * @return socket or -1 on error
+ */
+int SystemNetwork::open(int family)
+{
+    int fd = socket(family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+        return -1;
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Start connect.
+ *
+ * @param fd socket
+ * @param addr address to connect to
+ * @param len length of address
+ * @return 0 if connected, -1 with EINPROGRESS if connect is pending
+ */
+int SystemNetwork::connect(int fd, const struct sockaddr * addr, socklen_t len)
+{
+    return ::connect(fd, addr, len);
+}
+
+/**
+ * Get result of connect.
+ *
+ * @param fd socket
+ * @param err error of connect, 0 if connected
+ * @return -1 on error
+ */
+int SystemNetwork::pending_error(int fd, int & err)
+{
+    socklen_t len = sizeof(err);
+
+    return getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+}
+
+/**
+ * Read from socket.
+ *
+ * @param fd socket
+ * @param buf buffer
+ * @param len size of buffer
+ * @return count of bytes read, 0 on end of stream, -1 on error
+ */
+ssize_t SystemNetwork::read(int fd, void * buf, size_t len)
+{
+    return ::read(fd, buf, len);
+}
+
+/**
+ * Write to socket, a closed peer does not raise SIGPIPE.
+ *
+ * @param fd socket
+ * @param buf data
+ * @param len count of bytes
+ * @return count of bytes written, -1 on error
+ */
+ssize_t SystemNetwork::write(int fd, const void * buf, size_t len)
+{
+    return send(fd, buf, len, MSG_NOSIGNAL);
+}
+
+/**
+ * Close socket.
+ *
+ * @param fd socket
+ * @return void
+ */
+void SystemNetwork::close(int fd)
+{
+    ::close(fd);
+}
+
+/**
+ * Wait for events.
+ *
+ * @param fds descriptors
+ * @param nfds count of descriptors
+ * @param timeout timeout in milliseconds, -1 for none
+ * @return count of descriptors with events, -1 on error
+ */
+int SystemNetwork::poll(struct pollfd * fds, nfds_t nfds, int timeout)
+{
+    return ::poll(fds, nfds, timeout);
+}
@@ -0,0 +1,69 @@
+/**
+ * @file   network.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Network backend used by probes, resolver and the event loop.
+ */
+
+#ifndef NETWORK_H_
+#define NETWORK_H_
+
+#include "tcpsearch.h"
+
+#include <string>
+
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "resolver.h"
+
+/**
+ * @brief Clock, name resolution and non-blocking TCP sockets. Calls fail
+ *        like system calls, returning -1 and setting errno.
+ */
+class Network {
+  public:
+    virtual ~Network() {}
+
+    static Network & current();
+    static void use(Network * network);
+
+    virtual msec_t  now() = 0;
+    virtual int     resolve(const std::string & host, addrlist_t & addrs) = 0;
+    virtual bool    resolve_blocks() = 0;
+    virtual int     open(int family) = 0;
+    virtual int     connect(int fd, const struct sockaddr * addr, socklen_t len) = 0;
+    virtual int     pending_error(int fd, int & err) = 0;
+    virtual ssize_t read(int fd, void * buf, size_t len) = 0;
+    virtual ssize_t write(int fd, const void * buf, size_t len) = 0;
+    virtual void    close(int fd) = 0;
+    virtual int     poll(struct pollfd * fds, nfds_t nfds, int timeout) = 0;
+}; // class Network
+
+/**
+ * @brief Singleton backend using the operating system.
+ */
+class SystemNetwork : public Network {
+  public:
+    static SystemNetwork & get_instace();
+
+    virtual msec_t  now();
+    virtual int     resolve(const std::string & host, addrlist_t & addrs);
+    virtual bool    resolve_blocks();
+    virtual int     open(int family);
+    virtual int     connect(int fd, const struct sockaddr * addr, socklen_t len);
+    virtual int     pending_error(int fd, int & err);
+    virtual ssize_t read(int fd, void * buf, size_t len);
+    virtual ssize_t write(int fd, const void * buf, size_t len);
+    virtual void    close(int fd);
+    virtual int     poll(struct pollfd * fds, nfds_t nfds, int timeout);
+
+  private:
+    SystemNetwork() {}
+    ~SystemNetwork() {}
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(SystemNetwork);
+}; // class SystemNetwork
+
+#endif // NETWORK_H_
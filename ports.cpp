@@ -0,0 +1,68 @@
+/**
+ * @file   ports.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Built-in table of most frequently open TCP ports.
+ */
+
+#include "ports.h"
+
+#include <vector>
+
+/**
+ * TCP ports ordered by how often they are found open on the internet (as
+ * measured by nmap-services), the most frequent first.
+ */
+static const port_t kTopPorts[] = {
+       80,    23,   443,    21,    22,    25,  3389,   110,   445,   139,
+      143,    53,   135,  3306,  8080,  1723,   111,   995,   993,  5900,
+     1025,   587,  8888,   199,  1720,   465,   548,   113,    81,  6001,
+    10000,   514,  5060,   179,  1026,  2000,  8443,  8000, 32768,   554,
+       26,  1433, 49152,  2001,   515,  8008, 49154,  1027,  5666,   646,
+     5000,  5631,   631, 49153,  8081,  2049,    88,    79,  5800,   106,
+     2121,  1110, 49155,  6000,   513,   990,  5357,   427, 49156,   543,
+      544,  5101,   144,     7,   389,  8009,  3128,   444,  9999,  5009,
+     7070,  5190,  3000,  5432,  1900,  3986,    13,  1029,     9,  5051,
+     6646, 49157,  1028,   873,  1755,  2717,  4899,  9100,   119,    37
+};
+
+/**
+ * Get count of ports in the frequency table.
+ *
+ * @return count of ports
+ */
+size_t top_ports_count()
+{
+    return sizeof(kTopPorts) / sizeof(kTopPorts[0]);
+}
+
+/**
+ * Get port of given frequency rank.
+ *
+ * @param rank rank of the port, lower than top_ports_count()
+ * @return port number
+ */
+port_t top_port(size_t rank)
+{
+    return kTopPorts[rank];
+}
+
+/**
+ * Get frequency rank of port.
+ *
+ * @param port port number
+ * @return rank, top_ports_count() for ports not in the table
+ */
+size_t port_rank(port_t port)
+{
+    static std::vector<unsigned char> ranks;
+
+    // the table is short, ranks fit to a byte
+    if (ranks.empty()) {
+        ranks.assign(kMaxPort + 1, static_cast<unsigned char>(top_ports_count()));
+
+        for (size_t i = 0; i < top_ports_count(); ++i)
+            ranks[kTopPorts[i]] = static_cast<unsigned char>(i);
+    }
+
+    return port <= kMaxPort ? ranks[port] : top_ports_count();
+}
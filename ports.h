@@ -0,0 +1,23 @@
+/**
+ * @file   ports.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Built-in table of most frequently open TCP ports.
+ */
+
+#ifndef PORTS_H_
+#define PORTS_H_
+
+#include "tcpsearch.h"
+
+#include <cstddef>
+
+/**
+ * Highest valid port number.
+ */
+const port_t kMaxPort = 65535;
+
+size_t top_ports_count();
+port_t top_port(size_t rank);
+size_t port_rank(port_t port);
+
+#endif // PORTS_H_
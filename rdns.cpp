@@ -0,0 +1,314 @@
+/**
+ * @file   rdns.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Background reverse (PTR) lookups of target addresses.
+ */
+
+#include "rdns.h"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+/**
+ * Count of lookups running at once.
+ */
+static const unsigned kWorkers = 8;
+
+/**
+ * Maximum count of cached lookups.
+ */
+static const size_t kMaxEntries = 65536;
+
+/**
+ * Constructor.
+ */
+ReverseResolver::ReverseResolver()
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_wakeup, NULL);
+    m_pipe[0] = m_pipe[1] = -1;
+    m_pending = 0;
+    m_workers = 0;
+    m_started = false;
+    m_finished = 0;
+}
+
+/**
+ * Destructor, never called as workers may still be blocked in getnameinfo().
+ */
+ReverseResolver::~ReverseResolver()
+{
+}
+
+/**
+ * Access singleton, it is never destroyed so workers outliving main() do not
+ * touch released memory.
+ *
+ * @return singleton instance
+ */
+ReverseResolver & ReverseResolver::get_instace()
+{
+    static ReverseResolver * instance = new ReverseResolver();
+    return *instance;
+}
+
+/**
+ * Make cache key of address.
+ *
+ * @param addr address
+ * @return raw bytes of the IP address
+ */
+std::string ReverseResolver::key(const Address & addr)
+{
+    if (addr.addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6 * in6 =
+            reinterpret_cast<const struct sockaddr_in6 *>(&addr.addr);
+        return std::string(reinterpret_cast<const char *>(&in6->sin6_addr),
+                           sizeof(in6->sin6_addr));
+    }
+
+    const struct sockaddr_in * in =
+        reinterpret_cast<const struct sockaddr_in *>(&addr.addr);
+    return std::string(reinterpret_cast<const char *>(&in->sin_addr),
+                       sizeof(in->sin_addr));
+}
+
+/**
+ * Set descriptor to non-blocking mode.
+ *
+ * @param fd descriptor
+ * @return false on error
+ */
+static bool set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+/**
+ * Start workers and watch their pipe, called with the lock held.
+ *
+ * @return void
+ */
+void ReverseResolver::start()
+{
+    m_started = true;
+
+    if (pipe(m_pipe) < 0)
+        return;
+
+    if (! set_nonblock(m_pipe[0]) || ! set_nonblock(m_pipe[1])) {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+        return;
+    }
+
+    for (unsigned i = 0; i < kWorkers; ++i) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, worker, this))
+            break;
+
+        pthread_detach(thread);
+        ++m_workers;
+    }
+
+    if (m_workers)
+        Engine::get_instace().watch(this);
+}
+
+/**
+ * Entry point of worker thread.
+ *
+ * @param arg resolver
+ * @return NULL
+ */
+void * ReverseResolver::worker(void * arg)
+{
+    static_cast<ReverseResolver *>(arg)->serve();
+    return NULL;
+}
+
+/**
+ * Run queued lookups forever.
+ *
+ * @return void
+ */
+void ReverseResolver::serve()
+{
+    pthread_mutex_lock(&m_lock);
+
+    for (;;) {
+        while (m_queue.empty())
+            pthread_cond_wait(&m_wakeup, &m_lock);
+
+        Request request = m_queue.front();
+        m_queue.pop_front();
+
+        pthread_mutex_unlock(&m_lock);
+
+        char host[NI_MAXHOST];
+        int ret = getnameinfo(reinterpret_cast<const struct sockaddr *>(&request.addr.addr),
+                              request.addr.addrlen, host, sizeof(host),
+                              NULL, 0, NI_NAMEREQD);
+
+        pthread_mutex_lock(&m_lock);
+
+        // running lookups are not evicted
+        Entry & entry = m_cache[request.key];
+        entry.done = true;
+        entry.name = ret ? "" : host;
+
+        // one byte wakes the loop, which takes all finished lookups at once
+        if (! m_finished++) {
+            ssize_t written = write(m_pipe[1], "", 1);
+            UNUSED(written);
+        }
+    }
+}
+
+/**
+ * Watch the pipe only while lookups are running.
+ *
+ * @return events to poll
+ */
+short ReverseResolver::events() const
+{
+    return m_pending ? POLLIN : 0;
+}
+
+/**
+ * Take wakeup of workers, results are collected by jobs.
+ *
+ * @param revents returned events
+ * @return void
+ */
+void ReverseResolver::handle(short revents)
+{
+    UNUSED(revents);
+
+    char buf[64];
+
+    while (read(m_pipe[0], buf, sizeof(buf)) > 0)
+        continue;
+
+    pthread_mutex_lock(&m_lock);
+    m_pending -= m_finished;
+    m_finished = 0;
+    pthread_mutex_unlock(&m_lock);
+}
+
+/**
+ * Drop oldest collected lookups until there is room for a new one, called
+ * with the lock held. Running and not collected lookups are kept.
+ *
+ * @return void
+ */
+void ReverseResolver::evict()
+{
+    for (size_t i = m_age.size(); i && m_cache.size() >= kMaxEntries; --i) {
+        cache_t::iterator it = m_cache.find(m_age.front());
+
+        // kept entry is checked again after the others
+        if (! it->second.done || it->second.wanted)
+            m_age.push_back(m_age.front());
+        else
+            m_cache.erase(it);
+
+        m_age.pop_front();
+    }
+}
+
+/**
+ * Start lookup of address unless it is cached or running already.
+ *
+ * @param addr address to be looked up
+ * @return void
+ */
+void ReverseResolver::lookup(const Address & addr)
+{
+    std::string k = key(addr);
+
+    pthread_mutex_lock(&m_lock);
+
+    cache_t::iterator it = m_cache.find(k);
+
+    if (it != m_cache.end()) {
+        ++it->second.wanted;
+    } else {
+        if (! m_started)
+            start();
+
+        if (m_cache.size() >= kMaxEntries)
+            evict();
+
+        Entry & entry = m_cache[k];
+        entry.wanted = 1;
+        m_age.push_back(k);
+
+        if (m_workers) {
+            Request request;
+            request.key = k;
+            request.addr = addr;
+            m_queue.push_back(request);
+
+            entry.done = false;
+            ++m_pending;
+            pthread_cond_signal(&m_wakeup);
+        } else {
+            // no thread could be started, names are not looked up
+            entry.done = true;
+        }
+    }
+
+    pthread_mutex_unlock(&m_lock);
+}
+
+/**
+ * Get result of lookup started by lookup().
+ *
+ * @param addr address which was looked up
+ * @param name host name, empty if the address has none
+ * @return false if the lookup did not finish yet
+ */
+bool ReverseResolver::name(const Address & addr, std::string & name)
+{
+    bool done = false;
+
+    pthread_mutex_lock(&m_lock);
+
+    cache_t::const_iterator it = m_cache.find(key(addr));
+    if (it != m_cache.end() && it->second.done) {
+        name = it->second.name;
+        done = true;
+    }
+
+    pthread_mutex_unlock(&m_lock);
+
+    return done;
+}
+
+/**
+ * Tell that result of lookup was collected or is no longer needed, the entry
+ * may be evicted then.
+ *
+ * @param addr address which was looked up
+ * @return void
+ */
+void ReverseResolver::release(const Address & addr)
+{
+    pthread_mutex_lock(&m_lock);
+
+    cache_t::iterator it = m_cache.find(key(addr));
+    if (it != m_cache.end() && it->second.wanted)
+        --it->second.wanted;
+
+    pthread_mutex_unlock(&m_lock);
+}
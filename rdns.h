@@ -0,0 +1,89 @@
+/**
+ * @file   rdns.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Background reverse (PTR) lookups of target addresses.
+ */
+
+#ifndef RDNS_H_
+#define RDNS_H_
+
+#include "tcpsearch.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include <pthread.h>
+
+#include "engine.h"
+#include "resolver.h"
+
+/**
+ * @brief Singleton running getnameinfo() in worker threads, lookups are
+ *        deduplicated and their results cached (positive or negative).
+ *        Workers wake the event loop through a pipe watched by the engine.
+ */
+class ReverseResolver : public Pollable {
+  public:
+    static ReverseResolver & get_instace();
+
+    void lookup(const Address & addr);
+    bool name(const Address & addr, std::string & name);
+    void release(const Address & addr);
+
+    virtual int   fd() const { return m_pipe[0]; }
+    virtual short events() const;
+    virtual void  handle(short revents);
+    virtual bool  done() const { return false; }
+
+  private:
+    /**
+     * @brief Cached lookup.
+     */
+    class Entry {
+      public:
+        bool        done;   ///<! lookup finished
+        std::string name;   ///<! host name, empty if there is none
+        unsigned    wanted; ///<! lookups whose result was not collected
+    };
+
+    /**
+     * @brief Lookup waiting for a worker.
+     */
+    class Request {
+      public:
+        std::string key;    ///<! key of the entry in the cache
+        Address     addr;   ///<! address to be looked up
+    };
+
+    typedef std::map<std::string, Entry> cache_t;
+
+    ReverseResolver();
+    virtual ~ReverseResolver();
+
+    static std::string key(const Address & addr);
+    static void * worker(void * arg);
+
+    void start();
+    void serve();
+    void evict();
+
+    int                     m_pipe[2];  ///<! wakes the event loop
+    unsigned                m_pending;  ///<! lookups not reported to the
+                                        ///<! loop, used by the loop only
+    pthread_mutex_t         m_lock;     ///<! guards all members below
+    pthread_cond_t          m_wakeup;   ///<! signalled when a request is
+                                        ///<! queued
+    std::deque<Request>     m_queue;    ///<! lookups waiting for a worker
+    cache_t                 m_cache;    ///<! finished and running lookups
+    std::deque<std::string> m_age;      ///<! keys of m_cache, oldest first
+    unsigned                m_workers;  ///<! count of started workers
+    bool                    m_started;  ///<! workers were started
+    unsigned                m_finished; ///<! lookups finished since last
+                                        ///<! wakeup
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(ReverseResolver);
+}; // class ReverseResolver
+
+#endif // RDNS_H_
@@ -0,0 +1,192 @@
+/**
+ * @file   reorder.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Reorder buffer restoring host by host output.
+ */
+
+#include "reorder.h"
+
+#include <cassert>
+
+#include "connect.h"
+#include "text.h"
+
+/**
+ * Constructor.
+ *
+ * @param out output stream, hosts are numbered from 1
+ */
+Reorder::Reorder(std::ostream & out)
+    : m_out(out)
+{
+    m_next = 1;
+    m_size = 0;
+}
+
+/**
+ * Destructor.
+ */
+Reorder::~Reorder()
+{
+    for (blockmap_t::const_iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+        release(it->second);
+}
+
+/**
+ * Drop references to banners of a block.
+ *
+ * @param block block of a host
+ * @return void
+ */
+void Reorder::release(const Block & block)
+{
+    for (resultmap_t::const_iterator r = block.results.begin(); r != block.results.end(); ++r)
+        Banners::get_instace().release(r->second.banner);
+}
+
+/**
+ * Start block of host, every sequence number has to be opened.
+ *
+ * @param seq sequence number of the host
+ * @param name host as stated in the input
+ * @param addr address scanned, addrlen is 0 if the host was not translated
+ * @return void
+ */
+void Reorder::open(unsigned long seq, const std::string & name, const Address & addr)
+{
+    assert(seq >= m_next);
+
+    Block & block = m_blocks[seq];
+    block.name = name;
+    block.addr = addr;
+    block.complete = false;
+    block.labeled = true;
+}
+
+/**
+ * Buffer output of port.
+ *
+ * @param seq sequence number of the host
+ * @param port port
+ * @param line port line is followed by a banner line
+ * @param banner banner to write, it is interned while it is held
+ * @return void
+ */
+void Reorder::add(unsigned long seq, port_t port, bool line, const std::string & banner)
+{
+    blockmap_t::iterator it = m_blocks.find(seq);
+    assert(it != m_blocks.end());
+
+    Result result;
+    result.line = line;
+    result.banner = Banners::get_instace().intern(banner.data(), banner.size());
+
+    it->second.results.insert(std::make_pair(port, result));
+    ++m_size;
+}
+
+/**
+ * Mark host as complete, write all complete blocks which are next in order.
+ *
+ * @param seq sequence number of the host
+ * @return void
+ */
+void Reorder::close(unsigned long seq)
+{
+    blockmap_t::iterator it = m_blocks.find(seq);
+
+    if (it == m_blocks.end() || it->second.complete)
+        return;
+
+    it->second.complete = true;
+
+    if (seq == m_next)
+        emit(false);
+}
+
+/**
+ * Hold block of host until its alias is known.
+ *
+ * @param seq sequence number of the host
+ * @return void
+ */
+void Reorder::hold(unsigned long seq)
+{
+    blockmap_t::iterator it = m_blocks.find(seq);
+
+    if (it != m_blocks.end())
+        it->second.labeled = false;
+}
+
+/**
+ * Set alias of host, write all complete blocks which are next in order.
+ *
+ * @param seq sequence number of the host
+ * @param alias name of the host, empty for none
+ * @return void
+ */
+void Reorder::label(unsigned long seq, const std::string & alias)
+{
+    blockmap_t::iterator it = m_blocks.find(seq);
+
+    if (it == m_blocks.end() || it->second.labeled)
+        return;
+
+    it->second.alias = alias;
+    it->second.labeled = true;
+
+    if (seq == m_next)
+        emit(false);
+}
+
+/**
+ * Write all buffered blocks, complete or not.
+ *
+ * @return void
+ */
+void Reorder::flush()
+{
+    emit(true);
+}
+
+/**
+ * Write blocks in sequence order.
+ *
+ * @param all write incomplete blocks as well
+ * @return void
+ */
+void Reorder::emit(bool all)
+{
+    while (! m_blocks.empty()) {
+        blockmap_t::iterator it = m_blocks.begin();
+
+        if (! all && (it->first != m_next || ! it->second.complete
+                    || ! it->second.labeled))
+            break;
+
+        const Address & addr = it->second.addr;
+        Connect::pretty_host_print(m_out, it->second.name, addr.addrlen ? &addr : NULL,
+                                   it->second.alias);
+
+        for (resultmap_t::const_iterator r = it->second.results.begin();
+                r != it->second.results.end();
+                ++r) {
+            m_out << r->first << std::endl;
+
+            if (! r->second.line)
+                continue;
+
+            const Banners & banners = Banners::get_instace();
+            escape_banner(m_escaped, banners.data(r->second.banner),
+                          banners.length(r->second.banner));
+            m_out << m_escaped << std::endl;
+        }
+
+        release(it->second);
+        m_size -= it->second.results.size();
+        m_next = it->first + 1;
+        m_blocks.erase(it);
+    }
+
+    m_out.flush();
+}
@@ -0,0 +1,79 @@
+/**
+ * @file   reorder.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Reorder buffer restoring host by host output.
+ */
+
+#ifndef REORDER_H_
+#define REORDER_H_
+
+#include "tcpsearch.h"
+#include "banner.h"
+#include "resolver.h"
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+
+/**
+ * @brief Buffer of results keyed by host sequence number and port. Blocks of
+ *        hosts are written in sequence order as soon as they are complete,
+ *        results of a host in ascending port order. A held block waits
+ *        for its alias as well. Results keep references to banners, which
+ *        are escaped only when written.
+ */
+class Reorder {
+  public:
+    Reorder(std::ostream & out);
+    ~Reorder();
+
+    void   open(unsigned long seq, const std::string & name, const Address & addr);
+    void   add(unsigned long seq, port_t port, bool line, const std::string & banner);
+    void   close(unsigned long seq);
+    void   hold(unsigned long seq);
+    void   label(unsigned long seq, const std::string & alias);
+    void   flush();
+    size_t size() const { return m_size + m_blocks.size(); }
+
+  private:
+    /**
+     * @brief Output of a port, the port line is followed by a banner line.
+     */
+    class Result {
+      public:
+        bool     line;          ///<! banner line is written, even if empty
+        banner_t banner;        ///<! banner, it is referenced
+    };
+
+    typedef std::multimap<port_t, Result> resultmap_t;
+
+    /**
+     * @brief Results of one host.
+     */
+    class Block {
+      public:
+        std::string name;       ///<! host as stated in the input
+        Address     addr;       ///<! address scanned, addrlen is 0 if none
+        std::string alias;      ///<! name of the host found later, optional
+        bool        complete;   ///<! no more results will come
+        bool        labeled;    ///<! alias is settled
+        resultmap_t results;    ///<! output of ports
+    };
+
+    typedef std::map<unsigned long, Block> blockmap_t;
+
+    void emit(bool all);
+    void release(const Block & block);
+
+    std::ostream & m_out;       ///<! output stream
+    std::string    m_escaped;   ///<! buffer for sanitized banner
+    blockmap_t     m_blocks;    ///<! hosts which were not written yet
+    unsigned long  m_next;      ///<! sequence number of next host to write
+    size_t         m_size;      ///<! count of buffered results
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Reorder);
+}; // class Reorder
+
+#endif // REORDER_H_
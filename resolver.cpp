@@ -0,0 +1,400 @@
+/**
+ * @file   resolver.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Caching host name resolver.
+ */
+
+#include "resolver.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "dnscache.h"
+#include "network.h"
+
+/**
+ * How long is a translation considered valid (getaddrinfo() does not expose
+ * record TTLs).
+ */
+static const msec_t kPositiveTtl = 300 * 1000;
+
+/**
+ * How long is a failed translation remembered.
+ */
+static const msec_t kNegativeTtl = 30 * 1000;
+
+/**
+ * Maximum count of cached translations.
+ */
+static const size_t kMaxEntries = 65536;
+
+/**
+ * Count of translations running at once.
+ */
+static const unsigned kWorkers = 16;
+
+/**
+ * Constructor.
+ */
+Resolver::Resolver()
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_wakeup, NULL);
+    m_file = NULL;
+    m_pipe[0] = m_pipe[1] = -1;
+    m_pending = 0;
+    m_workers = 0;
+    m_started = false;
+}
+
+/**
+ * Destructor, never called as workers may still be blocked in getaddrinfo().
+ */
+Resolver::~Resolver()
+{
+}
+
+/**
+ * Access singleton, it is never destroyed so workers outliving main() do not
+ * touch released memory.
+ *
+ * @return singleton instance
+ */
+Resolver & Resolver::get_instace()
+{
+    static Resolver * instance = new Resolver();
+    return *instance;
+}
+
+/**
+ * Keep translations in a file as well, the file is consulted before the
+ * name is translated.
+ *
+ * @param file cache file, NULL for none; it is not owned
+ * @return void
+ */
+void Resolver::persist(DnsCacheFile * file)
+{
+    m_file = file;
+}
+
+/**
+ * Check if host is an IPv4 or IPv6 address, which is translated without
+ * asking the network.
+ *
+ * @param host host
+ * @return true if host is numeric
+ */
+bool Resolver::numeric(const std::string & host)
+{
+    unsigned char buf[sizeof(struct in6_addr)];
+
+    return inet_pton(AF_INET, host.c_str(), buf) == 1
+           || inet_pton(AF_INET6, host.c_str(), buf) == 1;
+}
+
+/**
+ * Drop stale entries, drop every idle one if the cache is still too big.
+ * Entries whose result was not taken yet are kept.
+ *
+ * @param now current time
+ * @return void
+ */
+void Resolver::evict(msec_t now)
+{
+    for (cache_t::iterator it = m_cache.begin(); it != m_cache.end(); ) {
+        if (! it->second.running && ! it->second.wanted && it->second.expires <= now)
+            m_cache.erase(it++);
+        else
+            ++it;
+    }
+
+    for (cache_t::iterator it = m_cache.begin();
+            it != m_cache.end() && m_cache.size() >= kMaxEntries; ) {
+        if (! it->second.running && ! it->second.wanted)
+            m_cache.erase(it++);
+        else
+            ++it;
+    }
+}
+
+/**
+ * Put translation to the cache.
+ *
+ * @param host translated host
+ * @param error getaddrinfo() return value
+ * @param addrs translated addresses
+ * @param fresh translation was not read from the cache file, store it there
+ * @return void
+ */
+void Resolver::store(const std::string & host, int error, const addrlist_t & addrs,
+                     bool fresh)
+{
+    msec_t now = Engine::now();
+    bool temporary = error == EAI_AGAIN || error == EAI_SYSTEM || error == EAI_MEMORY;
+
+    if (fresh && m_file && ! temporary)
+        m_file->store(host, error, addrs);
+
+    if (m_cache.size() >= kMaxEntries)
+        evict(now);
+
+    Entry & entry = m_cache[host];
+    entry.error = error;
+    entry.addrs = addrs;
+    entry.running = false;
+
+    // temporary failures are not worth remembering, the entry only hands
+    // the result over
+    if (temporary)
+        entry.expires = now;
+    else
+        entry.expires = now + (error ? kNegativeTtl : kPositiveTtl);
+}
+
+/**
+ * Translate host to list of IPv4/IPv6 addresses, use cached result if any.
+ * The event loop waits meanwhile, see request().
+ *
+ * @param host host to be translated
+ * @param addrs translated addresses in order given by getaddrinfo()
+ * @return getaddrinfo() return value, 0 on success
+ */
+int Resolver::resolve(const std::string & host, addrlist_t & addrs)
+{
+    cache_t::iterator it = m_cache.find(host);
+    if (it != m_cache.end() && ! it->second.running
+            && it->second.expires > Engine::now()) {
+        addrs = it->second.addrs;
+        return it->second.error;
+    }
+
+    int ret;
+
+    // translations shared across runs go before the network
+    if (m_file && m_file->lookup(host, ret, addrs)) {
+        store(host, ret, addrs, false);
+    } else {
+        ret = Network::current().resolve(host, addrs);
+        store(host, ret, addrs, true);
+    }
+
+    return ret;
+}
+
+/**
+ * Set descriptor to non-blocking mode.
+ *
+ * @param fd descriptor
+ * @return false on error
+ */
+static bool set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+/**
+ * Start workers and watch their pipe.
+ *
+ * @return void
+ */
+void Resolver::start()
+{
+    m_started = true;
+
+    if (pipe(m_pipe) < 0)
+        return;
+
+    if (! set_nonblock(m_pipe[0]) || ! set_nonblock(m_pipe[1])) {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+        return;
+    }
+
+    for (unsigned i = 0; i < kWorkers; ++i) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, worker, this))
+            break;
+
+        pthread_detach(thread);
+        ++m_workers;
+    }
+
+    if (m_workers)
+        Engine::get_instace().watch(this);
+}
+
+/**
+ * Entry point of worker thread.
+ *
+ * @param arg resolver
+ * @return NULL
+ */
+void * Resolver::worker(void * arg)
+{
+    static_cast<Resolver *>(arg)->serve();
+    return NULL;
+}
+
+/**
+ * Run queued translations forever.
+ *
+ * @return void
+ */
+void Resolver::serve()
+{
+    pthread_mutex_lock(&m_lock);
+
+    for (;;) {
+        while (m_queue.empty())
+            pthread_cond_wait(&m_wakeup, &m_lock);
+
+        Lookup lookup = m_queue.front();
+        m_queue.pop_front();
+
+        pthread_mutex_unlock(&m_lock);
+
+        lookup.error = Network::current().resolve(lookup.host, lookup.addrs);
+
+        pthread_mutex_lock(&m_lock);
+
+        // one byte wakes the loop, which takes all finished lookups at once
+        if (m_finished.empty()) {
+            ssize_t written = write(m_pipe[1], "", 1);
+            UNUSED(written);
+        }
+
+        m_finished.push_back(lookup);
+    }
+}
+
+/**
+ * Watch the pipe only while translations are running.
+ *
+ * @return events to poll
+ */
+short Resolver::events() const
+{
+    return m_pending ? POLLIN : 0;
+}
+
+/**
+ * Take translations finished by workers to the cache, jobs collect them
+ * from there.
+ *
+ * @param revents returned events
+ * @return void
+ */
+void Resolver::handle(short revents)
+{
+    UNUSED(revents);
+
+    char buf[64];
+
+    while (read(m_pipe[0], buf, sizeof(buf)) > 0)
+        continue;
+
+    std::deque<Lookup> finished;
+
+    pthread_mutex_lock(&m_lock);
+    finished.swap(m_finished);
+    pthread_mutex_unlock(&m_lock);
+
+    for (size_t i = 0; i < finished.size(); ++i)
+        store(finished[i].host, finished[i].error, finished[i].addrs, true);
+
+    m_pending -= finished.size();
+}
+
+/**
+ * Start translation of host unless it is cached or running already. Names
+ * are translated by workers, numeric hosts and simulated names right away.
+ * The entry is kept until its result is taken, see release().
+ *
+ * @param host host to be translated
+ * @return void
+ */
+void Resolver::request(const std::string & host)
+{
+    if (m_cache.size() >= kMaxEntries)
+        evict(Engine::now());
+
+    Entry & entry = m_cache[host];
+    ++entry.wanted;
+
+    if (entry.running || entry.expires > Engine::now())
+        return;
+
+    bool wait = Network::current().resolve_blocks() && ! numeric(host);
+    int ret;
+    addrlist_t addrs;
+
+    if (wait && ! m_started)
+        start();
+
+    // no thread could be started, the loop waits for the network
+    if (! wait || ! m_workers) {
+        resolve(host, addrs);
+        return;
+    }
+
+    if (m_file && m_file->lookup(host, ret, addrs)) {
+        store(host, ret, addrs, false);
+        return;
+    }
+
+    entry.running = true;
+    ++m_pending;
+
+    Lookup lookup;
+    lookup.host = host;
+
+    pthread_mutex_lock(&m_lock);
+    m_queue.push_back(lookup);
+    pthread_cond_signal(&m_wakeup);
+    pthread_mutex_unlock(&m_lock);
+}
+
+/**
+ * Get result of translation started by request().
+ *
+ * @param host translated host
+ * @param error getaddrinfo() return value
+ * @param addrs translated addresses in order given by getaddrinfo()
+ * @return false if the translation did not finish yet
+ */
+bool Resolver::result(const std::string & host, int & error, addrlist_t & addrs)
+{
+    cache_t::const_iterator it = m_cache.find(host);
+
+    if (it == m_cache.end() || it->second.running)
+        return false;
+
+    error = it->second.error;
+    addrs = it->second.addrs;
+
+    return true;
+}
+
+/**
+ * Tell that result of translation started by request() was taken or is no
+ * longer needed, the entry may be evicted then.
+ *
+ * @param host translated host
+ * @return void
+ */
+void Resolver::release(const std::string & host)
+{
+    cache_t::iterator it = m_cache.find(host);
+
+    if (it != m_cache.end() && it->second.wanted)
+        --it->second.wanted;
+}
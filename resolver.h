@@ -0,0 +1,109 @@
+/**
+ * @file   resolver.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Caching host name resolver.
+ */
+
+#ifndef RESOLVER_H_
+#define RESOLVER_H_
+
+#include "tcpsearch.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "engine.h"
+
+class DnsCacheFile;
+
+/**
+ * @brief Resolved socket address.
+ */
+class Address {
+  public:
+    struct sockaddr_storage addr;
+    socklen_t               addrlen;
+};
+
+typedef std::vector<Address> addrlist_t;
+
+/**
+ * @brief Singleton keeping translated host names warm between lookups.
+ *        Names are translated by getaddrinfo() in worker threads, which
+ *        wake the event loop through a pipe watched by the engine; the
+ *        cache is used by the loop only.
+ */
+class Resolver : public Pollable {
+  public:
+    static Resolver & get_instace();
+
+    int  resolve(const std::string & host, addrlist_t & addrs);
+    void request(const std::string & host);
+    bool result(const std::string & host, int & error, addrlist_t & addrs);
+    void release(const std::string & host);
+    void persist(DnsCacheFile * file);
+
+    virtual int   fd() const { return m_pipe[0]; }
+    virtual short events() const;
+    virtual void  handle(short revents);
+    virtual bool  done() const { return false; }
+
+  private:
+    /**
+     * @brief Cached translation (positive or negative).
+     */
+    class Entry {
+      public:
+        int        error;       ///<! getaddrinfo() return value
+        addrlist_t addrs;       ///<! translated addresses
+        msec_t     expires;     ///<! time when entry gets stale
+        bool       running;     ///<! translation is being done by a worker
+        unsigned   wanted;      ///<! requests whose result was not taken
+    };
+
+    /**
+     * @brief Translation passed to a worker and back.
+     */
+    class Lookup {
+      public:
+        std::string host;       ///<! host to be translated
+        int         error;      ///<! getaddrinfo() return value
+        addrlist_t  addrs;      ///<! translated addresses
+    };
+
+    typedef std::map<std::string, Entry> cache_t;
+
+    Resolver();
+    virtual ~Resolver();
+
+    static bool numeric(const std::string & host);
+    static void * worker(void * arg);
+
+    void start();
+    void serve();
+    void store(const std::string & host, int error, const addrlist_t & addrs,
+               bool fresh);
+    void evict(msec_t now);
+
+    cache_t            m_cache;    ///<! translations, used by the loop only
+    DnsCacheFile     * m_file;     ///<! translations shared across runs,
+                                   ///<! optional
+    int                m_pipe[2];  ///<! wakes the event loop
+    unsigned           m_pending;  ///<! translations given to workers
+    unsigned           m_workers;  ///<! count of started workers
+    bool               m_started;  ///<! workers were started
+    pthread_mutex_t    m_lock;     ///<! guards all members below
+    pthread_cond_t     m_wakeup;   ///<! signalled when a lookup is queued
+    std::deque<Lookup> m_queue;    ///<! lookups waiting for a worker
+    std::deque<Lookup> m_finished; ///<! lookups not taken by the loop yet
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Resolver);
+}; // class Resolver
+
+#endif // RESOLVER_H_
@@ -0,0 +1,690 @@
+/**
+ * @file   simnet.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Simulated network with virtual time.
+ */
+
+#include "simnet.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <cassert>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * Virtual time of the start of a simulation.
+ */
+static const msec_t kEpoch = 1000;
+
+/**
+ * Descriptors are numbered from here so they never look like real ones.
+ */
+static const int kFirstFd = 1 << 20;
+
+/**
+ * Time after which an unanswered connect fails, as the kernel gives up
+ * after its SYN retransmissions.
+ */
+static const msec_t kSynTimeout = 127 * 1000;
+
+/**
+ * Time after which a silent service closes idle connection.
+ */
+static const msec_t kIdleTimeout = 60 * 1000;
+
+/**
+ * Upper limit for simulated round-trip time and banner length.
+ */
+static const msec_t   kLatencyLimit = 60 * 1000;
+static const unsigned kBannerLimit = 4096;
+
+/**
+ * Mix bits of a value (splitmix64 finalizer).
+ *
+ * @param x value to be mixed
+ * @return mixed value
+ */
+static uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Map hash to interval [0, 1).
+ *
+ * @param x hash
+ * @return probability
+ */
+static double unit(uint64_t x)
+{
+    return static_cast<double>(x >> 11) / 9007199254740992.0;
+}
+
+/**
+ * Hash bytes of a buffer.
+ *
+ * @param seed initial value
+ * @param data buffer
+ * @param len size of buffer
+ * @return hash
+ */
+static uint64_t hash(uint64_t seed, const void * data, size_t len)
+{
+    const unsigned char * ptr = static_cast<const unsigned char *>(data);
+    uint64_t h = mix(seed);
+
+    for (size_t i = 0; i < len; ++i)
+        h = mix(h ^ ptr[i]);
+
+    return h;
+}
+
+/**
+ * Parse range "MIN-MAX" or a single value.
+ *
+ * @param str string to be parsed
+ * @param len length of string
+ * @param min lower bound
+ * @param max upper bound
+ * @param limit upper limit of both bounds
+ * @return true on success
+ */
+static bool parse_range(const char * str, size_t len,
+                        unsigned long & min, unsigned long & max,
+                        unsigned long limit)
+{
+    std::string value(str, len);
+    char * endptr;
+
+    if (value.empty() || value[0] < '0' || value[0] > '9')
+        return false;
+
+    min = strtoul(value.c_str(), &endptr, 10);
+    max = min;
+
+    if (*endptr == '-') {
+        const char * ptr = endptr + 1;
+
+        if (*ptr < '0' || *ptr > '9')
+            return false;
+
+        max = strtoul(ptr, &endptr, 10);
+    }
+
+    return ! *endptr && min <= max && max <= limit;
+}
+
+/**
+ * Parse probability.
+ *
+ * @param str string to be parsed
+ * @param len length of string
+ * @param value parsed probability
+ * @return true on success
+ */
+static bool parse_probability(const char * str, size_t len, double & value)
+{
+    std::string text(str, len);
+    char * endptr;
+
+    if (text.empty() || ((text[0] < '0' || text[0] > '9') && text[0] != '.'))
+        return false;
+
+    value = strtod(text.c_str(), &endptr);
+
+    return ! *endptr && value >= 0 && value <= 1;
+}
+
+/**
+ * Constructor, defaults of the simulation.
+ */
+SimSpec::SimSpec()
+{
+    seed = 1;
+    latency_min = 10;
+    latency_max = 200;
+    loss = 0;
+    down = 0;
+    open = 0.01;
+    banner_min = 0;
+    banner_max = 256;
+}
+
+/**
+ * Constructor.
+ */
+SimNetwork::SimNetwork()
+{
+    m_now = kEpoch;
+    m_next_fd = kFirstFd;
+    m_attempts = 0;
+    m_open = 0;
+    m_refused = 0;
+    m_dropped = 0;
+}
+
+/**
+ * Destructor.
+ */
+SimNetwork::~SimNetwork()
+{
+}
+
+/**
+ * Parse simulation parameters, e.g. "seed=7,latency=20-80,loss=0.01".
+ *
+ * @param spec comma-separated list of KEY=VALUE, keys are seed, latency,
+ *        loss, down, open and banner
+ * @param result parsed parameters, keys not stated keep defaults
+ * @return true on success
+ */
+bool SimNetwork::parse_spec(const char * spec, SimSpec & result)
+{
+    assert(spec);
+
+    const char * ptr = spec;
+
+    result = SimSpec();
+
+    // empty spec runs defaults
+    if (! *ptr)
+        return true;
+
+    do {
+        size_t len = strcspn(ptr, ",");
+        const char * eq = static_cast<const char *>(memchr(ptr, '=', len));
+
+        if (! eq)
+            return false;
+
+        std::string key(ptr, eq - ptr);
+        const char * value = eq + 1;
+        size_t value_len = ptr + len - value;
+        unsigned long min, max;
+
+        if (key == "seed") {
+            if (! parse_range(value, value_len, min, max, ~0UL) || min != max)
+                return false;
+            result.seed = min;
+        } else if (key == "latency") {
+            if (! parse_range(value, value_len, min, max, kLatencyLimit))
+                return false;
+            result.latency_min = min;
+            result.latency_max = max;
+        } else if (key == "banner") {
+            if (! parse_range(value, value_len, min, max, kBannerLimit))
+                return false;
+            result.banner_min = min;
+            result.banner_max = max;
+        } else if (key == "loss") {
+            if (! parse_probability(value, value_len, result.loss))
+                return false;
+        } else if (key == "down") {
+            if (! parse_probability(value, value_len, result.down))
+                return false;
+        } else if (key == "open") {
+            if (! parse_probability(value, value_len, result.open))
+                return false;
+        } else {
+            return false;
+        }
+
+        ptr += len;
+    } while (*ptr++ == ',');
+
+    return true;
+}
+
+/**
+ * Set parameters of the simulation.
+ *
+ * @param spec parameters
+ * @return void
+ */
+void SimNetwork::configure(const SimSpec & spec)
+{
+    m_spec = spec;
+}
+
+/**
+ * Print summary of the simulation.
+ *
+ * @param out output stream
+ * @return void
+ */
+void SimNetwork::report(std::ostream & out) const
+{
+    out << "Simulation: " << m_attempts << " connects, "
+        << m_open << " open, " << m_refused << " refused, "
+        << m_dropped << " unanswered, "
+        << (m_now - kEpoch) << " ms of virtual time\n";
+}
+
+/**
+ * Get virtual time.
+ *
+ * @return current time
+ */
+msec_t SimNetwork::now()
+{
+    return m_now;
+}
+
+/**
+ * Translate host, numeric addresses are taken as they are, names in .invalid
+ * do not exist and other names get an address from 100.64.0.0/10.
+ *
+ * @param host host to be translated
+ * @param addrs translated address
+ * @return getaddrinfo() compatible return value, 0 on success
+ */
+int SimNetwork::resolve(const std::string & host, addrlist_t & addrs)
+{
+    Address addr;
+
+    addrs.clear();
+    memset(&addr.addr, 0, sizeof(addr.addr));
+
+    struct sockaddr_in * in = reinterpret_cast<struct sockaddr_in *>(&addr.addr);
+    struct sockaddr_in6 * in6 = reinterpret_cast<struct sockaddr_in6 *>(&addr.addr);
+
+    static const char kInvalid[] = ".invalid";
+    static const size_t kInvalidLen = sizeof(kInvalid) - 1;
+
+    if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) == 1) {
+        in->sin_family = AF_INET;
+        addr.addrlen = sizeof(*in);
+    } else if (inet_pton(AF_INET6, host.c_str(), &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        addr.addrlen = sizeof(*in6);
+    } else if (host.empty() || host == kInvalid + 1
+            || (host.size() > kInvalidLen
+                && ! host.compare(host.size() - kInvalidLen, kInvalidLen, kInvalid))) {
+        return EAI_NONAME;
+    } else {
+        uint32_t ip = 0x64400000 | (hash(m_spec.seed, host.data(), host.size()) & 0x3fffff);
+
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(ip);
+        addr.addrlen = sizeof(*in);
+    }
+
+    addrs.push_back(addr);
+
+    return 0;
+}
+
+/**
+ * Check if translation waits for the network.
+ *
+ * @return false, simulated names are translated at once, in the order the
+ *         scan asks for them
+ */
+bool SimNetwork::resolve_blocks()
+{
+    return false;
+}
+
+/**
+ * Open simulated socket.
+ *
+ * @param family address family
+ * @return socket or -1 on error
+ */
+int SimNetwork::open(int family)
+{
+    if (family != AF_INET && family != AF_INET6) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    Socket & sock = m_sockets[m_next_fd];
+    sock.family = family;
+    sock.connecting = false;
+    sock.answer_at = 0;
+    sock.error = 0;
+    sock.data_at = 0;
+    sock.close_at = 0;
+    sock.offset = 0;
+
+    return m_next_fd++;
+}
+
+/**
+ * Start connect, its outcome is decided right away and becomes visible once
+ * the answer arrives.
+ *
+ * @param fd socket
+ * @param addr address to connect to
+ * @param len length of address
+ * @return -1 with EINPROGRESS
+ */
+int SimNetwork::connect(int fd, const struct sockaddr * addr, socklen_t len)
+{
+    socketmap_t::iterator it = m_sockets.find(fd);
+    if (it == m_sockets.end()) {
+        errno = EBADF;
+        return -1;
+    }
+
+    Socket & sock = it->second;
+
+    if (sock.connecting || addr->sa_family != sock.family) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // host is identified by its address only, port is mixed in separately
+    uint64_t host;
+    unsigned port;
+
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in * in = reinterpret_cast<const struct sockaddr_in *>(addr);
+        host = hash(m_spec.seed, &in->sin_addr, sizeof(in->sin_addr));
+        port = ntohs(in->sin_port);
+    } else {
+        const struct sockaddr_in6 * in6 = reinterpret_cast<const struct sockaddr_in6 *>(addr);
+        host = hash(m_spec.seed, &in6->sin6_addr, sizeof(in6->sin6_addr));
+        port = ntohs(in6->sin6_port);
+    }
+
+    msec_t rtt = m_spec.latency_min
+        + mix(host ^ 1) % (m_spec.latency_max - m_spec.latency_min + 1);
+    uint64_t service = mix(host ^ (static_cast<uint64_t>(port) << 8) ^ 2);
+
+    ++m_attempts;
+    sock.connecting = true;
+
+    if (unit(mix(host ^ 3)) < m_spec.down
+            || unit(mix(service ^ m_attempts)) < m_spec.loss) {
+        // nothing comes back, connect gives up eventually
+        ++m_dropped;
+        sock.answer_at = m_now + kSynTimeout;
+        sock.error = ETIMEDOUT;
+    } else if (unit(service) >= m_spec.open) {
+        ++m_refused;
+        sock.answer_at = m_now + rtt;
+        sock.error = ECONNREFUSED;
+    } else {
+        ++m_open;
+        sock.answer_at = m_now + rtt;
+        sock.error = 0;
+
+        unsigned banner = m_spec.banner_min
+            + mix(service ^ 4) % (m_spec.banner_max - m_spec.banner_min + 1);
+
+        if (banner) {
+            char prefix[16];
+            int n = snprintf(prefix, sizeof(prefix), "SIM-%u ", port);
+
+            for (unsigned i = 0; i + 2 < banner; ++i)
+                sock.data += i < static_cast<unsigned>(n) ? prefix[i] : 'a' + i % 26;
+
+            sock.data += banner > 1 ? "\r\n" : "\n";
+
+            // server speaks once our ACK reaches it
+            sock.data_at = sock.answer_at + rtt;
+        } else {
+            sock.close_at = sock.answer_at + kIdleTimeout;
+        }
+    }
+
+    UNUSED(len);
+
+    errno = EINPROGRESS;
+    return -1;
+}
+
+/**
+ * Get result of connect.
+ *
+ * @param fd socket
+ * @param err error of connect, 0 if connected, EINPROGRESS if pending
+ * @return -1 on error
+ */
+int SimNetwork::pending_error(int fd, int & err)
+{
+    socketmap_t::iterator it = m_sockets.find(fd);
+    if (it == m_sockets.end()) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (! it->second.connecting || m_now < it->second.answer_at)
+        err = EINPROGRESS;
+    else
+        err = it->second.error;
+
+    return 0;
+}
+
+/**
+ * Read banner sent by simulated service.
+ *
+ * @param fd socket
+ * @param buf buffer
+ * @param len size of buffer
+ * @return count of bytes read, 0 on end of stream, -1 on error
+ */
+ssize_t SimNetwork::read(int fd, void * buf, size_t len)
+{
+    socketmap_t::iterator it = m_sockets.find(fd);
+    if (it == m_sockets.end()) {
+        errno = EBADF;
+        return -1;
+    }
+
+    Socket & sock = it->second;
+
+    if (! sock.connecting || m_now < sock.answer_at || sock.error) {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    if (sock.offset < sock.data.size() && m_now >= sock.data_at) {
+        size_t n = sock.data.size() - sock.offset;
+        if (n > len)
+            n = len;
+
+        memcpy(buf, sock.data.data() + sock.offset, n);
+        sock.offset += n;
+
+        return n;
+    }
+
+    if (sock.close_at && m_now >= sock.close_at)
+        return 0;
+
+    errno = EAGAIN;
+    return -1;
+}
+
+/**
+ * Write to simulated socket, services ignore what they are sent.
+ *
+ * @param fd socket
+ * @param buf data
+ * @param len count of bytes
+ * @return count of bytes written, -1 on error
+ */
+ssize_t SimNetwork::write(int fd, const void * buf, size_t len)
+{
+    if (m_sockets.find(fd) == m_sockets.end()) {
+        errno = EBADF;
+        return -1;
+    }
+
+    UNUSED(buf);
+    return len;
+}
+
+/**
+ * Close simulated socket.
+ *
+ * @param fd socket
+ * @return void
+ */
+void SimNetwork::close(int fd)
+{
+    m_sockets.erase(fd);
+}
+
+/**
+ * Compute events of a socket at current virtual time.
+ *
+ * @param sock socket
+ * @param events requested events
+ * @return returned events
+ */
+short SimNetwork::ready(const Socket & sock, short events) const
+{
+    if (! sock.connecting || m_now < sock.answer_at)
+        return 0;
+
+    if (sock.error)
+        return (events & (POLLIN | POLLOUT)) | POLLERR;
+
+    short revents = events & POLLOUT;
+
+    if ((events & POLLIN)
+            && ((sock.offset < sock.data.size() && m_now >= sock.data_at)
+                || (sock.close_at && m_now >= sock.close_at)))
+        revents |= POLLIN;
+
+    return revents;
+}
+
+/**
+ * Compute time of the next event of a socket.
+ *
+ * @param sock socket
+ * @param events requested events
+ * @return time of the event, 0 for none
+ */
+msec_t SimNetwork::next_event(const Socket & sock, short events) const
+{
+    if (! sock.connecting)
+        return 0;
+
+    if (m_now < sock.answer_at)
+        return sock.answer_at;
+
+    if (! (events & POLLIN) || sock.error)
+        return 0;
+
+    if (sock.offset < sock.data.size())
+        return sock.data_at;
+
+    return sock.close_at;
+}
+
+/**
+ * Poll real descriptors among fds, those without events are skipped.
+ *
+ * @param fds descriptors
+ * @param nfds count of descriptors
+ * @param timeout timeout in milliseconds, -1 for none
+ * @return count of real descriptors with events, -1 if none is watched
+ */
+int SimNetwork::poll_real(struct pollfd * fds, nfds_t nfds, int timeout)
+{
+    m_real.clear();
+
+    for (nfds_t i = 0; i < nfds; ++i) {
+        if (fds[i].fd >= 0 && fds[i].fd < kFirstFd && fds[i].events)
+            m_real.push_back(fds[i]);
+    }
+
+    if (m_real.empty())
+        return -1;
+
+    // interrupted wait returns nothing, the loop checks for stop
+    int ret = ::poll(&m_real[0], m_real.size(), timeout);
+    if (ret <= 0)
+        return 0;
+
+    for (nfds_t i = 0, j = 0; i < nfds; ++i) {
+        if (fds[i].fd >= 0 && fds[i].fd < kFirstFd && fds[i].events)
+            fds[i].revents = m_real[j++].revents;
+    }
+
+    return ret;
+}
+
+/**
+ * Wait for events, virtual time skips to the next event or the timeout.
+ *
+ * @param fds descriptors
+ * @param nfds count of descriptors
+ * @param timeout timeout in milliseconds, -1 for none
+ * @return count of descriptors with events, -1 with EDEADLK if it would
+ *         wait forever
+ */
+int SimNetwork::poll(struct pollfd * fds, nfds_t nfds, int timeout)
+{
+    msec_t wakeup = timeout < 0 ? 0 : m_now + timeout;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        int count = 0;
+
+        for (nfds_t i = 0; i < nfds; ++i) {
+            fds[i].revents = 0;
+
+            // real descriptors are polled below
+            if (fds[i].fd < kFirstFd)
+                continue;
+
+            socketmap_t::const_iterator it = m_sockets.find(fds[i].fd);
+
+            if (it == m_sockets.end())
+                fds[i].revents = POLLNVAL;
+            else
+                fds[i].revents = ready(it->second, fds[i].events);
+
+            if (fds[i].revents)
+                ++count;
+        }
+
+        int real = poll_real(fds, nfds, 0);
+        if (real > 0)
+            count += real;
+
+        if (count || pass)
+            return count;
+
+        // work outside of the simulation takes no virtual time, wait for it
+        if (real == 0)
+            return poll_real(fds, nfds, -1);
+
+        // nothing is ready, skip to whatever comes first
+        msec_t next = wakeup;
+
+        for (nfds_t i = 0; i < nfds; ++i) {
+            socketmap_t::const_iterator it = m_sockets.find(fds[i].fd);
+            if (it == m_sockets.end())
+                continue;
+
+            msec_t at = next_event(it->second, fds[i].events);
+            if (at && (! next || at < next))
+                next = at;
+        }
+
+        if (! next) {
+            errno = EDEADLK;
+            return -1;
+        }
+
+        if (next > m_now)
+            m_now = next;
+    }
+
+    return 0;
+}
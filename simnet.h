@@ -0,0 +1,101 @@
+/**
+ * @file   simnet.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Simulated network with virtual time.
+ */
+
+#ifndef SIMNET_H_
+#define SIMNET_H_
+
+#include "tcpsearch.h"
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "network.h"
+
+/**
+ * @brief Parameters of simulated network.
+ */
+class SimSpec {
+  public:
+    SimSpec();
+
+    uint64_t seed;          ///<! seed of all random decisions
+    msec_t   latency_min;   ///<! lower bound of round-trip time of a host
+    msec_t   latency_max;   ///<! upper bound of round-trip time of a host
+    double   loss;          ///<! probability of connect attempt being dropped
+    double   down;          ///<! probability of host never answering
+    double   open;          ///<! probability of port being open
+    unsigned banner_min;    ///<! lower bound of banner length, 0 for silent
+    unsigned banner_max;    ///<! upper bound of banner length
+};
+
+/**
+ * @brief Network backend simulating hosts and services. All decisions are
+ *        derived from the seed, the address and the port, time is virtual
+ *        and advances only when the event loop waits, so runs are
+ *        reproducible and do not depend on the speed of the machine. Real
+ *        descriptors (e.g. wakeup of reverse lookups) are polled for real,
+ *        virtual time stands still while the loop waits for them.
+ */
+class SimNetwork : public Network {
+  public:
+    SimNetwork();
+    virtual ~SimNetwork();
+
+    static bool parse_spec(const char * spec, SimSpec & result);
+
+    void configure(const SimSpec & spec);
+    void report(std::ostream & out) const;
+
+    virtual msec_t  now();
+    virtual int     resolve(const std::string & host, addrlist_t & addrs);
+    virtual bool    resolve_blocks();
+    virtual int     open(int family);
+    virtual int     connect(int fd, const struct sockaddr * addr, socklen_t len);
+    virtual int     pending_error(int fd, int & err);
+    virtual ssize_t read(int fd, void * buf, size_t len);
+    virtual ssize_t write(int fd, const void * buf, size_t len);
+    virtual void    close(int fd);
+    virtual int     poll(struct pollfd * fds, nfds_t nfds, int timeout);
+
+  private:
+    /**
+     * @brief Simulated socket.
+     */
+    class Socket {
+      public:
+        int         family;     ///<! address family
+        bool        connecting; ///<! connect was started
+        msec_t      answer_at;  ///<! time when connect completes
+        int         error;      ///<! result of connect, 0 if connected
+        msec_t      data_at;    ///<! time when banner arrives
+        msec_t      close_at;   ///<! time when peer closes, 0 for never
+        std::string data;       ///<! banner sent by peer
+        size_t      offset;     ///<! count of banner bytes read
+    };
+
+    typedef std::map<int, Socket> socketmap_t;
+
+    short  ready(const Socket & sock, short events) const;
+    msec_t next_event(const Socket & sock, short events) const;
+    int    poll_real(struct pollfd * fds, nfds_t nfds, int timeout);
+
+    SimSpec       m_spec;       ///<! parameters of the network
+    msec_t        m_now;        ///<! virtual time
+    int           m_next_fd;    ///<! next descriptor to hand out
+    socketmap_t   m_sockets;    ///<! opened sockets
+    unsigned long m_attempts;   ///<! connect attempts, used for losses
+    unsigned long m_open;       ///<! attempts which found open port
+    unsigned long m_refused;    ///<! attempts which were reset
+    unsigned long m_dropped;    ///<! attempts which got no answer
+    std::vector<struct pollfd> m_real; ///<! real descriptors being polled
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(SimNetwork);
+}; // class SimNetwork
+
+#endif // SIMNET_H_
@@ -0,0 +1,411 @@
+/**
+ * @file   stats.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Progress counters published in a shared memory page.
+ */
+
+#include "stats.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Identification of stats file and its format.
+ */
+static const char     kMagic[4] = { 'T', 'S', 'S', 'T' };
+static const uint32_t kVersion = 1;
+
+/**
+ * Size of stats file.
+ */
+static const size_t kPageSize = 4096;
+
+/**
+ * Period of rate and ETA updates, milliseconds.
+ */
+static const msec_t kTickInterval = 1000;
+
+/**
+ * Period of --watch output, seconds.
+ */
+static const unsigned kWatchInterval = 1;
+
+/**
+ * @brief Layout of stats file.
+ */
+class Stats::Page {
+  public:
+    char     magic[4];              ///<! kMagic
+    uint32_t version;               ///<! kVersion
+    uint32_t count;                 ///<! count of counters
+    uint32_t finished;              ///<! scan is over
+    int64_t  pid;                   ///<! process of the scan
+    int64_t  started;               ///<! wall clock time of start, seconds
+    uint64_t reserved[4];           ///<! zero
+    uint64_t counters[COUNTERS];    ///<! counters
+};
+
+/**
+ * @brief Description of a counter for Prometheus text format.
+ */
+class Metric {
+  public:
+    Stats::counter_t counter;
+    const char     * name;
+    const char     * type;
+    const char     * help;
+    const char     * outcome;   ///<! label of completed probes, NULL if none
+};
+
+static const Metric kMetrics[] = {
+    { Stats::TARGETS_READ, "tcpsearch_targets_read_total", "counter",
+      "Targets read from input.", NULL },
+    { Stats::TARGETS_RESOLVED, "tcpsearch_targets_resolved_total", "counter",
+      "Targets whose name was translated.", NULL },
+    { Stats::TARGETS_FAILED, "tcpsearch_targets_failed_total", "counter",
+      "Targets whose name could not be translated.", NULL },
+    { Stats::TARGETS_DONE, "tcpsearch_targets_done_total", "counter",
+      "Targets scanned.", NULL },
+    { Stats::TARGETS_TOTAL, "tcpsearch_targets", "gauge",
+      "Targets in input, 0 if unknown.", NULL },
+    { Stats::PROBES_STARTED, "tcpsearch_probes_started_total", "counter",
+      "Probes started.", NULL },
+    { Stats::PROBES_RUNNING, "tcpsearch_probes_in_flight", "gauge",
+      "Probes in flight.", NULL },
+    { Stats::PROBES_OPEN, "tcpsearch_probes_completed_total", "counter",
+      "Probes completed by outcome.", "open" },
+    { Stats::PROBES_CLOSED, "tcpsearch_probes_completed_total", "counter",
+      NULL, "closed" },
+    { Stats::PROBES_FILTERED, "tcpsearch_probes_completed_total", "counter",
+      NULL, "filtered" },
+    { Stats::PROBES_UNKNOWN, "tcpsearch_probes_completed_total", "counter",
+      NULL, "unknown" },
+    { Stats::RATE, "tcpsearch_probe_rate", "gauge",
+      "Probes completed per second.", NULL },
+    { Stats::ETA, "tcpsearch_eta_seconds", "gauge",
+      "Estimated seconds left, 0 if unknown.", NULL },
+    { Stats::UPDATED, "tcpsearch_updated_seconds", "gauge",
+      "Time of last update since the Epoch.", NULL }
+};
+
+/**
+ * Constructor.
+ */
+Stats::Stats()
+{
+    m_page = NULL;
+    m_counters = m_private;
+    memset(m_private, 0, sizeof(m_private));
+    m_started = 0;
+    m_last = 0;
+    m_last_done = 0;
+}
+
+/**
+ * Destructor.
+ */
+Stats::~Stats()
+{
+    if (m_page)
+        munmap(m_page, kPageSize);
+}
+
+/**
+ * Access singleton instance
+ *
+ * @return singleton instance
+ */
+Stats & Stats::get_instace()
+{
+    static Stats instance;
+    return instance;
+}
+
+/**
+ * Create stats file and publish counters in it. The page is filled in a
+ * temporary file renamed over the old one, readers which still map the old
+ * file keep it and new readers see a complete page.
+ *
+ * @param path file name
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool Stats::publish(const std::string & path, std::ostream & err)
+{
+    std::string temp = path + ".XXXXXX";
+    std::vector<char> name(temp.begin(), temp.end());
+    name.push_back('\0');
+
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) {
+        err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // mkstemp() creates the file private, readers may run as other users
+    mode_t mask = umask(0);
+    umask(mask);
+
+    void * map = MAP_FAILED;
+    if (fchmod(fd, 0644 & ~mask) == 0 && ftruncate(fd, kPageSize) == 0)
+        map = mmap(NULL, kPageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED) {
+        err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        unlink(&name[0]);
+        return false;
+    }
+
+    ::close(fd);
+
+    Page * page = static_cast<Page *>(map);
+    page->version = kVersion;
+    page->count = COUNTERS;
+    page->pid = getpid();
+    page->started = time(NULL);
+    memcpy(page->counters, m_private, sizeof(m_private));
+    memcpy(page->magic, kMagic, sizeof(kMagic));
+
+    if (rename(&name[0], path.c_str()) < 0) {
+        err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        munmap(map, kPageSize);
+        unlink(&name[0]);
+        return false;
+    }
+
+    m_page = page;
+    m_counters = m_page->counters;
+
+    return true;
+}
+
+/**
+ * Update rate, ETA and time of update, at most once per kTickInterval.
+ *
+ * @param now current time
+ * @return void
+ */
+void Stats::tick(msec_t now)
+{
+    if (! m_started)
+        m_started = m_last = now;
+
+    if (now - m_last < kTickInterval)
+        return;
+
+    uint64_t done = m_counters[PROBES_OPEN] + m_counters[PROBES_CLOSED]
+                    + m_counters[PROBES_FILTERED] + m_counters[PROBES_UNKNOWN];
+
+    set(RATE, (done - m_last_done) * 1000 / (now - m_last));
+    m_last = now;
+    m_last_done = done;
+
+    // targets are scanned at a steady pace, extrapolate
+    uint64_t total = m_counters[TARGETS_TOTAL];
+    uint64_t finished = m_counters[TARGETS_DONE] + m_counters[TARGETS_FAILED];
+
+    if (total && finished && finished <= total)
+        set(ETA, (now - m_started) * (total - finished) / finished / 1000);
+    else
+        set(ETA, 0);
+
+    if (m_page)
+        set(UPDATED, time(NULL));
+}
+
+/**
+ * Mark the scan as finished.
+ *
+ * @return void
+ */
+void Stats::finish()
+{
+    if (! m_page)
+        return;
+
+    set(ETA, 0);
+    set(UPDATED, time(NULL));
+    __atomic_store_n(&m_page->finished, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Map stats file for reading.
+ *
+ * @param path file name
+ * @param err output stream for error messages
+ * @return page, NULL on error
+ */
+Stats::Page * Stats::map(const std::string & path, std::ostream & err)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        err << "Err: " << path << ": " << std::strerror(errno) << std::endl;
+        return NULL;
+    }
+
+    struct stat st;
+    void * map = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= kPageSize)
+        map = mmap(NULL, kPageSize, PROT_READ, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    Page * page = map == MAP_FAILED ? NULL : static_cast<Page *>(map);
+
+    if (! page || memcmp(page->magic, kMagic, sizeof(kMagic))
+            || page->version != kVersion || page->count != COUNTERS) {
+        err << "Err: " << path << ": not a stats file" << std::endl;
+
+        if (page)
+            munmap(page, kPageSize);
+
+        return NULL;
+    }
+
+    return page;
+}
+
+/**
+ * Read counters of a page.
+ *
+ * @param counters counters in the page
+ * @param values copy of counters
+ * @return void
+ */
+static void snapshot(const uint64_t * counters, uint64_t * values)
+{
+    for (unsigned i = 0; i < Stats::COUNTERS; ++i)
+        values[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+}
+
+/**
+ * Format duration, e.g. "1:02:03".
+ *
+ * @param seconds duration
+ * @return formatted duration
+ */
+static std::string format_duration(uint64_t seconds)
+{
+    char str[32];
+
+    snprintf(str, sizeof(str), "%llu:%02u:%02u",
+             static_cast<unsigned long long>(seconds / 3600),
+             static_cast<unsigned>(seconds / 60 % 60),
+             static_cast<unsigned>(seconds % 60));
+
+    return str;
+}
+
+/**
+ * Print progress of a scan every second until it finishes.
+ *
+ * @param path stats file
+ * @param out output stream for progress
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool Stats::watch(const std::string & path, std::ostream & out, std::ostream & err)
+{
+    Page * page = map(path, err);
+    if (! page)
+        return false;
+
+    uint64_t values[COUNTERS];
+
+    for (;;) {
+        bool finished = __atomic_load_n(&page->finished, __ATOMIC_ACQUIRE);
+        bool gone = kill(page->pid, 0) < 0 && errno == ESRCH;
+
+        snapshot(page->counters, values);
+
+        out << "targets " << values[TARGETS_READ];
+        if (values[TARGETS_TOTAL])
+            out << "/" << values[TARGETS_TOTAL];
+
+        out << " (" << values[TARGETS_DONE] << " done, "
+            << values[TARGETS_FAILED] << " failed)"
+            << ", probes " << values[PROBES_STARTED]
+            << " (" << values[PROBES_RUNNING] << " running)"
+            << ", open " << values[PROBES_OPEN]
+            << ", closed " << values[PROBES_CLOSED]
+            << ", filtered " << values[PROBES_FILTERED]
+            << ", unknown " << values[PROBES_UNKNOWN]
+            << ", " << values[RATE] << "/s";
+
+        if (finished)
+            out << ", finished";
+        else if (gone)
+            out << ", exited";
+        else if (values[ETA])
+            out << ", ETA " << format_duration(values[ETA]);
+
+        out << std::endl;
+
+        if (finished || gone)
+            break;
+
+        sleep(kWatchInterval);
+    }
+
+    munmap(page, kPageSize);
+
+    return true;
+}
+
+/**
+ * Print counters in Prometheus text format.
+ *
+ * @param path stats file
+ * @param out output stream for metrics
+ * @param err output stream for error messages
+ * @return false on error
+ */
+bool Stats::metrics(const std::string & path, std::ostream & out, std::ostream & err)
+{
+    Page * page = map(path, err);
+    if (! page)
+        return false;
+
+    uint64_t values[COUNTERS];
+    snapshot(page->counters, values);
+
+    for (size_t i = 0; i < sizeof(kMetrics) / sizeof(kMetrics[0]); ++i) {
+        const Metric & metric = kMetrics[i];
+
+        // labelled series share the header of the first one
+        if (metric.help) {
+            out << "# HELP " << metric.name << ' ' << metric.help << '\n'
+                << "# TYPE " << metric.name << ' ' << metric.type << '\n';
+        }
+
+        out << metric.name;
+        if (metric.outcome)
+            out << "{outcome=\"" << metric.outcome << "\"}";
+
+        out << ' ' << values[metric.counter] << '\n';
+    }
+
+    out << "# HELP tcpsearch_start_time_seconds Start of the scan since the Epoch.\n"
+        << "# TYPE tcpsearch_start_time_seconds gauge\n"
+        << "tcpsearch_start_time_seconds " << page->started << '\n'
+        << "# HELP tcpsearch_finished Whether the scan is over.\n"
+        << "# TYPE tcpsearch_finished gauge\n"
+        << "tcpsearch_finished " << __atomic_load_n(&page->finished, __ATOMIC_ACQUIRE)
+        << std::endl;
+
+    munmap(page, kPageSize);
+
+    return true;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file   stats.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Progress counters published in a shared memory page.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "tcpsearch.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+/**
+ * @brief Singleton with scan counters. Counters live in a memory-mapped file
+ *        once published, so other processes can watch the scan; updates are
+ *        plain relaxed stores (there is a single writer), without locks or
+ *        system calls. Unpublished counters live in private memory.
+ */
+class Stats {
+  public:
+    /**
+     * @brief Counters, their order is part of the file format.
+     */
+    enum counter_t {
+        TARGETS_READ,       ///<! targets read from input
+        TARGETS_RESOLVED,   ///<! targets with translated name
+        TARGETS_FAILED,     ///<! targets whose name could not be translated
+        TARGETS_DONE,       ///<! targets scanned
+        TARGETS_TOTAL,      ///<! targets in input, 0 if unknown
+        PROBES_STARTED,     ///<! probes started
+        PROBES_RUNNING,     ///<! probes in flight
+        PROBES_OPEN,        ///<! probes which found the port open
+        PROBES_CLOSED,      ///<! probes which found the port closed
+        PROBES_FILTERED,    ///<! probes which got no answer
+        PROBES_UNKNOWN,     ///<! probes which failed locally
+        RATE,               ///<! probes finished per second recently
+        ETA,                ///<! estimated seconds left, 0 if unknown
+        UPDATED,            ///<! wall clock time of last update, seconds
+        COUNTERS            ///<! count of counters
+    };
+
+    static Stats & get_instace();
+
+    bool publish(const std::string & path, std::ostream & err);
+    bool published() const { return m_page != NULL; }
+    void tick(msec_t now);
+    void finish();
+
+    /**
+     * Increase counter.
+     *
+     * @param counter counter to increase
+     * @param n amount
+     * @return void
+     */
+    void add(counter_t counter, uint64_t n = 1)
+    {
+        set(counter, __atomic_load_n(&m_counters[counter], __ATOMIC_RELAXED) + n);
+    }
+
+    /**
+     * Set counter.
+     *
+     * @param counter counter to set
+     * @param value new value
+     * @return void
+     */
+    void set(counter_t counter, uint64_t value)
+    {
+        __atomic_store_n(&m_counters[counter], value, __ATOMIC_RELAXED);
+    }
+
+    static bool watch(const std::string & path, std::ostream & out, std::ostream & err);
+    static bool metrics(const std::string & path, std::ostream & out, std::ostream & err);
+
+  private:
+    class Page;
+
+    Stats();
+    ~Stats();
+
+    static Page * map(const std::string & path, std::ostream & err);
+
+    Page     * m_page;                  ///<! published page, NULL if none
+    uint64_t * m_counters;              ///<! counters in use
+    uint64_t   m_private[COUNTERS];     ///<! counters if not published
+    msec_t     m_started;               ///<! time of first tick
+    msec_t     m_last;                  ///<! time of last rate update
+    uint64_t   m_last_done;             ///<! probes finished at m_last
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(Stats);
+}; // class Stats
+
+#endif // STATS_H_
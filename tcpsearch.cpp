@@ -7,17 +7,18 @@
 #include "tcpsearch.h"
 
 #include <iostream>
-#include <algorithm>
-
-#include <unistd.h>
-
-#include <sys/wait.h>
-#include <signal.h>
 
 #include "arg.h"
 #include "arg-inl.h"
-#include "connect.h"
+#include "daemon.h"
+#include "dnscache.h"
+#include "engine.h"
 #include "host.h"
+#include "job.h"
+#include "matrix.h"
+#include "resolver.h"
+#include "simnet.h"
+#include "stats.h"
 
 /**
  * @brief Return values from main()
@@ -26,64 +27,53 @@ enum ret_t {
     RET_OK,           ///<! No error occourred
     RET_E_PARAM,      ///<! Bad arguments
     RET_E_HOST_INIT,  ///<! Unable to init Host object (bad file?)
-    RET_E_TCPSEARCH   ///<! There was an error during port scan
+    RET_E_TCPSEARCH,  ///<! There was an error during port scan
+    RET_E_DAEMON,     ///<! Unable to run daemon
+    RET_E_STATES,     ///<! Unable to store or query port states
+    RET_E_DNS_CACHE,  ///<! Unable to open DNS cache file
+    RET_E_STATS       ///<! Unable to publish or read counters
 };
 
 /**
- * Dummy for signal handler to exit sleep().
- *
- * @param sig signal num
- * @return void
+ * Simulated network, outlives the engine which may still hold probes.
  */
-static void foo(int sig)
-{
-    /*
-     * When SIGCHLD is emitted, sleep() is exited and we can continue execution.
-     */
-    UNUSED(sig);
-}
+static SimNetwork s_simnet;
 
 /**
- * Main loop of the program.
+ * Translations shared across runs, outlives the resolver's users.
+ */
+static DnsCacheFile s_dns_cache;
+
+/**
+ * Print hosts from port state file which match query.
  *
- * @param  port to connect to
- * @return false if an error occourred
+ * @param  path port state file
+ * @param  query query from command line
+ * @return false on error
  */
-static bool tcpsearch(Port * port)
+static bool query_states(const std::string & path, const std::string & query)
 {
-    std::string service;
-
-    const std::string & host = Host::get_instace().host();
-
-    for (unsigned i = port->port_from; i <= port->port_to; ++i) {
-        int pid = fork();
-
-        if (pid < 0) {
-            std::cerr << "Err: unable to fork\n";
-            return false;
-        } else if (pid != 0) {
-            // father will sleep before it kills childs depending on delay given
-            if (Arg::get_instace().delay() != 0) {
-                // if child exited, continue...
-                signal(SIGCHLD, foo);
-                sleep(Arg::get_instace().delay());
-                kill(pid, SIGTERM);
-                wait(NULL); // wait for killed child
-            } else {
-                wait(NULL);
-            }
-        } else {
-            if (Connect::get_instace().examine(service, i, host.c_str())) {
-                // if there was no error, print service name
-                std::cout << service << std::endl;
-            }
-
-            exit(0);
-        }
+    StateMatrix matrix;
+    StateMatrix::condlist_t conditions;
+    std::vector<size_t> rows;
+
+    if (! StateMatrix::parse_query(query.c_str(), conditions)) {
+        std::cerr << "Err: bad query specified\n";
+        return false;
     }
 
+    if (! matrix.load(path, std::cerr))
+        return false;
+
+    matrix.query(conditions, rows);
+
+    for (size_t i = 0; i < rows.size(); ++i)
+        std::cout << matrix.name(rows[i]) << '\n';
+
+    std::cout.flush();
+
     return true;
-};
+}
 
 /**
  * Program's main()
@@ -98,26 +88,90 @@ int main(int argc, char * argv[])
         return RET_E_PARAM;
     }
 
+    if (! Arg::get_instace().query_file().empty()) {
+        if (! query_states(Arg::get_instace().query_file(), Arg::get_instace().query()))
+            return RET_E_STATES;
+
+        return RET_OK;
+    }
+
+    if (! Arg::get_instace().watch().empty()) {
+        if (! Stats::watch(Arg::get_instace().watch(), std::cout, std::cerr))
+            return RET_E_STATS;
+
+        return RET_OK;
+    }
+
+    if (! Arg::get_instace().metrics().empty()) {
+        if (! Stats::metrics(Arg::get_instace().metrics(), std::cout, std::cerr))
+            return RET_E_STATS;
+
+        return RET_OK;
+    }
+
+    if (! Arg::get_instace().stats().empty()
+            && ! Stats::get_instace().publish(Arg::get_instace().stats(), std::cerr))
+        return RET_E_STATS;
+
+    if (! Arg::get_instace().dns_cache().empty()) {
+        if (! s_dns_cache.open(Arg::get_instace().dns_cache(), std::cerr))
+            return RET_E_DNS_CACHE;
+
+        Resolver::get_instace().persist(&s_dns_cache);
+    }
+
+    Engine::get_instace().set_max_probes(Arg::get_instace().parallel());
+
+    if (! Arg::get_instace().daemon().empty()) {
+        if (! Daemon::get_instace().run(Arg::get_instace().daemon()))
+            return RET_E_DAEMON;
+
+        return RET_OK;
+    }
+
+    if (! Arg::get_instace().simulate().empty()) {
+        SimSpec spec;
+
+        if (! SimNetwork::parse_spec(Arg::get_instace().simulate().c_str(), spec))
+            return RET_E_PARAM;
+
+        s_simnet.configure(spec);
+        Network::use(&s_simnet);
+    }
+
     if (! Host::get_instace().init(Arg::get_instace().filename())) {
         return RET_E_HOST_INIT;
     }
 
-    // program's main loop
-    while (Host::get_instace().next_host()) {
+    Job job(&Host::get_instace(), Arg::get_instace().settings(),
+            std::cout, std::cerr);
+    StateMatrix matrix;
+
+    if (! Arg::get_instace().store().empty()) {
+        matrix.set_ports(Arg::get_instace().ports());
+        job.record(&matrix);
+    }
 
-        Connect::pretty_host_print(std::cout, Host::get_instace().host());
+    // program's main loop
+    Engine::get_instace().add_job(&job);
+    if (! Engine::get_instace().run(false)) {
+        return RET_E_TCPSEARCH;
+    }
 
-        // check if server exists...
-        if (! Connect::try_translate(Host::get_instace().host())) {
-            continue;
-        }
+    Stats::get_instace().finish();
 
+    if (! Arg::get_instace().simulate().empty())
+        s_simnet.report(std::cerr);
 
-        for_each(Arg::get_instace().ports_begin(),
-                 Arg::get_instace().ports_end(),
-                 tcpsearch);
+    if (! Arg::get_instace().store().empty()
+            && ! matrix.save(Arg::get_instace().store(), std::cerr)) {
+        return RET_E_STATES;
     }
 
+    // hosts after corrupt part of compressed input were not scanned
+    if (Host::get_instace().failed())
+        return RET_E_HOST_INIT;
+
     return RET_OK;
 }
 
@@ -7,9 +7,12 @@
 #ifndef TCPSEARCH_H_
 #define TCPSEARCH_H_
 
+#include <stdint.h>
+
 typedef unsigned port_t;
 typedef unsigned domain_t;
 typedef unsigned delay_t;
+typedef uint64_t msec_t;
 
 // dissallow copy and assign to classes
 #define DISABLE_COPY_AND_ASSIGN(Class)  \
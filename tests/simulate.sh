@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Scans of a simulated network. Output and summary of each scan are compared
+# with NAME.out and NAME.err in this directory; the simulation is
+# deterministic, so any difference is a change of behaviour. Reverse lookups
+# are real, the rdns scan expects /etc/hosts to name 127.0.0.1 localhost.
+#
+# Usage: tests/simulate.sh [--update]   (from the top directory, see make check)
+#   --update    rewrite expected files by current output
+
+TCPSEARCH=${TCPSEARCH:-./tcpsearch}
+DIR=$(dirname "$0")
+TMP=${TMPDIR:-/tmp}/tcpsearch-check.$$
+
+update=
+if [ "$1" = "--update" ]; then
+    update=1
+fi
+
+failed=0
+trap 'rm -f "$TMP.out" "$TMP.err"' EXIT
+
+# scan NAME SPEC OPTION..., targets are read from $hosts
+scan() {
+    name=$1
+    spec=$2
+    shift 2
+
+    $TCPSEARCH --simulate "$spec" "$@" "$hosts" > "$TMP.out" 2> "$TMP.err"
+    status=$?
+
+    if [ $status -ne 0 ]; then
+        echo "FAIL: $name: exit status $status"
+        failed=1
+    elif [ -n "$update" ]; then
+        cp "$TMP.out" "$DIR/$name.out"
+        cp "$TMP.err" "$DIR/$name.err"
+        echo "updated: $name"
+    elif diff -u "$DIR/$name.out" "$TMP.out" && diff -u "$DIR/$name.err" "$TMP.err"; then
+        echo "ok: $name"
+    else
+        echo "FAIL: $name"
+        failed=1
+    fi
+}
+
+hosts=$DIR/hosts
+scan interleaved   seed=7,loss=0.05,down=0.1,open=0.05 -p 1-100 -j 500 -t 2
+scan ordered       seed=7,loss=0.05,down=0.1,open=0.05 -p 1-100 -j 500 -t 2 --ordered
+scan verbose       seed=3,open=0.2 -p 20-30 -t 1 -v
+scan retries       seed=5,loss=0.3,open=0.1 -p 1-50 -j 100 -t 1 --retries 2 --ordered
+scan frequency     seed=9,open=0.1 --top 20 -j 200 -t 1 --order frequency --ordered
+scan limits        seed=11,down=0.3,open=0.3 -p 1-60 -j 50 -t 1 --max-open-per-host 2 --down-after 5 --ordered
+scan silent        seed=2,open=0.3,banner=0-0 -p 1-10 -j 100 -t 1
+scan deadline      seed=4,open=0.1,down=0.2 -p 1-1000 -j 50 -t 1 --deadline 20 --ordered
+
+hosts=$DIR/localhost
+scan rdns          seed=1,open=0.5 -p 1-8 -t 1 --rdns -v
+
+exit $failed
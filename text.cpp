@@ -0,0 +1,389 @@
+/**
+ * @file   text.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Vectorized scanning and sanitization of banners.
+ *
+ * Kernels are implemented for AVX2 and SSE2 with a scalar fallback, the best
+ * one supported by the CPU is chosen at runtime.
+ */
+
+#include "text.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define TEXT_X86 1
+# include <immintrin.h>
+#endif
+
+/**
+ * @brief Set of scanning kernels.
+ */
+class Kernel {
+  public:
+    size_t (* eol)(const char * data, size_t len);
+    size_t (* printable)(const char * data, size_t len);
+    const char * name;
+};
+
+/**
+ * Find first CR or LF.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the terminator, len if there is none
+ */
+static size_t scan_eol_scalar(const char * data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] == '\n' || data[i] == '\r')
+            return i;
+    }
+
+    return len;
+}
+
+/**
+ * Check if byte can be written as it is (printable ASCII except backslash).
+ *
+ * @param c byte
+ * @return true if the byte is safe
+ */
+static inline bool is_safe(unsigned char c)
+{
+    return c >= 0x20 && c < 0x7f && c != '\\';
+}
+
+/**
+ * Find first byte which is not safe to be written as it is.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the byte, len if all bytes are safe
+ */
+static size_t scan_printable_scalar(const char * data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (! is_safe(data[i]))
+            return i;
+    }
+
+    return len;
+}
+
+#if defined(TEXT_X86) && defined(__SSE2__)
+/**
+ * Find first CR or LF, SSE2 version.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the terminator, len if there is none
+ */
+static size_t scan_eol_sse2(const char * data, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, nl),
+                                                       _mm_cmpeq_epi8(v, cr)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + scan_eol_scalar(data + i, len - i);
+}
+
+/**
+ * Find first byte which is not safe to be written as it is, SSE2 version.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the byte, len if all bytes are safe
+ */
+static size_t scan_printable_sse2(const char * data, size_t len)
+{
+    // signed compare, bytes >= 0x80 are negative and fail it as well
+    const __m128i space = _mm_set1_epi8(0x1f);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i bs = _mm_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(v, del), _mm_cmpeq_epi8(v, bs));
+        __m128i ok = _mm_andnot_si128(bad, _mm_cmpgt_epi8(v, space));
+        unsigned mask = _mm_movemask_epi8(ok);
+
+        if (mask != 0xffff)
+            return i + __builtin_ctz(~mask);
+    }
+
+    return i + scan_printable_scalar(data + i, len - i);
+}
+
+/**
+ * Find first CR or LF, AVX2 version.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the terminator, len if there is none
+ */
+__attribute__((target("avx2")))
+static size_t scan_eol_avx2(const char * data, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+                                                             _mm256_cmpeq_epi8(v, cr)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + scan_eol_sse2(data + i, len - i);
+}
+
+/**
+ * Find first byte which is not safe to be written as it is, AVX2 version.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the byte, len if all bytes are safe
+ */
+__attribute__((target("avx2")))
+static size_t scan_printable_avx2(const char * data, size_t len)
+{
+    const __m256i space = _mm256_set1_epi8(0x1f);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i bs = _mm256_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i bad = _mm256_or_si256(_mm256_cmpeq_epi8(v, del), _mm256_cmpeq_epi8(v, bs));
+        __m256i ok = _mm256_andnot_si256(bad, _mm256_cmpgt_epi8(v, space));
+        unsigned mask = _mm256_movemask_epi8(ok);
+
+        if (mask != 0xffffffffu)
+            return i + __builtin_ctz(~mask);
+    }
+
+    return i + scan_printable_sse2(data + i, len - i);
+}
+#endif
+
+/**
+ * Find kernel by name.
+ *
+ * @param name kernel name ("scalar", "sse2" or "avx2")
+ * @param kernel found kernel
+ * @return false if the kernel is not built or not supported by the CPU
+ */
+static bool find_kernel(const char * name, Kernel & kernel)
+{
+    if (! strcmp(name, "scalar")) {
+        kernel.eol = scan_eol_scalar;
+        kernel.printable = scan_printable_scalar;
+        kernel.name = "scalar";
+        return true;
+    }
+
+#if defined(TEXT_X86) && defined(__SSE2__)
+    if (! strcmp(name, "sse2")) {
+        kernel.eol = scan_eol_sse2;
+        kernel.printable = scan_printable_sse2;
+        kernel.name = "sse2";
+        return true;
+    }
+
+    __builtin_cpu_init();
+    if (! strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+        kernel.eol = scan_eol_avx2;
+        kernel.printable = scan_printable_avx2;
+        kernel.name = "avx2";
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+/**
+ * Choose the best kernel supported by the CPU.
+ *
+ * @return kernel
+ */
+static Kernel select_kernel()
+{
+    static const char * const kPreferred[] = { "avx2", "sse2", "scalar" };
+    Kernel kernel;
+
+    // scalar kernel is always found
+    for (size_t i = 0; ! find_kernel(kPreferred[i], kernel); ++i)
+        continue;
+
+    return kernel;
+}
+
+/**
+ * Access kernel in use, chosen for this CPU unless text_select() was called.
+ *
+ * @return kernel
+ */
+static Kernel & kernel()
+{
+    static Kernel instance = select_kernel();
+    return instance;
+}
+
+/**
+ * Get length of valid UTF-8 sequence of a printable non-ASCII character.
+ *
+ * @param data bytes starting with a byte >= 0x80
+ * @param len count of bytes
+ * @return length of the sequence, 0 if it is not valid or it is a C1 control
+ */
+static size_t utf8_sequence(const char * data, size_t len)
+{
+    const unsigned char * s = reinterpret_cast<const unsigned char *>(data);
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+    size_t n;
+
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+        // U+0080 - U+009F are control characters
+        if (s[0] == 0xc2)
+            lo = 0xa0;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        if (s[0] == 0xe0)
+            lo = 0xa0;
+        else if (s[0] == 0xed)
+            hi = 0x9f;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        if (s[0] == 0xf0)
+            lo = 0x90;
+        else if (s[0] == 0xf4)
+            hi = 0x8f;
+    } else
+        return 0;
+
+    if (len < n || s[1] < lo || s[1] > hi)
+        return 0;
+
+    for (size_t i = 2; i < n; ++i) {
+        if (s[i] < 0x80 || s[i] > 0xbf)
+            return 0;
+    }
+
+    return n;
+}
+
+/**
+ * Find first CR or LF.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the terminator, len if there is none
+ */
+size_t scan_eol(const char * data, size_t len)
+{
+    return kernel().eol(data, len);
+}
+
+/**
+ * Find first byte which is not printable ASCII or which is a backslash.
+ *
+ * @param data bytes to scan
+ * @param len count of bytes
+ * @return index of the byte, len if there is none
+ */
+size_t scan_printable(const char * data, size_t len)
+{
+    return kernel().printable(data, len);
+}
+
+/**
+ * Make banner safe to be written to terminal. Printable ASCII and valid UTF-8
+ * is kept, backslash is doubled and other bytes are written as \xNN.
+ *
+ * @param out sanitized banner
+ * @param data banner
+ * @param len length of banner
+ * @return void
+ */
+void escape_banner(std::string & out, const char * data, size_t len)
+{
+    static const char kHex[] = "0123456789abcdef";
+
+    out.clear();
+    out.reserve(len);
+
+    for (size_t i = 0; i < len; ) {
+        size_t run = scan_printable(data + i, len - i);
+
+        out.append(data + i, run);
+        i += run;
+
+        if (i == len)
+            break;
+
+        unsigned char c = data[i];
+
+        if (c == '\\') {
+            out.append("\\\\");
+            ++i;
+            continue;
+        }
+
+        if (c >= 0x80) {
+            size_t n = utf8_sequence(data + i, len - i);
+
+            if (n) {
+                out.append(data + i, n);
+                i += n;
+                continue;
+            }
+        }
+
+        char esc[4] = { '\\', 'x', kHex[c >> 4], kHex[c & 0xf] };
+        out.append(esc, sizeof(esc));
+        ++i;
+    }
+}
+
+/**
+ * Get name of kernel chosen for this CPU.
+ *
+ * @return kernel name
+ */
+const char * text_kernel()
+{
+    return kernel().name;
+}
+
+/**
+ * Use given kernel instead of the one chosen for this CPU, checks compare
+ * kernels this way. Not to be called while other threads scan text.
+ *
+ * @param name kernel name ("scalar", "sse2" or "avx2")
+ * @return false if the kernel is not built or not supported by the CPU
+ */
+bool text_select(const char * name)
+{
+    Kernel found;
+
+    if (! find_kernel(name, found))
+        return false;
+
+    kernel() = found;
+    return true;
+}
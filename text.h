@@ -0,0 +1,21 @@
+/**
+ * @file   text.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Vectorized scanning and sanitization of banners.
+ */
+
+#ifndef TEXT_H_
+#define TEXT_H_
+
+#include "tcpsearch.h"
+
+#include <cstddef>
+#include <string>
+
+size_t scan_eol(const char * data, size_t len);
+size_t scan_printable(const char * data, size_t len);
+void   escape_banner(std::string & out, const char * data, size_t len);
+const char * text_kernel();
+bool         text_select(const char * name);
+
+#endif // TEXT_H_
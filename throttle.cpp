@@ -0,0 +1,182 @@
+/**
+ * @file   throttle.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Per-subnet probe rate limiting.
+ */
+
+#include "throttle.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+#include <netinet/in.h>
+
+/**
+ * Tokens taken by one probe, buckets gain rate tokens per millisecond.
+ */
+static const uint64_t kTokenCost = 1000;
+
+/**
+ * Buckets hold at most tokens for this many milliseconds of probes.
+ */
+static const uint64_t kBurstWindow = 10;
+
+/**
+ * Constructor.
+ *
+ * @param rate probes per second allowed to each subnet
+ * @param prefix4 prefix length of IPv4 subnets
+ * @param prefix6 prefix length of IPv6 subnets
+ */
+SubnetThrottle::SubnetThrottle(unsigned rate, unsigned prefix4, unsigned prefix6)
+{
+    assert(rate > 0);
+    assert(prefix4 <= 32 && prefix6 <= 128);
+
+    m_rate = rate;
+    m_prefix4 = prefix4;
+    m_prefix6 = prefix6;
+    m_capacity = std::max(kTokenCost, static_cast<uint64_t>(rate) * kBurstWindow);
+}
+
+/**
+ * Destructor.
+ */
+SubnetThrottle::~SubnetThrottle()
+{
+}
+
+/**
+ * Get key of subnet of address.
+ *
+ * @param addr address
+ * @return address family and masked address bytes
+ */
+std::string SubnetThrottle::subnet(const Address & addr) const
+{
+    const unsigned char * bytes;
+    unsigned prefix;
+    size_t len;
+
+    if (addr.addr.ss_family == AF_INET6) {
+        const sockaddr_in6 * in6 = reinterpret_cast<const sockaddr_in6 *>(&addr.addr);
+        bytes = in6->sin6_addr.s6_addr;
+        len = sizeof(in6->sin6_addr.s6_addr);
+        prefix = m_prefix6;
+    } else {
+        const sockaddr_in * in = reinterpret_cast<const sockaddr_in *>(&addr.addr);
+        bytes = reinterpret_cast<const unsigned char *>(&in->sin_addr.s_addr);
+        len = sizeof(in->sin_addr.s_addr);
+        prefix = m_prefix4;
+    }
+
+    std::string key(1, static_cast<char>(addr.addr.ss_family));
+
+    for (size_t i = 0; i < len && prefix > 0; ++i) {
+        unsigned bits = std::min(prefix, 8u);
+        key += static_cast<char>(bytes[i] & (0xff00 >> bits));
+        prefix -= bits;
+    }
+
+    return key;
+}
+
+/**
+ * Drop unused buckets which had time to refill, a new bucket of their
+ * subnet does not let more probes through then.
+ *
+ * @param now current time
+ * @return void
+ */
+void SubnetThrottle::expire(msec_t now)
+{
+    while (! m_unused.empty()) {
+        bucketmap_t::iterator it = m_buckets.find(m_unused.front());
+
+        // bucket used again keeps its place by its later release
+        if (it != m_buckets.end() && it->second.users == 0) {
+            if (it->second.expires > now)
+                break;
+
+            m_buckets.erase(it);
+        }
+
+        m_unused.pop_front();
+    }
+}
+
+/**
+ * Get bucket of subnet of address, it is shared by all targets in the subnet.
+ *
+ * @param addr target address
+ * @return bucket, has to be released by release()
+ */
+Bucket * SubnetThrottle::acquire(const Address & addr)
+{
+    expire(Engine::now());
+
+    std::string key = subnet(addr);
+    bucketmap_t::iterator it = m_buckets.find(key);
+
+    if (it == m_buckets.end()) {
+        Bucket bucket;
+        // new subnet starts with a single probe, not with a burst
+        bucket.tokens = kTokenCost;
+        bucket.stamp = 0;
+        bucket.users = 0;
+        bucket.expires = 0;
+        bucket.subnet = key;
+
+        it = m_buckets.insert(std::make_pair(key, bucket)).first;
+    }
+
+    ++it->second.users;
+
+    return &it->second;
+}
+
+/**
+ * Release bucket. Unused bucket is kept until it refills, otherwise the next
+ * target of its subnet would get a fresh bucket and probes sent by
+ * the previous targets would not count.
+ *
+ * @param bucket bucket obtained by acquire()
+ * @return void
+ */
+void SubnetThrottle::release(Bucket * bucket)
+{
+    assert(bucket->users > 0);
+
+    if (--bucket->users == 0) {
+        // empty bucket is full after this time at the latest
+        bucket->expires = Engine::now() + (m_capacity + m_rate - 1) / m_rate;
+        m_unused.push_back(bucket->subnet);
+    }
+}
+
+/**
+ * Take token for a probe.
+ *
+ * @param bucket bucket of target subnet
+ * @param now current time
+ * @return 0 if probe can be run, otherwise time when a token is available
+ */
+msec_t SubnetThrottle::take(Bucket * bucket, msec_t now)
+{
+    if (bucket->stamp == 0)
+        bucket->stamp = now;
+
+    if (now > bucket->stamp) {
+        uint64_t gained = (now - bucket->stamp) * m_rate;
+        bucket->tokens = std::min(m_capacity, bucket->tokens + gained);
+        bucket->stamp = now;
+    }
+
+    if (bucket->tokens >= kTokenCost) {
+        bucket->tokens -= kTokenCost;
+        return 0;
+    }
+
+    return now + (kTokenCost - bucket->tokens + m_rate - 1) / m_rate;
+}
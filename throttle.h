@@ -0,0 +1,61 @@
+/**
+ * @file   throttle.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  Per-subnet probe rate limiting.
+ */
+
+#ifndef THROTTLE_H_
+#define THROTTLE_H_
+
+#include "tcpsearch.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "resolver.h"
+
+/**
+ * @brief Token bucket of one subnet.
+ */
+class Bucket {
+  public:
+    uint64_t    tokens; ///<! available tokens, kTokenCost per probe
+    msec_t      stamp;  ///<! time of the last refill
+    unsigned    users;  ///<! count of targets in the subnet
+    msec_t      expires;///<! time when unused bucket is refilled and dropped
+    std::string subnet; ///<! key of the bucket
+};
+
+/**
+ * @brief Token buckets keyed by subnet of target address.
+ */
+class SubnetThrottle {
+  public:
+    SubnetThrottle(unsigned rate, unsigned prefix4, unsigned prefix6);
+    ~SubnetThrottle();
+
+    Bucket * acquire(const Address & addr);
+    void     release(Bucket * bucket);
+    msec_t   take(Bucket * bucket, msec_t now);
+
+  private:
+    typedef std::map<std::string, Bucket> bucketmap_t;
+
+    std::string subnet(const Address & addr) const;
+    void        expire(msec_t now);
+
+    unsigned    m_rate;       ///<! probes per second per subnet
+    unsigned    m_prefix4;    ///<! prefix length of IPv4 subnets
+    unsigned    m_prefix6;    ///<! prefix length of IPv6 subnets
+    uint64_t    m_capacity;   ///<! maximum tokens in bucket
+    bucketmap_t m_buckets;    ///<! buckets of subnets with targets and
+                              ///<! unused ones still refilling
+    std::deque<std::string> m_unused; ///<! keys of unused buckets, in order
+                                      ///<! of their release
+
+    // dissallow copy and assign
+    DISABLE_COPY_AND_ASSIGN(SubnetThrottle);
+}; // class SubnetThrottle
+
+#endif // THROTTLE_H_
@@ -0,0 +1,718 @@
+/**
+ * @file   tls.cpp
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  TLS handshake metadata extraction without a TLS stack.
+ *
+ * A fixed ClientHello offering TLS 1.2 at most is sent, so the server's
+ * certificate comes in plaintext (TLS 1.3 encrypts it). Records received
+ * are parsed up to the first certificate, which is walked as DER to get its
+ * subject, alternative names and expiry. Nothing is verified.
+ */
+
+#include "tls.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/**
+ * Types of TLS records.
+ */
+static const unsigned char kRecordCcs = 20;
+static const unsigned char kRecordAlert = 21;
+static const unsigned char kRecordHandshake = 22;
+static const unsigned char kRecordData = 23;
+
+/**
+ * Types of handshake messages.
+ */
+static const unsigned char kServerHello = 2;
+static const unsigned char kCertificate = 11;
+static const unsigned char kServerHelloDone = 14;
+
+/**
+ * Longest record allowed, including compression and encryption overhead.
+ */
+static const size_t kMaxRecord = 16384 + 2048;
+
+/**
+ * Cipher suites offered in ClientHello, most preferred first.
+ */
+static const unsigned short kCiphers[] = {
+    0xc02f, 0xc030, 0xc02b, 0xc02c, 0xcca8, 0xcca9, 0xc013, 0xc014,
+    0xc009, 0xc00a, 0x009e, 0x009f, 0x009c, 0x009d, 0x002f, 0x0035,
+    0x000a, 0x00ff
+};
+
+/**
+ * @brief Name of a cipher suite.
+ */
+class CipherName {
+  public:
+    unsigned short id;
+    const char   * name;
+};
+
+static const CipherName kCipherNames[] = {
+    { 0x000a, "DES-CBC3-SHA" },
+    { 0x002f, "AES128-SHA" },
+    { 0x0035, "AES256-SHA" },
+    { 0x009c, "AES128-GCM-SHA256" },
+    { 0x009d, "AES256-GCM-SHA384" },
+    { 0x009e, "DHE-RSA-AES128-GCM-SHA256" },
+    { 0x009f, "DHE-RSA-AES256-GCM-SHA384" },
+    { 0x1301, "TLS_AES_128_GCM_SHA256" },
+    { 0x1302, "TLS_AES_256_GCM_SHA384" },
+    { 0x1303, "TLS_CHACHA20_POLY1305_SHA256" },
+    { 0xc009, "ECDHE-ECDSA-AES128-SHA" },
+    { 0xc00a, "ECDHE-ECDSA-AES256-SHA" },
+    { 0xc013, "ECDHE-RSA-AES128-SHA" },
+    { 0xc014, "ECDHE-RSA-AES256-SHA" },
+    { 0xc02b, "ECDHE-ECDSA-AES128-GCM-SHA256" },
+    { 0xc02c, "ECDHE-ECDSA-AES256-GCM-SHA384" },
+    { 0xc02f, "ECDHE-RSA-AES128-GCM-SHA256" },
+    { 0xc030, "ECDHE-RSA-AES256-GCM-SHA384" },
+    { 0xcca8, "ECDHE-RSA-CHACHA20-POLY1305" },
+    { 0xcca9, "ECDHE-ECDSA-CHACHA20-POLY1305" }
+};
+
+/**
+ * @brief Name of a subject attribute, identified by the last byte of its
+ *        object identifier 2.5.4.x.
+ */
+class AttributeName {
+  public:
+    unsigned char id;
+    const char  * name;
+};
+
+static const AttributeName kAttributeNames[] = {
+    { 3,  "CN" },
+    { 6,  "C" },
+    { 7,  "L" },
+    { 8,  "ST" },
+    { 10, "O" },
+    { 11, "OU" }
+};
+
+/**
+ * Object identifier 2.5.29.17 of subject alternative name extension.
+ */
+static const unsigned char kOidSan[] = { 0x55, 0x1d, 0x11 };
+
+/**
+ * Append big-endian 16 bit number.
+ *
+ * @param out where to append
+ * @param value number
+ * @return void
+ */
+static void put16(std::string & out, size_t value)
+{
+    out += static_cast<char>((value >> 8) & 0xff);
+    out += static_cast<char>(value & 0xff);
+}
+
+/**
+ * Overwrite big-endian number in place.
+ *
+ * @param out buffer
+ * @param pos position of the number
+ * @param bytes size of the number
+ * @param value number
+ * @return void
+ */
+static void patch(std::string & out, size_t pos, unsigned bytes, size_t value)
+{
+    for (unsigned i = 0; i < bytes; ++i)
+        out[pos + i] = static_cast<char>((value >> (8 * (bytes - 1 - i))) & 0xff);
+}
+
+/**
+ * Get big-endian number.
+ *
+ * @param p bytes
+ * @param bytes size of the number
+ * @return number
+ */
+static size_t get(const unsigned char * p, unsigned bytes)
+{
+    size_t value = 0;
+
+    for (unsigned i = 0; i < bytes; ++i)
+        value = (value << 8) | p[i];
+
+    return value;
+}
+
+/**
+ * Build ClientHello record.
+ *
+ * @param host name sent as server name indication, empty for none
+ * @return record
+ */
+static std::string build_client_hello(const std::string & host)
+{
+    std::string out;
+
+    // record header, length is patched below
+    out.append("\x16\x03\x01\0\0", 5);
+
+    // handshake header, length is patched below
+    out.append("\x01\0\0\0", 4);
+
+    // client_version, random and empty session id
+    out.append("\x03\x03", 2);
+    for (unsigned i = 0; i < 32; ++i)
+        out += static_cast<char>(i * 7 + 1);
+    out += '\0';
+
+    put16(out, sizeof(kCiphers));
+    for (size_t i = 0; i < sizeof(kCiphers) / sizeof(kCiphers[0]); ++i)
+        put16(out, kCiphers[i]);
+
+    // null compression only
+    out.append("\x01\x00", 2);
+
+    size_t extensions = out.size();
+    out.append("\0\0", 2);
+
+    if (! host.empty()) {
+        put16(out, 0x0000);
+        put16(out, host.size() + 5);
+        put16(out, host.size() + 3);
+        out += '\0';
+        put16(out, host.size());
+        out += host;
+    }
+
+    // supported_groups: x25519, secp256r1, secp384r1
+    out.append("\x00\x0a\x00\x08\x00\x06\x00\x1d\x00\x17\x00\x18", 12);
+
+    // ec_point_formats: uncompressed
+    out.append("\x00\x0b\x00\x02\x01\x00", 6);
+
+    // signature_algorithms: RSA PKCS#1, ECDSA, RSA-PSS, SHA-1 fallbacks
+    out.append("\x00\x0d\x00\x18\x00\x16"
+               "\x04\x01\x05\x01\x06\x01\x04\x03\x05\x03\x06\x03"
+               "\x08\x04\x08\x05\x08\x06\x02\x01\x02\x03", 28);
+
+    patch(out, extensions, 2, out.size() - extensions - 2);
+    patch(out, 6, 3, out.size() - 9);
+    patch(out, 3, 2, out.size() - 5);
+
+    return out;
+}
+
+/**
+ * Get ClientHello to be sent to a server.
+ *
+ * @param host host name, used as server name indication unless it is
+ *             a numeric address
+ * @return record
+ */
+std::string tls_client_hello(const std::string & host)
+{
+    static const std::string anonymous = build_client_hello(std::string());
+
+    unsigned char addr[sizeof(struct in6_addr)];
+
+    if (host.empty() || host.size() > 255
+            || inet_pton(AF_INET, host.c_str(), addr) == 1
+            || inet_pton(AF_INET6, host.c_str(), addr) == 1)
+        return anonymous;
+
+    return build_client_hello(host);
+}
+
+/**
+ * Constructor.
+ */
+TlsInfo::TlsInfo()
+{
+    records = 0;
+    version = 0;
+    cipher = 0;
+    hello = false;
+    cert = false;
+    alert = -1;
+}
+
+/**
+ * Read DER element.
+ *
+ * @param p position in buffer, moved past the element
+ * @param end end of buffer
+ * @param tag tag of the element
+ * @param value contents of the element
+ * @param len length of the contents
+ * @return false if the element is malformed
+ */
+static bool der_next(const unsigned char *& p, const unsigned char * end,
+                     unsigned & tag, const unsigned char *& value, size_t & len)
+{
+    if (end - p < 2)
+        return false;
+
+    tag = *p++;
+    len = *p++;
+
+    if (len & 0x80) {
+        unsigned bytes = len & 0x7f;
+
+        if (! bytes || bytes > 4 || static_cast<size_t>(end - p) < bytes)
+            return false;
+
+        len = get(p, bytes);
+        p += bytes;
+    }
+
+    if (static_cast<size_t>(end - p) < len)
+        return false;
+
+    value = p;
+    p += len;
+
+    return true;
+}
+
+/**
+ * Parse distinguished name.
+ *
+ * @param p contents of Name
+ * @param end end of contents
+ * @param out attributes, e.g. "CN=host,O=org"
+ * @return void
+ */
+static void der_name(const unsigned char * p, const unsigned char * end, std::string & out)
+{
+    unsigned tag;
+    const unsigned char * set;
+    size_t set_len;
+
+    while (der_next(p, end, tag, set, set_len)) {
+        const unsigned char * attr_end = set + set_len;
+        const unsigned char * attr;
+        size_t attr_len;
+
+        while (der_next(set, attr_end, tag, attr, attr_len)) {
+            const unsigned char * q = attr;
+            const unsigned char * q_end = attr + attr_len;
+            const unsigned char * oid, * value;
+            size_t oid_len, value_len;
+
+            if (! der_next(q, q_end, tag, oid, oid_len) || tag != 0x06
+                    || ! der_next(q, q_end, tag, value, value_len))
+                continue;
+
+            // only textual attributes 2.5.4.x are printed
+            if (oid_len != 3 || oid[0] != 0x55 || oid[1] != 0x04 || tag == 0x1e)
+                continue;
+
+            for (size_t i = 0; i < sizeof(kAttributeNames) / sizeof(kAttributeNames[0]); ++i) {
+                if (kAttributeNames[i].id != oid[2])
+                    continue;
+
+                if (! out.empty())
+                    out += ',';
+
+                out += kAttributeNames[i].name;
+                out += '=';
+                out.append(reinterpret_cast<const char *>(value), value_len);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Format UTCTime or GeneralizedTime as a date.
+ *
+ * @param tag type of time
+ * @param p contents
+ * @param len length of contents
+ * @param out date, e.g. "2030-01-31"
+ * @return void
+ */
+static void der_time(unsigned tag, const unsigned char * p, size_t len, std::string & out)
+{
+    const char * s = reinterpret_cast<const char *>(p);
+
+    if (tag == 0x17 && len >= 6) {
+        // two-digit years 50 to 99 belong to 20th century
+        out = (s[0] >= '5') ? "19" : "20";
+        out.append(s, 2);
+        s += 2;
+    } else if (tag == 0x18 && len >= 8) {
+        out.assign(s, 4);
+        s += 4;
+    } else
+        return;
+
+    out += '-';
+    out.append(s, 2);
+    out += '-';
+    out.append(s + 2, 2);
+}
+
+/**
+ * Parse subject alternative names.
+ *
+ * @param p contents of GeneralNames
+ * @param end end of contents
+ * @param out comma-separated names
+ * @return void
+ */
+static void der_san(const unsigned char * p, const unsigned char * end, std::string & out)
+{
+    unsigned tag;
+    const unsigned char * value;
+    size_t len;
+
+    while (der_next(p, end, tag, value, len)) {
+        std::string name;
+
+        if (tag == 0x82) {
+            // dNSName
+            name.assign(reinterpret_cast<const char *>(value), len);
+        } else if (tag == 0x87 && (len == 4 || len == 16)) {
+            // iPAddress
+            char str[INET6_ADDRSTRLEN];
+
+            if (inet_ntop(len == 4 ? AF_INET : AF_INET6, value, str, sizeof(str)))
+                name = str;
+        }
+
+        if (name.empty())
+            continue;
+
+        if (! out.empty())
+            out += ',';
+
+        out += name;
+    }
+}
+
+/**
+ * Parse X.509 certificate.
+ *
+ * @param p DER encoded certificate
+ * @param len length of certificate
+ * @param info where to store subject, names and expiry
+ * @return false if the certificate is malformed
+ */
+static bool der_certificate(const unsigned char * p, size_t len, TlsInfo & info)
+{
+    const unsigned char * end = p + len;
+    const unsigned char * value;
+    size_t value_len;
+    unsigned tag;
+
+    // Certificate and TBSCertificate
+    if (! der_next(p, end, tag, value, value_len) || tag != 0x30)
+        return false;
+
+    p = value;
+    end = value + value_len;
+
+    if (! der_next(p, end, tag, value, value_len) || tag != 0x30)
+        return false;
+
+    p = value;
+    end = value + value_len;
+
+    // optional version
+    if (! der_next(p, end, tag, value, value_len))
+        return false;
+
+    // serial number, signature, issuer
+    if (tag == 0xa0 && ! der_next(p, end, tag, value, value_len))
+        return false;
+
+    if (! der_next(p, end, tag, value, value_len) || ! der_next(p, end, tag, value, value_len))
+        return false;
+
+    // validity, only notAfter is interesting
+    if (! der_next(p, end, tag, value, value_len) || tag != 0x30)
+        return false;
+
+    const unsigned char * q = value;
+    const unsigned char * q_end = value + value_len;
+
+    if (der_next(q, q_end, tag, value, value_len) && der_next(q, q_end, tag, value, value_len))
+        der_time(tag, value, value_len, info.expires);
+
+    // subject
+    if (! der_next(p, end, tag, value, value_len) || tag != 0x30)
+        return false;
+
+    der_name(value, value + value_len, info.subject);
+
+    // subject public key info, optional unique identifiers and extensions
+    while (der_next(p, end, tag, value, value_len)) {
+        if (tag != 0xa3)
+            continue;
+
+        const unsigned char * ext_end = value + value_len;
+        const unsigned char * ext;
+        size_t ext_len;
+
+        if (! der_next(value, ext_end, tag, ext, ext_len) || tag != 0x30)
+            break;
+
+        ext_end = ext + ext_len;
+
+        while (der_next(ext, ext_end, tag, value, value_len)) {
+            const unsigned char * e = value;
+            const unsigned char * e_end = value + value_len;
+            const unsigned char * oid;
+            size_t oid_len;
+
+            if (! der_next(e, e_end, tag, oid, oid_len) || tag != 0x06
+                    || oid_len != sizeof(kOidSan) || memcmp(oid, kOidSan, oid_len))
+                continue;
+
+            // skip critical flag
+            if (! der_next(e, e_end, tag, value, value_len))
+                continue;
+
+            if (tag == 0x01 && ! der_next(e, e_end, tag, value, value_len))
+                continue;
+
+            // OCTET STRING with GeneralNames
+            const unsigned char * names;
+            size_t names_len;
+
+            if (tag == 0x04 && der_next(value, value + value_len, tag, names, names_len)
+                    && tag == 0x30)
+                der_san(names, names + names_len, info.san);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Parse ServerHello message.
+ *
+ * @param p contents of message
+ * @param len length of contents
+ * @param info where to store version and cipher
+ * @return false if the message is malformed
+ */
+static bool parse_server_hello(const unsigned char * p, size_t len, TlsInfo & info)
+{
+    const unsigned char * end = p + len;
+
+    // version, random and session id length
+    if (len < 35 || len < 35 + static_cast<size_t>(p[34]) + 3)
+        return false;
+
+    info.version = get(p, 2);
+    p += 35 + p[34];
+    info.cipher = get(p, 2);
+    p += 3;
+    info.hello = true;
+
+    if (end - p < 2)
+        return true;
+
+    size_t extensions = get(p, 2);
+    p += 2;
+
+    if (static_cast<size_t>(end - p) < extensions)
+        return false;
+
+    end = p + extensions;
+
+    while (end - p >= 4) {
+        unsigned type = get(p, 2);
+        size_t ext_len = get(p + 2, 2);
+        p += 4;
+
+        if (static_cast<size_t>(end - p) < ext_len)
+            return false;
+
+        // supported_versions carries TLS 1.3
+        if (type == 0x002b && ext_len == 2)
+            info.version = get(p, 2);
+
+        p += ext_len;
+    }
+
+    return true;
+}
+
+/**
+ * Parse Certificate message, only the server's own certificate is read.
+ *
+ * @param p contents of message
+ * @param len length of contents
+ * @param info where to store certificate details
+ * @return false if the message is malformed
+ */
+static bool parse_certificate(const unsigned char * p, size_t len, TlsInfo & info)
+{
+    if (len < 6)
+        return false;
+
+    size_t list = get(p, 3);
+    size_t cert = get(p + 3, 3);
+
+    // list holds at least the length of the first certificate, checked
+    // first so the subtraction below cannot wrap
+    if (list < 3 || list > len - 3 || cert > list - 3)
+        return false;
+
+    info.cert = der_certificate(p + 6, cert, info);
+
+    return info.cert;
+}
+
+/**
+ * Parse data received from a server so far. The whole buffer is parsed on
+ * every call, so data may be appended between calls.
+ *
+ * @param data received data
+ * @param len length of data
+ * @param info parsed metadata
+ * @return TLS_DONE if the handshake got past the certificate or failed,
+ *         TLS_MORE if more data is needed, TLS_ERROR if data are not TLS
+ */
+tls_status_t tls_parse(const char * data, size_t len, TlsInfo & info)
+{
+    const unsigned char * buf = reinterpret_cast<const unsigned char *>(data);
+    std::string handshake;
+    size_t offset = 0;
+    size_t pos = 0;
+
+    info = TlsInfo();
+
+    while (pos < len) {
+        // check the header as soon as possible, so plain banners are told
+        // apart without waiting
+        if (buf[pos] < kRecordCcs || buf[pos] > kRecordData
+                || (len - pos >= 2 && buf[pos + 1] != 3))
+            return TLS_ERROR;
+
+        if (len - pos < 5)
+            break;
+
+        size_t record = get(buf + pos + 3, 2);
+        if (record > kMaxRecord)
+            return TLS_ERROR;
+
+        if (len - pos - 5 < record)
+            break;
+
+        const unsigned char * payload = buf + pos + 5;
+        unsigned char type = buf[pos];
+
+        pos += 5 + record;
+        ++info.records;
+
+        if (type == kRecordAlert) {
+            if (record >= 2)
+                info.alert = payload[1];
+
+            return TLS_DONE;
+        }
+
+        // the rest of the handshake is encrypted
+        if (type != kRecordHandshake)
+            return TLS_DONE;
+
+        handshake.append(reinterpret_cast<const char *>(payload), record);
+
+        // messages may span records
+        while (handshake.size() - offset >= 4) {
+            const unsigned char * msg =
+                reinterpret_cast<const unsigned char *>(handshake.data()) + offset;
+            size_t msg_len = get(msg + 1, 3);
+
+            if (handshake.size() - offset - 4 < msg_len)
+                break;
+
+            offset += 4 + msg_len;
+
+            switch (msg[0]) {
+                case kServerHello:
+                    if (! parse_server_hello(msg + 4, msg_len, info))
+                        return TLS_ERROR;
+                    break;
+
+                case kCertificate:
+                    parse_certificate(msg + 4, msg_len, info);
+                    return TLS_DONE;
+
+                case kServerHelloDone:
+                    return TLS_DONE;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    return TLS_MORE;
+}
+
+/**
+ * Describe handshake as a service banner, e.g.
+ * "TLSv1.2 ECDHE-RSA-AES128-GCM-SHA256 subject=CN=host san=host expires=2030-01-31".
+ *
+ * @param info parsed metadata
+ * @return description
+ */
+std::string tls_describe(const TlsInfo & info)
+{
+    char str[32];
+    std::string out;
+
+    if (! info.hello) {
+        if (info.alert >= 0) {
+            snprintf(str, sizeof(str), "TLS alert %d", info.alert);
+            return str;
+        }
+
+        return "TLS";
+    }
+
+    if (info.version == 0x0300)
+        out = "SSLv3";
+    else if (info.version > 0x0300 && info.version <= 0x0304) {
+        snprintf(str, sizeof(str), "TLSv1.%u", info.version - 0x0301);
+        out = str;
+    } else {
+        snprintf(str, sizeof(str), "TLS 0x%04x", info.version);
+        out = str;
+    }
+
+    const char * cipher = NULL;
+    for (size_t i = 0; i < sizeof(kCipherNames) / sizeof(kCipherNames[0]); ++i) {
+        if (kCipherNames[i].id == info.cipher)
+            cipher = kCipherNames[i].name;
+    }
+
+    if (! cipher) {
+        snprintf(str, sizeof(str), "0x%04x", info.cipher);
+        cipher = str;
+    }
+
+    out += ' ';
+    out += cipher;
+
+    if (! info.subject.empty())
+        out += " subject=" + info.subject;
+
+    if (! info.san.empty())
+        out += " san=" + info.san;
+
+    if (! info.expires.empty())
+        out += " expires=" + info.expires;
+
+    return out;
+}
@@ -0,0 +1,46 @@
+/**
+ * @file   tls.h
+ * @author Fridolin Pokorny fridex.devel@gmail.com
+ * @brief  TLS handshake metadata extraction without a TLS stack.
+ */
+
+#ifndef TLS_H_
+#define TLS_H_
+
+#include "tcpsearch.h"
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Metadata of server's side of TLS handshake.
+ */
+class TlsInfo {
+  public:
+    TlsInfo();
+
+    unsigned    records;    ///<! count of complete TLS records
+    unsigned    version;    ///<! negotiated version, 0 if unknown
+    unsigned    cipher;     ///<! negotiated cipher suite
+    bool        hello;      ///<! ServerHello was parsed
+    bool        cert;       ///<! certificate was parsed
+    int         alert;      ///<! alert description, -1 if none
+    std::string subject;    ///<! subject of certificate, e.g. "CN=host,O=org"
+    std::string san;        ///<! comma-separated subject alternative names
+    std::string expires;    ///<! end of validity, e.g. "2030-01-31"
+};
+
+/**
+ * @brief Progress of parsing.
+ */
+enum tls_status_t {
+    TLS_MORE,       ///<! more data is needed
+    TLS_DONE,       ///<! nothing more to be learned
+    TLS_ERROR       ///<! data is not TLS or is malformed
+};
+
+std::string  tls_client_hello(const std::string & host);
+tls_status_t tls_parse(const char * data, size_t len, TlsInfo & info);
+std::string  tls_describe(const TlsInfo & info);
+
+#endif // TLS_H_